@@ -0,0 +1,110 @@
+#pragma once
+
+#include "Types.h"
+#include "Allocator.h"
+
+// Bump allocator over a chain of chunks taken from a backing allocator.
+// Frees are no-ops for its own memory and forwarded for anything else, so
+// it can release objects that were only borrowed from longer-lived storage.
+// Everything it handed out goes away at once when it is destroyed.
+class ArenaAllocator : public Allocator
+{
+public:
+	explicit ArenaAllocator(Allocator* backing)
+		: m_backing(backing)
+	{}
+
+	~ArenaAllocator() override
+	{
+		Chunk* chunk = m_chunks;
+		while (chunk)
+		{
+			Chunk* prev = chunk->prev;
+			m_backing->freeSizeKnown(chunk, chunk->size);
+			chunk = prev;
+		}
+	}
+
+	ArenaAllocator(const ArenaAllocator&) = delete;
+	ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+	void* alloc(i32 size) override
+	{
+		size = (size + 15) & ~15;
+
+		if (m_chunks == nullptr || m_pos + size > m_chunks->size)
+		{
+			grow(size);
+		}
+
+		void* result = (u8*)m_chunks + m_pos;
+		m_pos += size;
+		return result;
+	}
+
+	void free(void* block) override
+	{
+		if (block && !owns(block))
+		{
+			m_backing->free(block);
+		}
+	}
+
+	void freeSizeKnown(void* block, i32 size) override
+	{
+		if (block && !owns(block))
+		{
+			m_backing->freeSizeKnown(block, size);
+		}
+	}
+
+	// Chunks double in size, so this only walks a handful of them.
+	bool owns(const void* block) const
+	{
+		for (const Chunk* chunk = m_chunks; chunk; chunk = chunk->prev)
+		{
+			if (block >= (const u8*)chunk && block < (const u8*)chunk + chunk->size)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	Allocator* backing() const { return m_backing; }
+
+private:
+	struct Chunk
+	{
+		Chunk* prev;
+		i32 size;
+		i32 _pad;
+	};
+
+	static constexpr i32 FirstChunkSize = 16 * 1024;
+	static constexpr i32 MaxChunkSize = 8 * 1024 * 1024;
+
+	void grow(i32 size)
+	{
+		i32 chunkSize = m_chunks ? m_chunks->size * 2 : FirstChunkSize;
+		if (chunkSize > MaxChunkSize)
+		{
+			chunkSize = MaxChunkSize;
+		}
+		if (chunkSize < size + i32(sizeof(Chunk)))
+		{
+			chunkSize = size + i32(sizeof(Chunk));
+		}
+
+		Chunk* chunk = (Chunk*)m_backing->alloc(chunkSize);
+		chunk->prev = m_chunks;
+		chunk->size = chunkSize;
+		m_chunks = chunk;
+		m_pos = sizeof(Chunk);
+	}
+
+	Allocator* m_backing;
+	Chunk* m_chunks = nullptr;
+	i32 m_pos = 0;
+};
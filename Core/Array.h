@@ -66,6 +66,13 @@ public:
 	void resize(i32 new_size);
 	void reserve(i32 new_capacity);
 
+	// Grows without constructing the new elements, the caller writes them.
+	void resize_uninit(i32 new_size);
+
+	// Shrinks without destroying the dropped elements, the caller moved them
+	// elsewhere or never constructed them.
+	void shrink_uninit(i32 new_size);
+
 	void swap(Array<T>& other);
 
 	void clear();
@@ -202,6 +209,27 @@ void Array<T>::resize(i32 new_size)
 	m_size = new_size;
 }
 
+template <typename T>
+void Array<T>::resize_uninit(i32 new_size)
+{
+	assert(new_size >= m_size);
+
+	if (new_size > m_capacity)
+	{
+		reserve(new_size);
+	}
+
+	m_size = new_size;
+}
+
+template <typename T>
+void Array<T>::shrink_uninit(i32 new_size)
+{
+	assert(new_size <= m_size);
+
+	m_size = new_size;
+}
+
 template <typename T>
 void Array<T>::reserve(i32 new_capacity)
 {
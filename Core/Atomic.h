@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "Types.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Interlocked ops on plain integers, for counters living in memcpy'd structs
+// where std::atomic members would not be allowed.
+
+inline u32 atomicIncrement(u32* value)
+{
+#if defined(_MSC_VER)
+	return u32(_InterlockedIncrement((volatile long*)value));
+#else
+	return __atomic_add_fetch(value, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+inline u32 atomicDecrement(u32* value)
+{
+#if defined(_MSC_VER)
+	return u32(_InterlockedDecrement((volatile long*)value));
+#else
+	return __atomic_sub_fetch(value, 1, __ATOMIC_ACQ_REL);
+#endif
+}
+
+class SpinLock
+{
+public:
+	void lock()
+	{
+		// back off to the scheduler so a preempted holder can get to unlock
+		for (u32 spins = 0; m_flag.test_and_set(std::memory_order_acquire); ++spins)
+		{
+			if (spins < 64)
+			{
+#if defined(_MSC_VER)
+				_mm_pause();
+#endif
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	void unlock()
+	{
+		m_flag.clear(std::memory_order_release);
+	}
+
+private:
+	std::atomic_flag m_flag = ATOMIC_FLAG_INIT;
+};
+
+class ScopedSpinLock
+{
+public:
+	explicit ScopedSpinLock(SpinLock& lock)
+		: m_lock(lock)
+	{
+		m_lock.lock();
+	}
+
+	~ScopedSpinLock()
+	{
+		m_lock.unlock();
+	}
+
+	ScopedSpinLock(const ScopedSpinLock&) = delete;
+	ScopedSpinLock& operator=(const ScopedSpinLock&) = delete;
+
+private:
+	SpinLock& m_lock;
+};
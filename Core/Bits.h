@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Types.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+inline u32 popCount(u32 bits)
+{
+#if defined(_MSC_VER)
+	return __popcnt(bits);
+#else
+	return u32(__builtin_popcount(bits));
+#endif
+}
+
+// Index of the lowest set bit, bits must not be 0.
+inline u32 countTrailingZeros(u64 bits)
+{
+#if defined(_MSC_VER) && defined(_M_IX86)
+	// no 64 bit scan on x86, the low half first
+	unsigned long index;
+	if (_BitScanForward(&index, u32(bits)))
+	{
+		return u32(index);
+	}
+	_BitScanForward(&index, u32(bits >> 32));
+	return u32(index) + 32;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return u32(index);
+#else
+	return u32(__builtin_ctzll(bits));
+#endif
+}
+
+// Asks for the cache line holding address ahead of a read.
+inline void prefetch(const void* address)
+{
+#if defined(_MSC_VER) && defined(_M_ARM64)
+	__prefetch(address);
+#elif defined(_MSC_VER)
+	_mm_prefetch((const char*)address, _MM_HINT_T0);
+#else
+	__builtin_prefetch(address);
+#endif
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "StringView.h"
+#include "Types.h"
+#include "../mh64.h"
+
+// Hash policies turning a key into the bits a table indexes with. Tables index
+// with the low bits, so a policy has to leave them well spread.
+
+// The key as it is, for keys that are already random such as truth::Key.
+struct HashIdentity
+{
+	static u64 hash(u64 key) { return key; }
+};
+
+// One multiply folding the high half down, for keys whose low bits are fixed
+// or that differ only in their high bits, like shifted handles. Costs sequential
+// ids a little, which the identity already spreads evenly.
+struct HashMix
+{
+	static u64 hash(u64 key)
+	{
+		u64 h = key * 0x9e3779b97f4a7c15ull;
+		return h ^ (h >> 32);
+	}
+};
+
+// MetroHash64 of the key's bytes, for keys adversarial enough to beat HashMix.
+struct HashMetro
+{
+	static u64 hash(u64 key)
+	{
+		return MetroHash64::Hash((const u8*)&key, sizeof(key));
+	}
+};
+
+// MetroHash64 of the characters.
+struct HashString
+{
+	static u64 hash(StringView str)
+	{
+		return MetroHash64::Hash(str.data, str.size);
+	}
+};
+
+// Policy a table picks when it is not given one.
+template<typename K>
+struct DefaultHash
+{
+	using Type = HashMix;
+};
+
+template<>
+struct DefaultHash<StringView>
+{
+	using Type = HashString;
+};
+
+template<typename K>
+struct KeyEqual
+{
+	static bool equal(const K& a, const K& b) { return a == b; }
+};
@@ -3,22 +3,132 @@
 #include <assert.h>
 
 #include "Allocator.h"
+#include "ArenaAllocator.h"
 #include "Array.h"
+#include "Bits.h"
+#include "Hash.h"
 
 using u32 = unsigned int;
 using u64 = unsigned long long;
 
-template<typename T>
-struct HashMap
+// Shape of a chained table, for spotting clustering. The last bin also counts
+// everything past it.
+struct HashMapHistogram
+{
+	constexpr static i32 Bins = 16;
+
+	// chainLength[i] buckets hold i entries
+	u32 chainLength[Bins];
+
+	// probeCount[i] entries are found on the (i + 1)th key compare
+	u32 probeCount[Bins];
+
+	i32 longestChain;
+	float averageProbes;
+};
+
+// Where a table keeps its keys. Plain keys live in the entries as they are.
+template<typename K>
+struct KeyStorage
+{
+	constexpr static bool Owns = false;
+
+	void set_allocator(Allocator*) {}
+
+	K store(K key) { return key; }
+};
+
+// String keys are copied into an arena the table owns, so a key only has to
+// outlive the insert. Erased keys' characters stay until the table goes away.
+template<>
+struct KeyStorage<StringView>
+{
+	constexpr static bool Owns = true;
+
+	KeyStorage() = default;
+
+	KeyStorage(KeyStorage&& r)
+		: m_allocator(r.m_allocator)
+		, m_arena(r.m_arena)
+	{
+		r.m_arena = nullptr;
+	}
+
+	KeyStorage& operator=(KeyStorage&& rhs)
+	{
+		if (&rhs != this)
+		{
+			release();
+			m_allocator = rhs.m_allocator;
+			m_arena = rhs.m_arena;
+			rhs.m_arena = nullptr;
+		}
+
+		return *this;
+	}
+
+	~KeyStorage()
+	{
+		release();
+	}
+
+	void set_allocator(Allocator* a)
+	{
+		m_allocator = a;
+	}
+
+	StringView store(StringView key)
+	{
+		if (m_arena == nullptr)
+		{
+			m_arena = create<ArenaAllocator>(m_allocator, m_allocator);
+		}
+
+		char* chars = (char*)m_arena->alloc(i32(key.size));
+		memcpy(chars, key.data, key.size);
+		return StringView(chars, key.size);
+	}
+
+	void release()
+	{
+		if (m_arena)
+		{
+			destroy(*m_allocator, m_arena);
+			m_arena = nullptr;
+		}
+	}
+
+	Allocator* m_allocator = nullptr;
+	ArenaAllocator* m_arena = nullptr;
+};
+
+// Chained hash table over any small key type Hash and Eq know how to handle.
+// Keys are passed by value, for strings a StringView of the caller's characters,
+// so a lookup copies nothing and only an insert stores the key.
+template<typename K, typename T, typename Hash = typename DefaultHash<K>::Type, typename Eq = KeyEqual<K>>
+struct KeyedHashMap
 {
 private:
 constexpr static u32 END_OF_CHAIN = u32(-1);
 
+// Keys find_many works ahead by, a key's bucket head is prefetched this many
+// keys before its entry is, and its entry as many keys before the compare.
+constexpr static i32 PREFETCH_DISTANCE = 8;
+
+// Buckets an incremental rehash moves over per write. A grow at n entries has
+// n / m_maxLoadFactor buckets to move and n inserts until the next grow.
+constexpr static i32 REHASH_STEP = 4;
+
+// Entries an incremental grow of m_data moves to the new block per write. It
+// doubles at n entries and has n inserts until it is full again.
+constexpr static i32 MOVE_STEP = 4;
+
 struct HashFind
 {
 	u32 hashIndex;
 	u32 dataPrev;
 	u32 dataIndex;
+	bool old;
 };
 
 struct Entry
@@ -29,7 +139,7 @@ struct Entry
 
 	static constexpr bool has_clone = sizeof(test_clone((T*)0)) == 1;
 
-	u64 key;
+	K key;
 	u32 next;
 	T value;
 
@@ -86,34 +196,62 @@ public:
 		i32 index;
 	};	
 
-	explicit HashMap(Allocator* allocator)
+	explicit KeyedHashMap(Allocator* allocator)
 		: m_hash(allocator)
 		, m_data(allocator)
+		, m_oldHash(allocator)
+		, m_oldData(allocator)
 	{
-
+		m_keys.set_allocator(allocator);
 	}
 
-	explicit HashMap()
+	explicit KeyedHashMap()
 	{
 
 	}
 
+	~KeyedHashMap();
+
+	KeyedHashMap(KeyedHashMap&& r) = default;
+	KeyedHashMap& operator=(KeyedHashMap&& rhs) = default;
+
 	void set_allocator(Allocator* a);
 
-	T* find(u64 key);
-	const T* find(u64 key) const;
+	// Entries per bucket before the bucket array doubles.
+	void set_max_load_factor(float loadFactor);
+
+	// Spreads growth over the writes that follow it. The bucket array and
+	// m_data still double at once, but chains and entries move to them a few
+	// per write and lookups check the old ones until then. Pointers to values
+	// then stay valid only until the next write.
+	void set_incremental_rehash(bool incremental);
+
+	T* find(K key);
+	const T* find(K key) const;
 
-	bool contains(u64 key) const;
+	// find() of count keys into out, prefetching the buckets and entries of the
+	// keys ahead so their misses overlap instead of following one another.
+	void find_many(const K* keys, T** out, i32 count);
 
-	void add(u64 key, T value);
+	bool contains(K key) const;
 
-	void insert_or_assign(u64 key, const T& value);
+	// Sizes m_data and the buckets for count entries, so inserting up to that
+	// many neither reallocates nor rehashes.
+	void reserve(i32 count);
 
-	void insert_or_assign(u64 key, T&& value);
+	// Replaces the contents with count entries, sized once and linked in one
+	// pass without lookups. Keys must be unique.
+	void buildFrom(const K* keys, const T* values, i32 count);
 
-	void erase(u64 key);
+	void add(K key, T value);
 
-	T& operator[](u64 key);
+	void insert_or_assign(K key, const T& value);
+
+	void insert_or_assign(K key, T&& value);
+
+	void erase(K key);
+
+	T& operator[](K key);
 
 	i32 size() const;
 
@@ -121,41 +259,122 @@ public:
 
 	Entry* end();
 
+	const Entry* begin() const;
+
+	const Entry* end() const;
+
 	Entry* data();
 
-	HashMap clone() const;
+	KeyedHashMap clone() const;
+
+	HashMapHistogram histogram() const;
 
 private:
-	HashFind find_impl(u64 key);
+	HashFind find_impl(K key);
 
 	void erase_impl(HashFind find);
 
-	i32 add_entry(u64 key);
+	i32 add_entry(K key);
 
-	i32 find_or_make(u64 key);
+	i32 find_or_make(K key);
 
 	bool is_full();
 
+	i32 buckets_for(i32 count) const;
+
 	void grow();
 
 	void rehash(i32 new_size);
 
+	void rehash_step(i32 buckets);
+
+	bool rehashing() const;
+
+	Array<u32>& heads(const HashFind& find);
+
+	void link(u32 dataIndex);
+
+	void start_move();
+
+	void move_step(i32 entries);
+
+	bool moving() const;
+
+	void pop_entry();
+
+	// Entry dataIndex wherever it is, in m_oldData until a move has taken it.
+	Entry& entry(u32 dataIndex)
+	{
+		return i32(dataIndex) < m_oldData.size() && i32(dataIndex) >= m_moveCursor ? m_oldData[dataIndex] : m_data[dataIndex];
+	}
+
+	const Entry& entry(u32 dataIndex) const
+	{
+		return i32(dataIndex) < m_oldData.size() && i32(dataIndex) >= m_moveCursor ? m_oldData[dataIndex] : m_data[dataIndex];
+	}
+
 	Array<u32> m_hash;
 	Array<Entry> m_data;
+	float m_maxLoadFactor = 0.7f;
+
+	// buckets an incremental rehash is moving out of, from m_rehashCursor on
+	Array<u32> m_oldHash;
+	i32 m_rehashCursor = 0;
+	bool m_incremental = false;
+
+	// block m_data grew out of, its entries from m_moveCursor on are not moved yet
+	Array<Entry> m_oldData;
+	i32 m_moveCursor = 0;
+
+	KeyStorage<K> m_keys;
 };
 
-template <typename T>
-void HashMap<T>::set_allocator(Allocator* a)
+// The table everything keyed by ids uses.
+template<typename T, typename Hash = HashMix>
+using HashMap = KeyedHashMap<u64, T, Hash>;
+
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::set_allocator(Allocator* a)
 {
 	assert(m_data.get_allocator() == nullptr);
 	assert(m_hash.get_allocator() == nullptr);
 
 	m_data.set_allocator(a);
 	m_hash.set_allocator(a);
+	m_oldHash.set_allocator(a);
+	m_oldData.set_allocator(a);
+	m_keys.set_allocator(a);
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::set_max_load_factor(float loadFactor)
+{
+	assert(loadFactor > 0.0f);
+
+	m_maxLoadFactor = loadFactor;
 }
 
-template <typename T>
-T* HashMap<T>::find(u64 key)
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::set_incremental_rehash(bool incremental)
+{
+	if (!incremental)
+	{
+		rehash_step(m_oldHash.size());
+		move_step(m_oldData.size());
+	}
+
+	m_incremental = incremental;
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+KeyedHashMap<K, T, Hash, Eq>::~KeyedHashMap()
+{
+	// m_data destroys what it holds, which has to be every entry
+	move_step(m_oldData.size());
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+T* KeyedHashMap<K, T, Hash, Eq>::find(K key)
 {
 	HashFind find = find_impl(key);
 	if (find.dataIndex == END_OF_CHAIN)
@@ -163,26 +382,121 @@ T* HashMap<T>::find(u64 key)
 		return nullptr;
 	}
 
-	return &m_data[find.dataIndex].value;
+	return &entry(find.dataIndex).value;
 }
 
-template <typename T>
-const T* HashMap<T>::find(u64 key) const
+template <typename K, typename T, typename Hash, typename Eq>
+const T* KeyedHashMap<K, T, Hash, Eq>::find(K key) const
 {
-	HashMap* self = (HashMap*)this;
+	KeyedHashMap* self = (KeyedHashMap*)this;
 	return self->find(key);
 }
 
-template <typename T>
-bool HashMap<T>::contains(u64 key) const
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::find_many(const K* keys, T** out, i32 count)
+{
+	// the buckets and entries an incremental grow has not moved yet are not worth the pipeline
+	if (m_hash.empty() || rehashing() || moving())
+	{
+		for (i32 i = 0; i < count; ++i)
+		{
+			out[i] = find(keys[i]);
+		}
+		return;
+	}
+
+	constexpr i32 Ring = PREFETCH_DISTANCE * 2;
+	u32 heads[Ring];
+
+	const u32 mask = u32(m_hash.size() - 1);
+	for (i32 i = 0; i < count + 2 * PREFETCH_DISTANCE; ++i)
+	{
+		if (i < count)
+		{
+			prefetch(&m_hash[Hash::hash(keys[i]) & mask]);
+		}
+
+		const i32 headAt = i - PREFETCH_DISTANCE;
+		if (headAt >= 0 && headAt < count)
+		{
+			const u32 head = m_hash[Hash::hash(keys[headAt]) & mask];
+			if (head != END_OF_CHAIN)
+			{
+				prefetch(&m_data[head]);
+			}
+			heads[headAt % Ring] = head;
+		}
+
+		const i32 findAt = i - 2 * PREFETCH_DISTANCE;
+		if (findAt >= 0)
+		{
+			out[findAt] = nullptr;
+			for (u32 e = heads[findAt % Ring]; e != END_OF_CHAIN; e = m_data[e].next)
+			{
+				if (Eq::equal(m_data[e].key, keys[findAt]))
+				{
+					out[findAt] = &m_data[e].value;
+					break;
+				}
+			}
+		}
+	}
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+bool KeyedHashMap<K, T, Hash, Eq>::contains(K key) const
 {
-	HashMap* self = (HashMap*)this;
+	KeyedHashMap* self = (KeyedHashMap*)this;
 	HashFind find = self->find_impl(key);
 	return find.dataIndex != END_OF_CHAIN;
 }
 
-template <typename T>
-void HashMap<T>::add(u64 key, T value)
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::reserve(i32 count)
+{
+	rehash_step(m_oldHash.size());
+	move_step(m_oldData.size());
+
+	m_data.reserve(count);
+
+	const i32 buckets = buckets_for(count);
+	if (buckets > m_hash.size())
+	{
+		rehash(buckets);
+	}
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::buildFrom(const K* keys, const T* values, i32 count)
+{
+	Array<u32> done(m_hash.get_allocator());
+	m_oldHash.swap(done);
+	m_rehashCursor = 0;
+	move_step(m_oldData.size());
+
+	m_data.clear();
+	m_data.reserve(count);
+
+	for (i32 i = 0; i < count; ++i)
+	{
+		Entry* e = new (m_data.push_back_uninit()) Entry();
+		e->key = m_keys.store(keys[i]);
+		if constexpr (Entry::has_clone)
+		{
+			e->value = values[i].clone();
+		}
+		else
+		{
+			e->value = values[i];
+		}
+	}
+
+	const i32 buckets = buckets_for(count);
+	rehash(buckets > m_hash.size() ? buckets : m_hash.size());
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::add(K key, T value)
 {
 	if (m_hash.empty())
 		grow();
@@ -194,56 +508,71 @@ void HashMap<T>::add(u64 key, T value)
 	u32 i = add_entry(key);
 	if (fr.dataPrev == END_OF_CHAIN)
 	{
-		m_hash[fr.hashIndex] = i;
+		heads(fr)[fr.hashIndex] = i;
 	}
 	else
 	{
-		m_data[fr.dataPrev].next = i;
+		entry(fr.dataPrev).next = i;
 	}
 
-	memcpy(&m_data[i].value, &value, sizeof(T));
+	memcpy(&entry(i).value, &value, sizeof(T));
 	memset(&value, 0, sizeof(T));
 
 	if (is_full())
 	{
 		grow();
 	}
+	else
+	{
+		rehash_step(REHASH_STEP);
+	}
+	move_step(MOVE_STEP);
 }
 
-template <typename T>
-void HashMap<T>::insert_or_assign(u64 key, const T& value)
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::insert_or_assign(K key, const T& value)
 {
 	T copy = value;
 	insert_or_assign(key, (T&&)copy);
 }
 
-template <typename T>
-void HashMap<T>::insert_or_assign(u64 key, T&& value)
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::insert_or_assign(K key, T&& value)
 {
 	if (m_hash.empty())
 		grow();
 
 	const u32 i = find_or_make(key);
 
-	memcpy(&m_data[i].value, &value, sizeof(T));
+	// the value already there, or the default one a new entry starts with
+	entry(i).value.~T();
+	memcpy(&entry(i).value, &value, sizeof(T));
 	memset(&value, 0, sizeof(T));
 
 	if (is_full())
 	{
 		grow();
 	}
+	else
+	{
+		rehash_step(REHASH_STEP);
+	}
+	move_step(MOVE_STEP);
 }
 
-template <typename T>
-void HashMap<T>::erase(u64 key)
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::erase(K key)
 {
 	const HashFind find = find_impl(key);
 	if (find.dataIndex != END_OF_CHAIN)
 		erase_impl(find);
+
+	rehash_step(REHASH_STEP);
+	move_step(MOVE_STEP);
 }
 
-template <typename T>
-T& HashMap<T>::operator[](u64 key)
+template <typename K, typename T, typename Hash, typename Eq>
+T& KeyedHashMap<K, T, Hash, Eq>::operator[](K key)
 {
 	if (m_hash.empty())
 		grow();
@@ -255,114 +584,209 @@ T& HashMap<T>::operator[](u64 key)
 		grow();
 		i = find_or_make(key);
 	}
+	else
+	{
+		// only relinks chains, the entry stays where it is
+		rehash_step(REHASH_STEP);
+	}
+	move_step(MOVE_STEP);
 
-	return m_data[i].value;
+	return entry(i).value;
 }
 
-template <typename T>
-i32 HashMap<T>::size() const
+template <typename K, typename T, typename Hash, typename Eq>
+i32 KeyedHashMap<K, T, Hash, Eq>::size() const
 {
 	return m_data.size();
 }
 
-template <typename T>
-typename HashMap<T>::Entry* HashMap<T>::begin()
+template <typename K, typename T, typename Hash, typename Eq>
+typename KeyedHashMap<K, T, Hash, Eq>::Entry* KeyedHashMap<K, T, Hash, Eq>::begin()
 {
+	// a walk over the entries costs more than moving the rest of them
+	move_step(m_oldData.size());
 	return m_data.begin();
 }
 
-template <typename T>
-typename HashMap<T>::Entry* HashMap<T>::end()
+template <typename K, typename T, typename Hash, typename Eq>
+typename KeyedHashMap<K, T, Hash, Eq>::Entry* KeyedHashMap<K, T, Hash, Eq>::end()
 {
+	move_step(m_oldData.size());
 	return m_data.end();
 }
 
-template <typename T>
-typename HashMap<T>::Entry* HashMap<T>::data()
+template <typename K, typename T, typename Hash, typename Eq>
+const typename KeyedHashMap<K, T, Hash, Eq>::Entry* KeyedHashMap<K, T, Hash, Eq>::begin() const
 {
+	KeyedHashMap* self = (KeyedHashMap*)this;
+	return self->begin();
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+const typename KeyedHashMap<K, T, Hash, Eq>::Entry* KeyedHashMap<K, T, Hash, Eq>::end() const
+{
+	KeyedHashMap* self = (KeyedHashMap*)this;
+	return self->end();
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+typename KeyedHashMap<K, T, Hash, Eq>::Entry* KeyedHashMap<K, T, Hash, Eq>::data()
+{
+	move_step(m_oldData.size());
 	return m_data.data();
 }
 
-template <typename T>
-HashMap<T> HashMap<T>::clone() const
+template <typename K, typename T, typename Hash, typename Eq>
+KeyedHashMap<K, T, Hash, Eq> KeyedHashMap<K, T, Hash, Eq>::clone() const
 {
-	HashMap clone(m_hash.get_allocator());
+	KeyedHashMap* self = (KeyedHashMap*)this;
+	self->move_step(m_oldData.size());
+
+	KeyedHashMap clone(m_hash.get_allocator());
+	clone.m_maxLoadFactor = m_maxLoadFactor;
 	clone.m_data = m_data.clone();
 	clone.m_hash = m_hash.clone();
+	clone.m_oldHash = m_oldHash.clone();
+	clone.m_rehashCursor = m_rehashCursor;
+	clone.m_incremental = m_incremental;
+
+	// the copied entries still point at this table's key storage
+	if constexpr (KeyStorage<K>::Owns)
+	{
+		for (Entry& e : clone.m_data)
+		{
+			e.key = clone.m_keys.store(e.key);
+		}
+	}
 
 	return clone;
 }
 
+template <typename K, typename T, typename Hash, typename Eq>
+HashMapHistogram KeyedHashMap<K, T, Hash, Eq>::histogram() const
+{
+	HashMapHistogram h = {};
+	u64 probes = 0;
+
+	auto count = [&](u32 head)
+	{
+		i32 length = 0;
+		for (u32 e = head; e != END_OF_CHAIN; e = entry(e).next)
+		{
+			++h.probeCount[length < HashMapHistogram::Bins ? length : HashMapHistogram::Bins - 1];
+			probes += u64(length + 1);
+			++length;
+		}
+
+		++h.chainLength[length < HashMapHistogram::Bins ? length : HashMapHistogram::Bins - 1];
+		h.longestChain = length > h.longestChain ? length : h.longestChain;
+	};
+
+	// while rehashing, the old buckets from the cursor on stand in for the new
+	// ones they have not been moved to yet
+	for (i32 i = 0; i < m_hash.size(); ++i)
+	{
+		if (!rehashing() || (i & (m_oldHash.size() - 1)) < m_rehashCursor)
+		{
+			count(m_hash[i]);
+		}
+	}
+
+	for (i32 i = rehashing() ? m_rehashCursor : m_oldHash.size(); i < m_oldHash.size(); ++i)
+	{
+		count(m_oldHash[i]);
+	}
 
-template <typename T>
-typename HashMap<T>::HashFind HashMap<T>::find_impl(u64 key)
+	h.averageProbes = m_data.empty() ? 0.0f : float(double(probes) / m_data.size());
+	return h;
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+typename KeyedHashMap<K, T, Hash, Eq>::HashFind KeyedHashMap<K, T, Hash, Eq>::find_impl(K key)
 {
 	HashFind find;
 	find.hashIndex = END_OF_CHAIN;
 	find.dataPrev = END_OF_CHAIN;
 	find.dataIndex = END_OF_CHAIN;
+	find.old = false;
 
 	if (m_hash.empty())
 		return find;
 
-	find.hashIndex = key & (m_hash.size() - 1);
-	find.dataIndex = m_hash[find.hashIndex];
+	const u64 hash = Hash::hash(key);
+
+	// buckets the rehash has not reached yet still hold their chains
+	if (rehashing() && i32(hash & (m_oldHash.size() - 1)) >= m_rehashCursor)
+	{
+		find.old = true;
+	}
+
+	const Array<u32>& table = heads(find);
+	find.hashIndex = hash & (table.size() - 1);
+	find.dataIndex = table[find.hashIndex];
 	while (find.dataIndex != END_OF_CHAIN)
 	{
-		if (m_data[find.dataIndex].key == key)
+		const Entry& e = entry(find.dataIndex);
+		if (Eq::equal(e.key, key))
 		{
 			return find;
 		}
 		find.dataPrev = find.dataIndex;
-		find.dataIndex = m_data[find.dataIndex].next;
+		find.dataIndex = e.next;
 	}
 
 	return find;
 }
 
-template <typename T>
-void HashMap<T>::erase_impl(HashFind find)
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::erase_impl(HashFind find)
 {
 	if (find.dataPrev == END_OF_CHAIN)
-		m_hash[find.hashIndex] = m_data[find.dataIndex].next;
+		heads(find)[find.hashIndex] = entry(find.dataIndex).next;
 	else
-		m_data[find.dataPrev].next = m_data[find.dataIndex].next;
+		entry(find.dataPrev).next = entry(find.dataIndex).next;
 
 	if (find.dataIndex == u32(m_data.size() - 1))
 	{
-		m_data.resize(m_data.size() - 1);
+		pop_entry();
 		return;
 	}
 
-	m_data[find.dataIndex] = m_data[m_data.size() - 1];
-	HashFind last = find_impl(m_data[find.dataIndex].key);
+	entry(find.dataIndex) = entry(u32(m_data.size() - 1));
+	HashFind last = find_impl(entry(find.dataIndex).key);
 
 	if (last.dataPrev != END_OF_CHAIN)
 	{
-		m_data[last.dataPrev].next = find.dataIndex;
+		entry(last.dataPrev).next = find.dataIndex;
 	}
 	else
 	{
-		m_hash[last.hashIndex] = find.dataIndex;
+		heads(last)[last.hashIndex] = find.dataIndex;
 	}
 
-	m_data.resize(m_data.size() - 1);
+	pop_entry();
 }
 
-template <typename T>
-i32 HashMap<T>::add_entry(u64 key)
+template <typename K, typename T, typename Hash, typename Eq>
+i32 KeyedHashMap<K, T, Hash, Eq>::add_entry(K key)
 {
+	// a full m_data grows into a new block the next writes move entries to
+	if (m_incremental && m_data.size() == m_data.capacity() && !m_data.empty())
+	{
+		start_move();
+	}
+
 	u32 ei = m_data.size();
 
-	HashMap<T>::Entry* e = new (m_data.push_back_uninit()) HashMap<T>::Entry();
-	e->key = key;
+	KeyedHashMap<K, T, Hash, Eq>::Entry* e = new (m_data.push_back_uninit()) KeyedHashMap<K, T, Hash, Eq>::Entry();
+	e->key = m_keys.store(key);
 	e->next = END_OF_CHAIN;
 
 	return ei;
 }
 
-template <typename T>
-i32 HashMap<T>::find_or_make(u64 key)
+template <typename K, typename T, typename Hash, typename Eq>
+i32 KeyedHashMap<K, T, Hash, Eq>::find_or_make(K key)
 {
 	const HashFind fr = find_impl(key);
 	if (fr.dataIndex != END_OF_CHAIN)
@@ -371,63 +795,185 @@ i32 HashMap<T>::find_or_make(u64 key)
 	u32 i = add_entry(key);
 	if (fr.dataPrev == END_OF_CHAIN)
 	{
-		m_hash[fr.hashIndex] = i;
+		heads(fr)[fr.hashIndex] = i;
 	}
 	else
 	{
-		m_data[fr.dataPrev].next = i;
+		entry(fr.dataPrev).next = i;
 	}
 
 	return i;
 }
 
-template <typename T>
-bool HashMap<T>::is_full()
+template <typename K, typename T, typename Hash, typename Eq>
+bool KeyedHashMap<K, T, Hash, Eq>::is_full()
+{
+	return (float)m_data.size() >= (float)m_hash.size() * m_maxLoadFactor;
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+i32 KeyedHashMap<K, T, Hash, Eq>::buckets_for(i32 count) const
 {
-	constexpr float kMaxLoadFactor = 0.7f;
-	return (float)m_data.size() >= (float)m_hash.size() * kMaxLoadFactor;
+	i32 buckets = 16;
+	while ((float)count >= (float)buckets * m_maxLoadFactor)
+	{
+		buckets *= 2;
+	}
+
+	return buckets;
 }
 
-template <typename T>
-void HashMap<T>::grow()
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::grow()
 {
 	if (m_hash.size() == 0)
 	{
 		rehash(16);
+		return;
 	}
-	else
+
+	// a rehash still under way finishes before the next one starts
+	rehash_step(m_oldHash.size());
+
+	const i32 newSize = m_hash.size() * 2;
+	if (!m_incremental)
 	{
-		const u32 newSize = m_hash.size() * 2;
 		rehash(newSize);
+		return;
 	}
+
+	// a doubled table takes old bucket i's chain into buckets i and i + old size,
+	// so those are cleared only when bucket i moves and nothing is written here
+	m_oldHash.swap(m_hash);
+	m_hash.clear();
+	m_hash.resize_uninit(newSize);
+	m_rehashCursor = 0;
 }
 
-template <typename T>
-void HashMap<T>::rehash(i32 new_size)
+// Entries stay where they are, only the chains are relinked into the new
+// bucket heads.
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::rehash(i32 new_size)
 {
-	HashMap<T> nh(m_data.get_allocator());
+	m_hash.clear();
+	m_hash.resize_uninit(new_size);
+	memset(m_hash.data(), 0xff, new_size * sizeof(u32));
 
-	nh.m_hash.resize(new_size);
-	nh.m_hash.reserve(m_data.size());
+	for (i32 i = 0; i < m_data.size(); ++i)
+	{
+		link(u32(i));
+	}
+}
 
-	for (i32 i = 0; i < new_size; ++i)
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::rehash_step(i32 buckets)
+{
+	if (!rehashing())
 	{
-		nh.m_hash[i] = END_OF_CHAIN;
+		return;
 	}
 
-	for (i32 i = 0; i < m_data.size(); ++i)
+	const i32 end = m_rehashCursor + buckets < m_oldHash.size() ? m_rehashCursor + buckets : m_oldHash.size();
+	for (; m_rehashCursor < end; ++m_rehashCursor)
 	{
-		auto& e = m_data[i];
-		nh.insert_or_assign(e.key, static_cast<T&&>(e.value));
+		m_hash[m_rehashCursor] = END_OF_CHAIN;
+		m_hash[m_rehashCursor + m_oldHash.size()] = END_OF_CHAIN;
+
+		u32 e = m_oldHash[m_rehashCursor];
+		while (e != END_OF_CHAIN)
+		{
+			const u32 next = entry(e).next;
+			link(e);
+			e = next;
+		}
 	}
 
-	if (m_hash.empty())
+	if (m_rehashCursor == m_oldHash.size())
 	{
-		m_hash.swap(nh.m_hash);
+		Array<u32> done(m_hash.get_allocator());
+		m_oldHash.swap(done);
+		m_rehashCursor = 0;
 	}
-	else
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+bool KeyedHashMap<K, T, Hash, Eq>::rehashing() const
+{
+	return m_rehashCursor < m_oldHash.size();
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+Array<u32>& KeyedHashMap<K, T, Hash, Eq>::heads(const HashFind& find)
+{
+	return find.old ? m_oldHash : m_hash;
+}
+
+// Pushes an entry onto the front of its chain in m_hash.
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::link(u32 dataIndex)
+{
+	Entry& e = entry(dataIndex);
+	const u32 bucket = Hash::hash(e.key) & (m_hash.size() - 1);
+	e.next = m_hash[bucket];
+	m_hash[bucket] = dataIndex;
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::start_move()
+{
+	// a move still under way finishes before the next one starts
+	move_step(m_oldData.size());
+
+	// m_data keeps its size, the entries below it stay in m_oldData until moved
+	m_oldData.swap(m_data);
+	m_data.reserve(m_oldData.capacity() * 2);
+	m_data.resize_uninit(m_oldData.size());
+	m_moveCursor = 0;
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::move_step(i32 entries)
+{
+	if (m_oldData.empty())
+	{
+		return;
+	}
+
+	const i32 end = m_moveCursor + entries < m_oldData.size() ? m_moveCursor + entries : m_oldData.size();
+	memcpy((void*)&m_data[m_moveCursor], (const void*)&m_oldData[m_moveCursor], (end - m_moveCursor) * sizeof(Entry));
+	m_moveCursor = end;
+
+	if (m_moveCursor == m_oldData.size())
+	{
+		// every entry was moved out by memcpy, none is left to destroy
+		m_oldData.shrink_uninit(0);
+		Array<Entry> done(m_data.get_allocator());
+		m_oldData.swap(done);
+		m_moveCursor = 0;
+	}
+}
+
+template <typename K, typename T, typename Hash, typename Eq>
+bool KeyedHashMap<K, T, Hash, Eq>::moving() const
+{
+	return m_moveCursor < m_oldData.size();
+}
+
+// Destroys the last entry, which sits in m_oldData while a move has not taken
+// it, and then ends that block.
+template <typename K, typename T, typename Hash, typename Eq>
+void KeyedHashMap<K, T, Hash, Eq>::pop_entry()
+{
+	const i32 last = m_data.size() - 1;
+	if (!moving() || last >= m_oldData.size())
 	{
-		m_data.swap(nh.m_data);
-		m_hash.swap(nh.m_hash);
+		m_data.resize(last);
+		return;
 	}
+
+	m_oldData.resize(last);
+	m_data.shrink_uninit(last);
+
+	// ends the move when that was the last entry left in m_oldData
+	move_step(0);
 }
@@ -0,0 +1,738 @@
+#pragma once
+
+#include <assert.h>
+#include <string.h>
+#include <type_traits>
+
+#include "Allocator.h"
+#include "Atomic.h"
+#include "Types.h"
+
+// Array whose copies share structure. Elements sit in leaves of Width items
+// below a tree indexed by position. clone() shares the whole tree and a write
+// copies only the nodes on its path that another copy still holds, so
+// push_back, insert, erase and set cost O(log n) in time and memory.
+// Elements are memcpy'd, T must be trivially copyable.
+template<typename T>
+class PersistentArray
+{
+	static_assert(std::is_trivially_copyable<T>::value, "PersistentArray elements are memcpy'd");
+
+public:
+	constexpr static i32 Width = 32;
+
+	// Nodes are at least half full except at the edges, 16^8 covers any i32 size.
+	constexpr static i32 MaxHeight = 8;
+
+	constexpr static u64 Multiplier = 0x9e3779b97f4a7c15ULL;
+
+private:
+	struct Node
+	{
+		u32 refs;
+		i32 count;
+
+		// contentHash() of the node and Multiplier to the power of its size,
+		// valid while hashed is set. Writes clear it on the way down.
+		u64 hash;
+		u64 scale;
+		bool hashed;
+	};
+
+	struct Leaf : Node
+	{
+		T items[Width];
+	};
+
+	struct Inner : Node
+	{
+		i32 sizes[Width];
+		Node* children[Width];
+	};
+
+public:
+	explicit PersistentArray();
+	explicit PersistentArray(Allocator* allocator);
+	~PersistentArray();
+
+	PersistentArray(PersistentArray&& r)
+		: m_allocator(r.m_allocator)
+		, m_root(r.m_root)
+		, m_size(r.m_size)
+		, m_height(r.m_height)
+	{
+		r.m_root = nullptr;
+		r.m_size = 0;
+		r.m_height = 0;
+	}
+
+	PersistentArray& operator=(PersistentArray&& rhs)
+	{
+		if (&rhs != this)
+		{
+			release(m_root, m_height);
+
+			m_allocator = rhs.m_allocator;
+			m_root = rhs.m_root;
+			m_size = rhs.m_size;
+			m_height = rhs.m_height;
+
+			rhs.m_root = nullptr;
+			rhs.m_size = 0;
+			rhs.m_height = 0;
+		}
+
+		return *this;
+	}
+
+	void set_allocator(Allocator* a)
+	{
+		assert(m_allocator == nullptr);
+
+		m_allocator = a;
+	}
+
+	// O(1), the copy shares every node until either side writes.
+	PersistentArray clone() const;
+
+	void push_back(T val);
+	void insert(i32 i, T val);
+	void erase(i32 i);
+	void set(i32 i, T val);
+
+	void clear();
+	bool empty() const { return m_size == 0; }
+	i32 size() const { return m_size; }
+
+	const T& operator[](i32 i) const;
+
+	// Calls fn(const T* items, i32 count) for each leaf in order, the fast way
+	// through the elements.
+	template<typename Fn>
+	void forEachChunk(Fn fn) const;
+
+	// Sum of elementHash(item_i) * Multiplier^i. It does not depend on how the
+	// elements are split over nodes, and node results are cached, so after a
+	// write only the nodes on its path are hashed again. elementHash should mix
+	// its input well and be the same function on every call.
+	template<typename ElementHash>
+	u64 contentHash(ElementHash elementHash) const;
+
+	class Iterator
+	{
+	public:
+		const T& operator*() const { return m_leaf->items[m_index]; }
+
+		Iterator& operator++()
+		{
+			if (++m_index == m_leaf->count)
+			{
+				nextLeaf();
+			}
+			return *this;
+		}
+
+		bool operator!=(const Iterator& other) const
+		{
+			return m_leaf != other.m_leaf || m_index != other.m_index;
+		}
+
+	private:
+		friend class PersistentArray;
+
+		struct Frame
+		{
+			const Inner* inner;
+			i32 slot;
+		};
+
+		void descend(const Node* node, i32 height)
+		{
+			for (; height > 0; --height)
+			{
+				m_stack[m_depth++] = Frame{ (const Inner*)node, 0 };
+				node = ((const Inner*)node)->children[0];
+			}
+
+			m_leaf = (const Leaf*)node;
+			m_index = 0;
+		}
+
+		void nextLeaf()
+		{
+			while (m_depth > 0)
+			{
+				Frame& frame = m_stack[m_depth - 1];
+				if (++frame.slot < frame.inner->count)
+				{
+					descend(frame.inner->children[frame.slot], m_height - m_depth);
+					return;
+				}
+				--m_depth;
+			}
+
+			m_leaf = nullptr;
+			m_index = 0;
+		}
+
+		Frame m_stack[MaxHeight];
+		i32 m_depth = 0;
+		i32 m_height = 0;
+		const Leaf* m_leaf = nullptr;
+		i32 m_index = 0;
+	};
+
+	Iterator begin() const;
+	Iterator end() const;
+
+	Allocator* get_allocator() const;
+
+private:
+	Leaf* newLeaf();
+	Inner* newInner();
+	void release(Node* node, i32 height);
+	Node* writable(Node* node, i32 height);
+	static i32 childAt(const Inner* inner, i32* i);
+	static i32 sizeOf(const Node* node, i32 height);
+	static void placeChild(Inner* inner, i32 c, Node* child, i32 size);
+	static void removeChild(Inner* inner, i32 c);
+
+	Node* insertAt(Node*& slot, i32 height, i32 i, T val);
+	void eraseAt(Node*& slot, i32 height, i32 i);
+	void mergeChildren(Inner* inner, i32 c, i32 height);
+	void setAt(Node*& slot, i32 height, i32 i, T val);
+
+	template<typename Fn>
+	static void forEachChunk(const Node* node, i32 height, Fn& fn);
+
+	template<typename ElementHash>
+	static void hashNode(Node* node, i32 height, ElementHash& elementHash);
+
+private:
+	Allocator* m_allocator = nullptr;
+	Node* m_root = nullptr;
+	i32 m_size = 0;
+
+	// Levels of inner nodes above the leaves.
+	i32 m_height = 0;
+};
+
+template <typename T>
+PersistentArray<T>::PersistentArray()
+{
+
+}
+
+template <typename T>
+PersistentArray<T>::PersistentArray(Allocator* allocator)
+	: m_allocator(allocator)
+{
+
+}
+
+template <typename T>
+PersistentArray<T>::~PersistentArray()
+{
+	release(m_root, m_height);
+}
+
+template <typename T>
+PersistentArray<T> PersistentArray<T>::clone() const
+{
+	PersistentArray copy(m_allocator);
+	if (m_root)
+	{
+		atomicIncrement(&m_root->refs);
+	}
+
+	copy.m_root = m_root;
+	copy.m_size = m_size;
+	copy.m_height = m_height;
+
+	return copy;
+}
+
+template <typename T>
+void PersistentArray<T>::push_back(T val)
+{
+	insert(m_size, val);
+}
+
+template <typename T>
+void PersistentArray<T>::insert(i32 i, T val)
+{
+	assert(i >= 0 && i <= m_size);
+
+	if (m_root == nullptr)
+	{
+		m_root = newLeaf();
+		m_height = 0;
+	}
+
+	Node* split = insertAt(m_root, m_height, i, val);
+	++m_size;
+
+	if (split)
+	{
+		i32 splitSize = sizeOf(split, m_height);
+
+		Inner* root = newInner();
+		placeChild(root, 0, m_root, m_size - splitSize);
+		placeChild(root, 1, split, splitSize);
+
+		m_root = root;
+		++m_height;
+	}
+}
+
+template <typename T>
+void PersistentArray<T>::erase(i32 i)
+{
+	assert(i >= 0 && i < m_size);
+
+	eraseAt(m_root, m_height, i);
+	--m_size;
+
+	if (m_size == 0)
+	{
+		clear();
+		return;
+	}
+
+	// drop roots left with a single child
+	while (m_height > 0 && m_root->count == 1)
+	{
+		Node* child = ((Inner*)m_root)->children[0];
+		atomicIncrement(&child->refs);
+		release(m_root, m_height);
+
+		m_root = child;
+		--m_height;
+	}
+}
+
+template <typename T>
+void PersistentArray<T>::set(i32 i, T val)
+{
+	assert(i >= 0 && i < m_size);
+
+	setAt(m_root, m_height, i, val);
+}
+
+template <typename T>
+void PersistentArray<T>::clear()
+{
+	release(m_root, m_height);
+	m_root = nullptr;
+	m_size = 0;
+	m_height = 0;
+}
+
+template <typename T>
+const T& PersistentArray<T>::operator[](i32 i) const
+{
+	assert(i >= 0 && i < m_size);
+
+	const Node* node = m_root;
+	for (i32 height = m_height; height > 0; --height)
+	{
+		const Inner* inner = (const Inner*)node;
+		node = inner->children[childAt(inner, &i)];
+	}
+
+	return ((const Leaf*)node)->items[i];
+}
+
+template <typename T>
+template <typename Fn>
+void PersistentArray<T>::forEachChunk(Fn fn) const
+{
+	if (m_root)
+	{
+		forEachChunk(m_root, m_height, fn);
+	}
+}
+
+template <typename T>
+template <typename Fn>
+void PersistentArray<T>::forEachChunk(const Node* node, i32 height, Fn& fn)
+{
+	if (height == 0)
+	{
+		fn(((const Leaf*)node)->items, node->count);
+		return;
+	}
+
+	const Inner* inner = (const Inner*)node;
+	for (i32 c = 0; c < inner->count; ++c)
+	{
+		forEachChunk(inner->children[c], height - 1, fn);
+	}
+}
+
+template <typename T>
+template <typename ElementHash>
+u64 PersistentArray<T>::contentHash(ElementHash elementHash) const
+{
+	if (m_root == nullptr)
+	{
+		return 0;
+	}
+
+	hashNode(m_root, m_height, elementHash);
+	return m_root->hash;
+}
+
+template <typename T>
+template <typename ElementHash>
+void PersistentArray<T>::hashNode(Node* node, i32 height, ElementHash& elementHash)
+{
+	if (node->hashed)
+	{
+		return;
+	}
+
+	u64 hash = 0;
+	u64 scale = 1;
+	if (height == 0)
+	{
+		const Leaf* leaf = (const Leaf*)node;
+		for (i32 k = 0; k < leaf->count; ++k)
+		{
+			hash += scale * elementHash(leaf->items[k]);
+			scale *= Multiplier;
+		}
+	}
+	else
+	{
+		Inner* inner = (Inner*)node;
+		for (i32 c = 0; c < inner->count; ++c)
+		{
+			Node* child = inner->children[c];
+			hashNode(child, height - 1, elementHash);
+			hash += scale * child->hash;
+			scale *= child->scale;
+		}
+	}
+
+	node->hash = hash;
+	node->scale = scale;
+	node->hashed = true;
+}
+
+template <typename T>
+typename PersistentArray<T>::Iterator PersistentArray<T>::begin() const
+{
+	Iterator it;
+	if (m_root)
+	{
+		it.m_height = m_height;
+		it.descend(m_root, m_height);
+	}
+
+	return it;
+}
+
+template <typename T>
+typename PersistentArray<T>::Iterator PersistentArray<T>::end() const
+{
+	return Iterator();
+}
+
+template <typename T>
+Allocator* PersistentArray<T>::get_allocator() const
+{
+	return m_allocator;
+}
+
+template <typename T>
+typename PersistentArray<T>::Leaf* PersistentArray<T>::newLeaf()
+{
+	Leaf* leaf = (Leaf*)m_allocator->alloc(sizeof(Leaf));
+	leaf->refs = 1;
+	leaf->count = 0;
+	leaf->hashed = false;
+
+	return leaf;
+}
+
+template <typename T>
+typename PersistentArray<T>::Inner* PersistentArray<T>::newInner()
+{
+	Inner* inner = (Inner*)m_allocator->alloc(sizeof(Inner));
+	inner->refs = 1;
+	inner->count = 0;
+	inner->hashed = false;
+
+	return inner;
+}
+
+template <typename T>
+void PersistentArray<T>::release(Node* node, i32 height)
+{
+	if (node == nullptr || atomicDecrement(&node->refs) != 0)
+	{
+		return;
+	}
+
+	if (height == 0)
+	{
+		m_allocator->freeSizeKnown(node, sizeof(Leaf));
+		return;
+	}
+
+	Inner* inner = (Inner*)node;
+	for (i32 c = 0; c < inner->count; ++c)
+	{
+		release(inner->children[c], height - 1);
+	}
+	m_allocator->freeSizeKnown(node, sizeof(Inner));
+}
+
+// Node itself when this array is its only holder, else a copy taking its place.
+template <typename T>
+typename PersistentArray<T>::Node* PersistentArray<T>::writable(Node* node, i32 height)
+{
+	if (node->refs > 1)
+	{
+		Node* copy;
+		if (height == 0)
+		{
+			copy = newLeaf();
+			memcpy(copy, node, sizeof(Leaf));
+		}
+		else
+		{
+			copy = newInner();
+			memcpy(copy, node, sizeof(Inner));
+
+			Inner* inner = (Inner*)copy;
+			for (i32 c = 0; c < inner->count; ++c)
+			{
+				atomicIncrement(&inner->children[c]->refs);
+			}
+		}
+
+		copy->refs = 1;
+		release(node, height);
+		node = copy;
+	}
+
+	node->hashed = false;
+	return node;
+}
+
+// Child holding element *i, *i becomes the index within it. One past the end
+// lands in the last child.
+template <typename T>
+i32 PersistentArray<T>::childAt(const Inner* inner, i32* i)
+{
+	i32 c = 0;
+	while (c < inner->count - 1 && *i >= inner->sizes[c])
+	{
+		*i -= inner->sizes[c];
+		++c;
+	}
+
+	return c;
+}
+
+template <typename T>
+i32 PersistentArray<T>::sizeOf(const Node* node, i32 height)
+{
+	if (height == 0)
+	{
+		return node->count;
+	}
+
+	const Inner* inner = (const Inner*)node;
+	i32 size = 0;
+	for (i32 c = 0; c < inner->count; ++c)
+	{
+		size += inner->sizes[c];
+	}
+
+	return size;
+}
+
+template <typename T>
+void PersistentArray<T>::placeChild(Inner* inner, i32 c, Node* child, i32 size)
+{
+	assert(inner->count < Width);
+
+	memmove(inner->children + c + 1, inner->children + c, (inner->count - c) * sizeof(Node*));
+	memmove(inner->sizes + c + 1, inner->sizes + c, (inner->count - c) * sizeof(i32));
+	inner->children[c] = child;
+	inner->sizes[c] = size;
+	++inner->count;
+}
+
+template <typename T>
+void PersistentArray<T>::removeChild(Inner* inner, i32 c)
+{
+	memmove(inner->children + c, inner->children + c + 1, (inner->count - c - 1) * sizeof(Node*));
+	memmove(inner->sizes + c, inner->sizes + c + 1, (inner->count - c - 1) * sizeof(i32));
+	--inner->count;
+}
+
+// Inserts val at i below slot and returns the upper half if the node split.
+// A node split by an append keeps all it had, so arrays built by push_back
+// end up with full leaves.
+template <typename T>
+typename PersistentArray<T>::Node* PersistentArray<T>::insertAt(Node*& slot, i32 height, i32 i, T val)
+{
+	Node* node = writable(slot, height);
+	slot = node;
+
+	if (height == 0)
+	{
+		Leaf* leaf = (Leaf*)node;
+		Leaf* upper = nullptr;
+		if (leaf->count == Width)
+		{
+			i32 keep = i == Width ? Width : Width / 2;
+			upper = newLeaf();
+			upper->count = Width - keep;
+			memcpy(upper->items, leaf->items + keep, upper->count * sizeof(T));
+			leaf->count = keep;
+
+			if (i >= keep)
+			{
+				leaf = upper;
+				i -= keep;
+			}
+		}
+
+		memmove(leaf->items + i + 1, leaf->items + i, (leaf->count - i) * sizeof(T));
+		leaf->items[i] = val;
+		++leaf->count;
+
+		return upper;
+	}
+
+	Inner* inner = (Inner*)node;
+	i32 c = childAt(inner, &i);
+	Node* split = insertAt(inner->children[c], height - 1, i, val);
+	inner->sizes[c] += 1;
+
+	if (split == nullptr)
+	{
+		return nullptr;
+	}
+
+	i32 splitSize = sizeOf(split, height - 1);
+	inner->sizes[c] -= splitSize;
+	c += 1;
+
+	Inner* upper = nullptr;
+	if (inner->count == Width)
+	{
+		i32 keep = c == Width ? Width : Width / 2;
+		upper = newInner();
+		upper->count = Width - keep;
+		memcpy(upper->children, inner->children + keep, upper->count * sizeof(Node*));
+		memcpy(upper->sizes, inner->sizes + keep, upper->count * sizeof(i32));
+		inner->count = keep;
+
+		if (c >= keep)
+		{
+			inner = upper;
+			c -= keep;
+		}
+	}
+
+	placeChild(inner, c, split, splitSize);
+
+	return upper;
+}
+
+template <typename T>
+void PersistentArray<T>::eraseAt(Node*& slot, i32 height, i32 i)
+{
+	Node* node = writable(slot, height);
+	slot = node;
+
+	if (height == 0)
+	{
+		Leaf* leaf = (Leaf*)node;
+		memmove(leaf->items + i, leaf->items + i + 1, (leaf->count - i - 1) * sizeof(T));
+		--leaf->count;
+		return;
+	}
+
+	Inner* inner = (Inner*)node;
+	i32 c = childAt(inner, &i);
+	eraseAt(inner->children[c], height - 1, i);
+	inner->sizes[c] -= 1;
+
+	if (inner->sizes[c] == 0)
+	{
+		release(inner->children[c], height - 1);
+		removeChild(inner, c);
+		return;
+	}
+
+	mergeChildren(inner, c, height);
+}
+
+// Folds child c and a neighbour into one node once they fit in three quarters
+// of one, the slack keeps an insert and erase at the same spot from splitting
+// and merging every time.
+template <typename T>
+void PersistentArray<T>::mergeChildren(Inner* inner, i32 c, i32 height)
+{
+	if (inner->count < 2)
+	{
+		return;
+	}
+
+	i32 lo = c + 1 < inner->count ? c : c - 1;
+	i32 hi = lo + 1;
+	Node* right = inner->children[hi];
+	if (inner->children[lo]->count + right->count > Width * 3 / 4)
+	{
+		return;
+	}
+
+	Node* left = writable(inner->children[lo], height - 1);
+	inner->children[lo] = left;
+
+	if (height - 1 == 0)
+	{
+		memcpy(((Leaf*)left)->items + left->count, ((Leaf*)right)->items, right->count * sizeof(T));
+	}
+	else
+	{
+		Inner* from = (Inner*)right;
+		Inner* to = (Inner*)left;
+		for (i32 k = 0; k < from->count; ++k)
+		{
+			atomicIncrement(&from->children[k]->refs);
+		}
+		memcpy(to->children + to->count, from->children, from->count * sizeof(Node*));
+		memcpy(to->sizes + to->count, from->sizes, from->count * sizeof(i32));
+	}
+
+	left->count += right->count;
+	inner->sizes[lo] += inner->sizes[hi];
+
+	release(right, height - 1);
+	removeChild(inner, hi);
+}
+
+template <typename T>
+void PersistentArray<T>::setAt(Node*& slot, i32 height, i32 i, T val)
+{
+	Node* node = writable(slot, height);
+	slot = node;
+
+	if (height == 0)
+	{
+		((Leaf*)node)->items[i] = val;
+		return;
+	}
+
+	Inner* inner = (Inner*)node;
+	i32 c = childAt(inner, &i);
+	setAt(inner->children[c], height - 1, i, val);
+}
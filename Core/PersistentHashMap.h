@@ -0,0 +1,564 @@
+#pragma once
+
+#include <assert.h>
+#include <string.h>
+
+#include "Allocator.h"
+#include "Atomic.h"
+#include "Bits.h"
+#include "Types.h"
+
+// Hash map whose copies share structure, a hash array mapped trie in the
+// compact CHAMP layout. Every node consumes Bits of the key from the low end
+// and holds its entries and child nodes in two bitmap indexed arrays. clone()
+// shares the root and a write copies only the nodes on its path that another
+// copy still holds, so cloning is O(1) and writes are O(log n).
+// Keys are used as they are, there is no hash policy like HashMap's, so they
+// are expected to be random. Keys equal in their low bits share a path down.
+template<typename T>
+class PersistentHashMap
+{
+public:
+	template<typename U>
+	static auto test_clone(U* p) -> decltype(p->clone(), char(0)) { return 0; }
+	static char(&test_clone(...))[2] { static char arr[2] = {}; return arr; }
+
+	static constexpr bool has_clone = sizeof(test_clone((T*)0)) == 1;
+
+	constexpr static u32 Bits = 5;
+	constexpr static u32 MaxDepth = (64 + Bits - 1) / Bits;
+
+	struct Entry
+	{
+		u64 key;
+		T value;
+	};
+
+private:
+	// Followed by popCount(dataMap) entries and then popCount(nodeMap) children.
+	struct Node
+	{
+		u32 refs;
+		u32 dataMap;
+		u32 nodeMap;
+		u32 _pad;
+
+		Entry* entries() { return (Entry*)(this + 1); }
+		const Entry* entries() const { return (const Entry*)(this + 1); }
+		Node** children() { return (Node**)(entries() + popCount(dataMap)); }
+		Node* const* children() const { return (Node* const*)(entries() + popCount(dataMap)); }
+
+		u32 dataIndex(u32 bit) const { return popCount(dataMap & (bit - 1)); }
+		u32 childIndex(u32 bit) const { return popCount(nodeMap & (bit - 1)); }
+	};
+
+	static_assert(sizeof(Node) % alignof(Entry) == 0, "Entries follow the node header");
+
+public:
+	explicit PersistentHashMap();
+	explicit PersistentHashMap(Allocator* allocator);
+	~PersistentHashMap();
+
+	PersistentHashMap(PersistentHashMap&& r)
+		: m_allocator(r.m_allocator)
+		, m_root(r.m_root)
+		, m_size(r.m_size)
+	{
+		r.m_root = nullptr;
+		r.m_size = 0;
+	}
+
+	PersistentHashMap& operator=(PersistentHashMap&& rhs)
+	{
+		if (&rhs != this)
+		{
+			release(m_root);
+
+			m_allocator = rhs.m_allocator;
+			m_root = rhs.m_root;
+			m_size = rhs.m_size;
+
+			rhs.m_root = nullptr;
+			rhs.m_size = 0;
+		}
+
+		return *this;
+	}
+
+	void set_allocator(Allocator* a)
+	{
+		assert(m_allocator == nullptr);
+
+		m_allocator = a;
+	}
+
+	// O(1), the copy shares every node until either side writes.
+	PersistentHashMap clone() const;
+
+	// The non-const find copies the path to key while it is shared, so the
+	// value can be written through the result.
+	T* find(u64 key);
+	const T* find(u64 key) const;
+
+	bool contains(u64 key) const;
+
+	void insert_or_assign(u64 key, const T& value);
+
+	void insert_or_assign(u64 key, T&& value);
+
+	void erase(u64 key);
+
+	T& operator[](u64 key);
+
+	i32 size() const;
+
+	void clear();
+
+	class Iterator
+	{
+	public:
+		const Entry& operator*() const { return m_node->entries()[m_index]; }
+		const Entry* operator->() const { return &m_node->entries()[m_index]; }
+
+		Iterator& operator++()
+		{
+			++m_index;
+			settle();
+			return *this;
+		}
+
+		bool operator!=(const Iterator& other) const
+		{
+			return m_node != other.m_node || m_index != other.m_index;
+		}
+
+	private:
+		friend class PersistentHashMap;
+
+		struct Frame
+		{
+			const Node* node;
+			u32 child;
+		};
+
+		// Moves on to the next node with entries left once the current one is done,
+		// visiting each node's entries before its children.
+		void settle()
+		{
+			while (m_node && m_index == popCount(m_node->dataMap))
+			{
+				m_stack[m_depth++] = Frame{ m_node, 0 };
+				m_node = nullptr;
+
+				while (m_depth > 0)
+				{
+					Frame& frame = m_stack[m_depth - 1];
+					if (frame.child < popCount(frame.node->nodeMap))
+					{
+						m_node = frame.node->children()[frame.child++];
+						m_index = 0;
+						break;
+					}
+					--m_depth;
+				}
+			}
+
+			if (m_node == nullptr)
+			{
+				m_index = 0;
+			}
+		}
+
+		Frame m_stack[MaxDepth + 1];
+		u32 m_depth = 0;
+		const Node* m_node = nullptr;
+		u32 m_index = 0;
+	};
+
+	Iterator begin() const;
+	Iterator end() const;
+
+	Allocator* get_allocator() const;
+
+private:
+	static u32 bitAt(u64 key, u32 shift)
+	{
+		return 1u << (u32(key >> shift) & ((1u << Bits) - 1));
+	}
+
+	static void copyValue(T* to, const T& from)
+	{
+		if constexpr (has_clone)
+		{
+			new (to) T(from.clone());
+		}
+		else
+		{
+			new (to) T(from);
+		}
+	}
+
+	static i32 nodeBytes(u32 dataMap, u32 nodeMap)
+	{
+		return i32(sizeof(Node) + popCount(dataMap) * sizeof(Entry) + popCount(nodeMap) * sizeof(Node*));
+	}
+
+	Node* makeNode(u32 dataMap, u32 nodeMap);
+	Node* reshape(const Node* from, u32 dataMap, u32 nodeMap, u32 skipBit);
+	Node* makePair(const Entry& existing, u64 key, u32 shift, T** outValue);
+	Node* writable(Node* node);
+	void release(Node* node);
+
+	T* findOrInsert(Node*& slot, u64 key, u32 shift);
+	T* findForWrite(Node*& slot, u64 key, u32 shift);
+	void eraseAt(Node*& slot, u64 key, u32 shift);
+
+private:
+	Allocator* m_allocator = nullptr;
+	Node* m_root = nullptr;
+	i32 m_size = 0;
+};
+
+template <typename T>
+PersistentHashMap<T>::PersistentHashMap()
+{
+
+}
+
+template <typename T>
+PersistentHashMap<T>::PersistentHashMap(Allocator* allocator)
+	: m_allocator(allocator)
+{
+
+}
+
+template <typename T>
+PersistentHashMap<T>::~PersistentHashMap()
+{
+	release(m_root);
+}
+
+template <typename T>
+PersistentHashMap<T> PersistentHashMap<T>::clone() const
+{
+	PersistentHashMap copy(m_allocator);
+	if (m_root)
+	{
+		atomicIncrement(&m_root->refs);
+	}
+
+	copy.m_root = m_root;
+	copy.m_size = m_size;
+
+	return copy;
+}
+
+template <typename T>
+T* PersistentHashMap<T>::find(u64 key)
+{
+	if (!contains(key))
+	{
+		return nullptr;
+	}
+
+	return findForWrite(m_root, key, 0);
+}
+
+template <typename T>
+const T* PersistentHashMap<T>::find(u64 key) const
+{
+	const Node* node = m_root;
+	for (u32 shift = 0; node; shift += Bits)
+	{
+		u32 bit = bitAt(key, shift);
+		if (node->dataMap & bit)
+		{
+			const Entry& entry = node->entries()[node->dataIndex(bit)];
+			return entry.key == key ? &entry.value : nullptr;
+		}
+
+		node = (node->nodeMap & bit) ? node->children()[node->childIndex(bit)] : nullptr;
+	}
+
+	return nullptr;
+}
+
+template <typename T>
+bool PersistentHashMap<T>::contains(u64 key) const
+{
+	return find(key) != nullptr;
+}
+
+template <typename T>
+void PersistentHashMap<T>::insert_or_assign(u64 key, const T& value)
+{
+	T* slot = &(*this)[key];
+	slot->~T();
+	copyValue(slot, value);
+}
+
+template <typename T>
+void PersistentHashMap<T>::insert_or_assign(u64 key, T&& value)
+{
+	(*this)[key] = (T&&)value;
+}
+
+template <typename T>
+void PersistentHashMap<T>::erase(u64 key)
+{
+	if (!contains(key))
+	{
+		return;
+	}
+
+	eraseAt(m_root, key, 0);
+	--m_size;
+
+	if (m_root->dataMap == 0 && m_root->nodeMap == 0)
+	{
+		release(m_root);
+		m_root = nullptr;
+	}
+}
+
+template <typename T>
+T& PersistentHashMap<T>::operator[](u64 key)
+{
+	if (m_root == nullptr)
+	{
+		m_root = makeNode(0, 0);
+	}
+
+	return *findOrInsert(m_root, key, 0);
+}
+
+template <typename T>
+i32 PersistentHashMap<T>::size() const
+{
+	return m_size;
+}
+
+template <typename T>
+void PersistentHashMap<T>::clear()
+{
+	release(m_root);
+	m_root = nullptr;
+	m_size = 0;
+}
+
+template <typename T>
+typename PersistentHashMap<T>::Iterator PersistentHashMap<T>::begin() const
+{
+	Iterator it;
+	it.m_node = m_root;
+	it.settle();
+
+	return it;
+}
+
+template <typename T>
+typename PersistentHashMap<T>::Iterator PersistentHashMap<T>::end() const
+{
+	return Iterator();
+}
+
+template <typename T>
+Allocator* PersistentHashMap<T>::get_allocator() const
+{
+	return m_allocator;
+}
+
+// Entries are left for the caller to construct.
+template <typename T>
+typename PersistentHashMap<T>::Node* PersistentHashMap<T>::makeNode(u32 dataMap, u32 nodeMap)
+{
+	Node* node = (Node*)m_allocator->alloc(nodeBytes(dataMap, nodeMap));
+	node->refs = 1;
+	node->dataMap = dataMap;
+	node->nodeMap = nodeMap;
+	node->_pad = 0;
+
+	return node;
+}
+
+// Node with the given maps holding copies of from's entries and children, all
+// but the ones at skipBit which the caller fills in.
+template <typename T>
+typename PersistentHashMap<T>::Node* PersistentHashMap<T>::reshape(const Node* from, u32 dataMap, u32 nodeMap, u32 skipBit)
+{
+	Node* node = makeNode(dataMap, nodeMap);
+
+	for (u32 bits = from->dataMap & dataMap & ~skipBit; bits; bits &= bits - 1)
+	{
+		u32 bit = bits & (0u - bits);
+		Entry* to = &node->entries()[node->dataIndex(bit)];
+		const Entry& entry = from->entries()[from->dataIndex(bit)];
+		to->key = entry.key;
+		copyValue(&to->value, entry.value);
+	}
+
+	for (u32 bits = from->nodeMap & nodeMap & ~skipBit; bits; bits &= bits - 1)
+	{
+		u32 bit = bits & (0u - bits);
+		Node* child = from->children()[from->childIndex(bit)];
+		atomicIncrement(&child->refs);
+		node->children()[node->childIndex(bit)] = child;
+	}
+
+	return node;
+}
+
+// Subtree at shift holding a copy of existing and a new default value for key.
+template <typename T>
+typename PersistentHashMap<T>::Node* PersistentHashMap<T>::makePair(const Entry& existing, u64 key, u32 shift, T** outValue)
+{
+	u32 existingBit = bitAt(existing.key, shift);
+	u32 bit = bitAt(key, shift);
+
+	if (existingBit == bit)
+	{
+		Node* node = makeNode(0, bit);
+		node->children()[0] = makePair(existing, key, shift + Bits, outValue);
+		return node;
+	}
+
+	Node* node = makeNode(existingBit | bit, 0);
+
+	Entry* copy = &node->entries()[node->dataIndex(existingBit)];
+	copy->key = existing.key;
+	copyValue(&copy->value, existing.value);
+
+	Entry* added = &node->entries()[node->dataIndex(bit)];
+	added->key = key;
+	new (&added->value) T();
+	*outValue = &added->value;
+
+	return node;
+}
+
+// Node itself when this map is its only holder, else a copy taking its place.
+template <typename T>
+typename PersistentHashMap<T>::Node* PersistentHashMap<T>::writable(Node* node)
+{
+	if (node->refs == 1)
+	{
+		return node;
+	}
+
+	Node* copy = reshape(node, node->dataMap, node->nodeMap, 0);
+	release(node);
+
+	return copy;
+}
+
+template <typename T>
+void PersistentHashMap<T>::release(Node* node)
+{
+	if (node == nullptr || atomicDecrement(&node->refs) != 0)
+	{
+		return;
+	}
+
+	u32 entries = popCount(node->dataMap);
+	for (u32 i = 0; i < entries; ++i)
+	{
+		node->entries()[i].value.~T();
+	}
+
+	u32 children = popCount(node->nodeMap);
+	for (u32 i = 0; i < children; ++i)
+	{
+		release(node->children()[i]);
+	}
+
+	m_allocator->freeSizeKnown(node, nodeBytes(node->dataMap, node->nodeMap));
+}
+
+template <typename T>
+T* PersistentHashMap<T>::findOrInsert(Node*& slot, u64 key, u32 shift)
+{
+	u32 bit = bitAt(key, shift);
+
+	if (slot->nodeMap & bit)
+	{
+		slot = writable(slot);
+		return findOrInsert(slot->children()[slot->childIndex(bit)], key, shift + Bits);
+	}
+
+	T* value = nullptr;
+	Node* reshaped;
+	if (slot->dataMap & bit)
+	{
+		const Entry& entry = slot->entries()[slot->dataIndex(bit)];
+		if (entry.key == key)
+		{
+			slot = writable(slot);
+			return &slot->entries()[slot->dataIndex(bit)].value;
+		}
+
+		// two keys sharing this slot move down into a new child
+		reshaped = reshape(slot, slot->dataMap & ~bit, slot->nodeMap | bit, bit);
+		reshaped->children()[reshaped->childIndex(bit)] = makePair(entry, key, shift + Bits, &value);
+	}
+	else
+	{
+		reshaped = reshape(slot, slot->dataMap | bit, slot->nodeMap, bit);
+		Entry* added = &reshaped->entries()[reshaped->dataIndex(bit)];
+		added->key = key;
+		new (&added->value) T();
+		value = &added->value;
+	}
+
+	release(slot);
+	slot = reshaped;
+	++m_size;
+
+	return value;
+}
+
+// Value of a key known to be in the map, copying the path to it while shared.
+template <typename T>
+T* PersistentHashMap<T>::findForWrite(Node*& slot, u64 key, u32 shift)
+{
+	slot = writable(slot);
+
+	u32 bit = bitAt(key, shift);
+	if (slot->dataMap & bit)
+	{
+		return &slot->entries()[slot->dataIndex(bit)].value;
+	}
+
+	return findForWrite(slot->children()[slot->childIndex(bit)], key, shift + Bits);
+}
+
+// Removes a key known to be in the map. A child left with a single entry is
+// folded back into its parent, so a set of keys always has the same layout.
+template <typename T>
+void PersistentHashMap<T>::eraseAt(Node*& slot, u64 key, u32 shift)
+{
+	u32 bit = bitAt(key, shift);
+
+	if (slot->dataMap & bit)
+	{
+		Node* reshaped = reshape(slot, slot->dataMap & ~bit, slot->nodeMap, bit);
+		release(slot);
+		slot = reshaped;
+		return;
+	}
+
+	slot = writable(slot);
+	Node*& childSlot = slot->children()[slot->childIndex(bit)];
+	eraseAt(childSlot, key, shift + Bits);
+
+	Node* child = childSlot;
+	if (child->nodeMap == 0 && popCount(child->dataMap) == 1)
+	{
+		Node* reshaped = reshape(slot, slot->dataMap | bit, slot->nodeMap & ~bit, bit);
+		Entry* to = &reshaped->entries()[reshaped->dataIndex(bit)];
+		to->key = child->entries()[0].key;
+		copyValue(&to->value, child->entries()[0].value);
+
+		release(slot);
+		slot = reshaped;
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string.h>
+
+#include "Types.h"
+
+// Characters somebody else owns, with their length. Cheap to make from a
+// literal or a buffer, so lookups by name never copy the name.
+struct StringView
+{
+	StringView()
+		: data("")
+		, size(0)
+	{}
+
+	StringView(const char* str)
+		: data(str)
+		, size(u32(strlen(str)))
+	{}
+
+	StringView(const char* str, u32 length)
+		: data(str)
+		, size(length)
+	{}
+
+	bool operator==(const StringView& other) const
+	{
+		return size == other.size && memcmp(data, other.data, size) == 0;
+	}
+
+	bool operator!=(const StringView& other) const
+	{
+		return !(*this == other);
+	}
+
+	const char* data;
+	u32 size;
+};
@@ -0,0 +1,690 @@
+#pragma once
+
+#include <assert.h>
+#include <string.h>
+
+#include "Allocator.h"
+#include "Bits.h"
+#include "Hash.h"
+#include "Types.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define SWISSMAP_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define SWISSMAP_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Open addressing map with the same interface as HashMap. Every slot has a
+// control byte holding 7 bits of its key's hash, and a lookup compares a group
+// of 16 control bytes at once, so it touches the entries only for the slots
+// whose hash bits match instead of following a chain through m_data.
+//
+// Groups are probed in triangular order, which visits every group once on a
+// power of two table. Erasing leaves a tombstone only where a probe may have
+// passed the group before, ie. when it has no empty slot.
+namespace swiss
+{
+	constexpr static u32 GroupWidth = 16;
+
+	constexpr static u8 Empty = 0x80;
+	constexpr static u8 Deleted = 0xfe;
+
+	// Slot bits of a group compare, Shift turns a bit index into a slot index.
+	struct BitMask
+	{
+#if defined(SWISSMAP_NEON)
+		constexpr static u32 Shift = 2;
+#else
+		constexpr static u32 Shift = 0;
+#endif
+
+		explicit operator bool() const { return bits != 0; }
+
+		u32 lowest() const { return countTrailingZeros(bits) >> Shift; }
+
+		void clearLowest() { bits &= bits - 1; }
+
+		u64 bits;
+	};
+
+	struct Group
+	{
+		explicit Group(const u8* ctrl)
+		{
+#if defined(SWISSMAP_SSE2)
+			bytes = _mm_loadu_si128((const __m128i*)ctrl);
+#elif defined(SWISSMAP_NEON)
+			bytes = vld1q_u8(ctrl);
+#else
+			memcpy(bytes, ctrl, GroupWidth);
+#endif
+		}
+
+		BitMask match(u8 h2) const
+		{
+#if defined(SWISSMAP_SSE2)
+			return BitMask{ u32(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(char(h2))))) };
+#elif defined(SWISSMAP_NEON)
+			return narrow(vceqq_u8(bytes, vdupq_n_u8(h2)));
+#else
+			u64 bits = 0;
+			for (u32 i = 0; i < GroupWidth; ++i)
+			{
+				bits |= u64(bytes[i] == h2) << i;
+			}
+			return BitMask{ bits };
+#endif
+		}
+
+		BitMask matchEmpty() const
+		{
+			return match(Empty);
+		}
+
+		// empty and deleted are the only control bytes with the high bit set
+		BitMask matchEmptyOrDeleted() const
+		{
+#if defined(SWISSMAP_SSE2)
+			return BitMask{ u32(_mm_movemask_epi8(bytes)) };
+#elif defined(SWISSMAP_NEON)
+			return narrow(vcltq_s8(vreinterpretq_s8_u8(bytes), vdupq_n_s8(0)));
+#else
+			u64 bits = 0;
+			for (u32 i = 0; i < GroupWidth; ++i)
+			{
+				bits |= u64(bytes[i] >> 7) << i;
+			}
+			return BitMask{ bits };
+#endif
+		}
+
+#if defined(SWISSMAP_SSE2)
+		__m128i bytes;
+#elif defined(SWISSMAP_NEON)
+		// NEON has no movemask, shifting each 16 bit lane right by 4 while
+		// narrowing leaves a nibble per slot, one bit of which is kept
+		static BitMask narrow(uint8x16_t cmp)
+		{
+			uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+			return BitMask{ vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ull };
+		}
+
+		uint8x16_t bytes;
+#else
+		u8 bytes[GroupWidth];
+#endif
+	};
+}
+
+template<typename T>
+struct SwissMap
+{
+public:
+	template<typename U>
+	static auto test_clone(U* p) -> decltype(p->clone(), char(0)) { return 0; }
+	static char(&test_clone(...))[2] { static char arr[2] = {}; return arr; }
+
+	static constexpr bool has_clone = sizeof(test_clone((T*)0)) == 1;
+
+	struct Entry
+	{
+		u64 key;
+		T value;
+	};
+
+	static_assert(alignof(Entry) <= swiss::GroupWidth, "Entries follow the control bytes");
+
+	template<typename E>
+	struct IteratorBase
+	{
+		void operator++()
+		{
+			++index;
+			settle();
+		}
+
+		bool operator!=(const IteratorBase& other) const
+		{
+			return index != other.index;
+		}
+
+		E& operator*() const
+		{
+			return map->m_entries[index];
+		}
+
+		E* operator->() const
+		{
+			return &map->m_entries[index];
+		}
+
+		void settle()
+		{
+			while (index < map->m_capacity && (map->m_ctrl[index] & 0x80))
+			{
+				++index;
+			}
+		}
+
+		const SwissMap* map;
+		u32 index;
+	};
+
+	using Iterator = IteratorBase<Entry>;
+	using ConstIterator = IteratorBase<const Entry>;
+
+	explicit SwissMap(Allocator* allocator)
+		: m_allocator(allocator)
+	{
+
+	}
+
+	explicit SwissMap()
+	{
+
+	}
+
+	~SwissMap();
+
+	SwissMap(SwissMap&& r);
+
+	SwissMap& operator=(SwissMap&& rhs);
+
+	void set_allocator(Allocator* a);
+
+	// Fraction of the slots filled before the table doubles, below 1.
+	void set_max_load_factor(float loadFactor);
+
+	T* find(u64 key);
+	const T* find(u64 key) const;
+
+	// find() of count keys into out, prefetching the control bytes and entries
+	// of the keys ahead so their misses overlap instead of following one another.
+	void find_many(const u64* keys, T** out, i32 count);
+
+	bool contains(u64 key) const;
+
+	// Sizes the table for count entries, so inserting up to that many never rehashes.
+	void reserve(i32 count);
+
+	void insert_or_assign(u64 key, const T& value);
+
+	void insert_or_assign(u64 key, T&& value);
+
+	void erase(u64 key);
+
+	T& operator[](u64 key);
+
+	i32 size() const;
+
+	Iterator begin();
+
+	Iterator end();
+
+	ConstIterator begin() const;
+
+	ConstIterator end() const;
+
+	SwissMap clone() const;
+
+private:
+	// Hash bits picking the first group, and the 7 bits kept in the control byte.
+	// Keys are mixed first since ids that differ only in their top bits would
+	// otherwise share both.
+	static u64 hash(u64 key)
+	{
+		return HashMix::hash(key);
+	}
+
+	// Keys find_many works ahead by, like HashMap's.
+	constexpr static i32 PrefetchDistance = 8;
+
+	static u64 h1(u64 h) { return h >> 7; }
+	static u8 h2(u64 h) { return u8(h & 0x7f); }
+
+	static i32 allocationSize(u32 capacity)
+	{
+		return i32(capacity + capacity * sizeof(Entry));
+	}
+
+	u32 groupMask() const { return m_capacity / swiss::GroupWidth - 1; }
+
+	u32 maxSize(u32 capacity) const { return u32(capacity * m_maxLoadFactor); }
+
+	u32 find_impl(u64 key, u64 h) const;
+
+	u32 find_free(u64 h) const;
+
+	u32 find_or_make(u64 key);
+
+	void rehash(u32 new_capacity);
+
+	void release();
+
+	Allocator* m_allocator = nullptr;
+	u8* m_ctrl = nullptr;
+	Entry* m_entries = nullptr;
+	u32 m_capacity = 0;
+	u32 m_size = 0;
+	u32 m_growthLeft = 0;
+	float m_maxLoadFactor = 0.875f;
+};
+
+template <typename T>
+SwissMap<T>::~SwissMap()
+{
+	release();
+}
+
+template <typename T>
+SwissMap<T>::SwissMap(SwissMap&& r)
+	: m_allocator(r.m_allocator)
+	, m_ctrl(r.m_ctrl)
+	, m_entries(r.m_entries)
+	, m_capacity(r.m_capacity)
+	, m_size(r.m_size)
+	, m_growthLeft(r.m_growthLeft)
+	, m_maxLoadFactor(r.m_maxLoadFactor)
+{
+	r.m_ctrl = nullptr;
+	r.m_entries = nullptr;
+	r.m_capacity = 0;
+	r.m_size = 0;
+	r.m_growthLeft = 0;
+}
+
+template <typename T>
+SwissMap<T>& SwissMap<T>::operator=(SwissMap&& rhs)
+{
+	if (&rhs != this)
+	{
+		release();
+
+		m_allocator = rhs.m_allocator;
+		m_ctrl = rhs.m_ctrl;
+		m_entries = rhs.m_entries;
+		m_capacity = rhs.m_capacity;
+		m_size = rhs.m_size;
+		m_growthLeft = rhs.m_growthLeft;
+		m_maxLoadFactor = rhs.m_maxLoadFactor;
+
+		rhs.m_ctrl = nullptr;
+		rhs.m_entries = nullptr;
+		rhs.m_capacity = 0;
+		rhs.m_size = 0;
+		rhs.m_growthLeft = 0;
+	}
+
+	return *this;
+}
+
+template <typename T>
+void SwissMap<T>::set_allocator(Allocator* a)
+{
+	assert(m_allocator == nullptr);
+
+	m_allocator = a;
+}
+
+template <typename T>
+void SwissMap<T>::set_max_load_factor(float loadFactor)
+{
+	assert(loadFactor > 0.0f && loadFactor < 1.0f);
+
+	m_maxLoadFactor = loadFactor;
+	if (m_capacity)
+	{
+		u32 capacity = m_capacity;
+		while (maxSize(capacity) <= m_size)
+		{
+			capacity *= 2;
+		}
+		rehash(capacity);
+	}
+}
+
+template <typename T>
+T* SwissMap<T>::find(u64 key)
+{
+	u32 i = find_impl(key, hash(key));
+	return i != u32(-1) ? &m_entries[i].value : nullptr;
+}
+
+template <typename T>
+const T* SwissMap<T>::find(u64 key) const
+{
+	u32 i = find_impl(key, hash(key));
+	return i != u32(-1) ? &m_entries[i].value : nullptr;
+}
+
+template <typename T>
+void SwissMap<T>::find_many(const u64* keys, T** out, i32 count)
+{
+	if (m_capacity == 0)
+	{
+		for (i32 i = 0; i < count; ++i)
+		{
+			out[i] = nullptr;
+		}
+		return;
+	}
+
+	const u32 mask = groupMask();
+	for (i32 i = 0; i < count + 2 * PrefetchDistance; ++i)
+	{
+		if (i < count)
+		{
+			prefetch(m_ctrl + (u32(h1(hash(keys[i]))) & mask) * swiss::GroupWidth);
+		}
+
+		// the first group is in cache by now, its first match is the likely entry
+		const i32 entryAt = i - PrefetchDistance;
+		if (entryAt >= 0 && entryAt < count)
+		{
+			const u64 h = hash(keys[entryAt]);
+			const u32 group = u32(h1(h)) & mask;
+			if (swiss::BitMask match = swiss::Group(m_ctrl + group * swiss::GroupWidth).match(h2(h)))
+			{
+				prefetch(&m_entries[group * swiss::GroupWidth + match.lowest()]);
+			}
+		}
+
+		const i32 findAt = i - 2 * PrefetchDistance;
+		if (findAt >= 0)
+		{
+			out[findAt] = find(keys[findAt]);
+		}
+	}
+}
+
+template <typename T>
+void SwissMap<T>::reserve(i32 count)
+{
+	u32 capacity = m_capacity ? m_capacity : swiss::GroupWidth;
+	while (maxSize(capacity) < u32(count))
+	{
+		capacity *= 2;
+	}
+
+	// also squeezes out tombstones that would eat into the room asked for
+	if (capacity > m_capacity || i64(m_growthLeft) < i64(count) - i64(m_size))
+	{
+		rehash(capacity);
+	}
+}
+
+template <typename T>
+bool SwissMap<T>::contains(u64 key) const
+{
+	return find_impl(key, hash(key)) != u32(-1);
+}
+
+template <typename T>
+void SwissMap<T>::insert_or_assign(u64 key, const T& value)
+{
+	T copy = value;
+	insert_or_assign(key, (T&&)copy);
+}
+
+template <typename T>
+void SwissMap<T>::insert_or_assign(u64 key, T&& value)
+{
+	u32 i = find_or_make(key);
+	m_entries[i].value = (T&&)value;
+}
+
+template <typename T>
+void SwissMap<T>::erase(u64 key)
+{
+	u32 i = find_impl(key, hash(key));
+	if (i == u32(-1))
+	{
+		return;
+	}
+
+	m_entries[i].~Entry();
+	--m_size;
+
+	// a group that still has an empty slot never sent a probe on to the next one
+	u32 groupStart = i & ~(swiss::GroupWidth - 1);
+	if (swiss::Group(m_ctrl + groupStart).matchEmpty())
+	{
+		m_ctrl[i] = swiss::Empty;
+		++m_growthLeft;
+	}
+	else
+	{
+		m_ctrl[i] = swiss::Deleted;
+	}
+}
+
+template <typename T>
+T& SwissMap<T>::operator[](u64 key)
+{
+	// m_entries moves when find_or_make grows the table
+	u32 i = find_or_make(key);
+	return m_entries[i].value;
+}
+
+template <typename T>
+i32 SwissMap<T>::size() const
+{
+	return i32(m_size);
+}
+
+template <typename T>
+typename SwissMap<T>::Iterator SwissMap<T>::begin()
+{
+	Iterator it{ this, 0 };
+	it.settle();
+	return it;
+}
+
+template <typename T>
+typename SwissMap<T>::Iterator SwissMap<T>::end()
+{
+	return Iterator{ this, m_capacity };
+}
+
+template <typename T>
+typename SwissMap<T>::ConstIterator SwissMap<T>::begin() const
+{
+	ConstIterator it{ this, 0 };
+	it.settle();
+	return it;
+}
+
+template <typename T>
+typename SwissMap<T>::ConstIterator SwissMap<T>::end() const
+{
+	return ConstIterator{ this, m_capacity };
+}
+
+template <typename T>
+SwissMap<T> SwissMap<T>::clone() const
+{
+	SwissMap clone(m_allocator);
+	clone.m_maxLoadFactor = m_maxLoadFactor;
+
+	if (m_capacity == 0)
+	{
+		return clone;
+	}
+
+	u8* block = (u8*)m_allocator->alloc(allocationSize(m_capacity));
+	clone.m_ctrl = block;
+	clone.m_entries = (Entry*)(block + m_capacity);
+	clone.m_capacity = m_capacity;
+	clone.m_size = m_size;
+	clone.m_growthLeft = m_growthLeft;
+
+	memcpy(clone.m_ctrl, m_ctrl, m_capacity);
+	for (u32 i = 0; i < m_capacity; ++i)
+	{
+		if ((m_ctrl[i] & 0x80) == 0)
+		{
+			Entry* e = new (&clone.m_entries[i]) Entry();
+			e->key = m_entries[i].key;
+			if constexpr (has_clone)
+			{
+				e->value = m_entries[i].value.clone();
+			}
+			else
+			{
+				e->value = m_entries[i].value;
+			}
+		}
+	}
+
+	return clone;
+}
+
+template <typename T>
+u32 SwissMap<T>::find_impl(u64 key, u64 h) const
+{
+	if (m_capacity == 0)
+	{
+		return u32(-1);
+	}
+
+	u32 mask = groupMask();
+	u32 group = u32(h1(h)) & mask;
+	for (u32 step = 1; ; ++step)
+	{
+		const u8* ctrl = m_ctrl + group * swiss::GroupWidth;
+		swiss::Group g(ctrl);
+
+		for (swiss::BitMask match = g.match(h2(h)); match; match.clearLowest())
+		{
+			u32 i = group * swiss::GroupWidth + match.lowest();
+			if (m_entries[i].key == key)
+			{
+				return i;
+			}
+		}
+
+		// the load factor keeps an empty slot somewhere, and triangular steps
+		// reach every group before coming back to the first
+		if (g.matchEmpty() || step > mask)
+		{
+			return u32(-1);
+		}
+
+		group = (group + step) & mask;
+	}
+}
+
+template <typename T>
+u32 SwissMap<T>::find_free(u64 h) const
+{
+	u32 mask = groupMask();
+	u32 group = u32(h1(h)) & mask;
+	for (u32 step = 1; ; ++step)
+	{
+		swiss::BitMask free = swiss::Group(m_ctrl + group * swiss::GroupWidth).matchEmptyOrDeleted();
+		if (free)
+		{
+			return group * swiss::GroupWidth + free.lowest();
+		}
+
+		group = (group + step) & mask;
+	}
+}
+
+template <typename T>
+u32 SwissMap<T>::find_or_make(u64 key)
+{
+	u64 h = hash(key);
+	u32 i = find_impl(key, h);
+	if (i != u32(-1))
+	{
+		return i;
+	}
+
+	if (m_capacity == 0)
+	{
+		rehash(swiss::GroupWidth);
+	}
+
+	i = find_free(h);
+
+	// a tombstone is reused for free, only an empty slot counts against the load
+	if (m_ctrl[i] == swiss::Empty && m_growthLeft == 0)
+	{
+		// mostly tombstones, squeeze them out instead of doubling
+		bool crowded = m_size >= maxSize(m_capacity) / 2;
+		rehash(crowded ? m_capacity * 2 : m_capacity);
+		i = find_free(h);
+	}
+
+	if (m_ctrl[i] == swiss::Empty)
+	{
+		--m_growthLeft;
+	}
+
+	m_ctrl[i] = h2(h);
+	Entry* e = new (&m_entries[i]) Entry();
+	e->key = key;
+	++m_size;
+
+	return i;
+}
+
+template <typename T>
+void SwissMap<T>::rehash(u32 new_capacity)
+{
+	u8* oldCtrl = m_ctrl;
+	Entry* oldEntries = m_entries;
+	u32 oldCapacity = m_capacity;
+
+	u8* block = (u8*)m_allocator->alloc(allocationSize(new_capacity));
+	m_ctrl = block;
+	m_entries = (Entry*)(block + new_capacity);
+	m_capacity = new_capacity;
+	m_growthLeft = maxSize(new_capacity) - m_size;
+
+	memset(m_ctrl, swiss::Empty, new_capacity);
+
+	for (u32 i = 0; i < oldCapacity; ++i)
+	{
+		if ((oldCtrl[i] & 0x80) == 0)
+		{
+			u64 h = hash(oldEntries[i].key);
+			u32 to = find_free(h);
+			m_ctrl[to] = h2(h);
+			new (&m_entries[to]) Entry((Entry&&)oldEntries[i]);
+			oldEntries[i].~Entry();
+		}
+	}
+
+	if (oldCtrl)
+	{
+		m_allocator->freeSizeKnown(oldCtrl, allocationSize(oldCapacity));
+	}
+}
+
+template <typename T>
+void SwissMap<T>::release()
+{
+	if (m_ctrl == nullptr)
+	{
+		return;
+	}
+
+	for (u32 i = 0; i < m_capacity; ++i)
+	{
+		if ((m_ctrl[i] & 0x80) == 0)
+		{
+			m_entries[i].~Entry();
+		}
+	}
+
+	m_allocator->freeSizeKnown(m_ctrl, allocationSize(m_capacity));
+	m_ctrl = nullptr;
+	m_entries = nullptr;
+	m_capacity = 0;
+	m_size = 0;
+	m_growthLeft = 0;
+}
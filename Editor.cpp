@@ -47,6 +47,9 @@ struct Xoshiro256
 
 Xoshiro256 g_rand;
 
+// Sequence numbers handed to partitionKey, starts at a random point per session.
+static u64 s_keySequence;
+
 truth::Key nextKey()
 {
 	truth::Key key;
@@ -54,6 +57,11 @@ truth::Key nextKey()
 	return key;
 }
 
+truth::Key nextKey(truth::Key partition)
+{
+	return truth::partitionKey(partition, s_keySequence++);
+}
+
 int InitializeRandomContext(Xoshiro256* rand)
 {
 	HCRYPTPROV hCryptProv = 0;
@@ -219,6 +227,7 @@ EditorTab* EditorTab::openEmpty(Allocator* a, EditorRenderer* renderer, i32 id)
 
 
 	tab->m_state = g_truth->head();
+	g_truth->retain(tab->m_state);
 	tab->m_renderer = renderer;
 
 	sprintf_s(tab->m_name, "New (%d)", id);
@@ -260,93 +269,161 @@ void EditorTab::save()
 
 bool isReferenced(const Entity* referee, const TruthObject* candidate)
 {
-	return referee->instantiatedRoots.contains(candidate->root.asU64);
+	return referee->links->instantiatedRoots.contains(candidate->root.asU64);
 }
 
-void EditorTab::update()
+static bool overlapsPartition(truth::Key partition, u64 first, u64 last)
 {
-	ReadOnlySnapshot newHead = g_truth->head();
+	return truth::partitionFirst(partition) <= last && first <= truth::partitionLast(partition);
+}
 
-	if (m_state.s != newHead.s)
-	{
-		const Entity* rootEntity = (const Entity*)g_truth->read(m_state, m_root);
+// Applies the changes between the tab's last state and the new head to its instances.
+struct TabDiffVisitor : TruthDiffVisitor
+{
+	EditorTab* tab;
+	const Entity* rootEntity;
+	ReadOnlySnapshot newHead;
 
-		TempAllocator ta;
-		Array<KeyEntry> adds(&ta);
-		Array<KeyEntry> removes(&ta);
-		Array<KeyEntry> edits(&ta);
+	// adds and moves are applied in one batch each once the diff is done
+	Array<u64> addedIds;
+	Array<float3> addedPositions;
+	Array<u64> movedIds;
+	Array<float3> movedPositions;
 
-		diff(m_state.s, newHead.s, adds, edits, removes);
+	void queueAdd(truth::Key key, float3 pos)
+	{
+		addedIds.push_back(key.asU64);
+		addedPositions.push_back(pos);
+	}
 
+	void queueMove(truth::Key key, float3 pos)
+	{
+		movedIds.push_back(key.asU64);
+		movedPositions.push_back(pos);
+	}
 
-		for (auto& add : adds)
+	// Everything the tab shows was keyed in its own partition or in that of a
+	// prototype it instantiates, the other partitions' subtrees are skipped.
+	bool visitRange(u64 first, u64 last)
+	{
+		if (overlapsPartition(tab->m_root, first, last))
 		{
-			if (add.value->root == m_root)
-			{
-				float3 pos = get_position(newHead, add.key).float3();
-				addInstance(add.key.asU64, pos);
-
-				const Entity* added = (const Entity*)add.value;
-
-				if (added->prototype.asU64 != 0)
-				{
-					const Entity* proto = (const Entity*)g_truth->read(newHead, added->prototype);
+			return true;
+		}
 
-					for (truth::Key childKey : proto->children)
-					{
-						float3 cpos = get_position(newHead, childKey).float3();
-						addInstance(childKey.asU64, cpos);
-					}
-				}
-			}
-			else if (isReferenced(rootEntity, add.value))
+		for (auto& entry : rootEntity->links->instantiatedRoots)
+		{
+			if (overlapsPartition(truth::Key{ entry.key }, first, last))
 			{
-				float3 pos = get_position(newHead, add.key).float3();
-				addInstance(add.key.asU64, pos);
+				return true;
 			}
 		}
 
-		for (const KeyEntry& edit : edits)
+		return false;
+	}
+
+	void onAdd(truth::Key key, TruthObject* value)
+	{
+		if (value->root == tab->m_root)
 		{
-			if (edit.value->root == m_root)
-			{
-				constexpr float3 defaultColor =	{0.5f, 0.5f, 0.5f};
-				float3 newPos = get_position(newHead, edit.key).float3();
-				updateInstance(edit.key.asU64, newPos, defaultColor);
-			}
-			else if (isReferenced(rootEntity, edit.value))
+			float3 pos = get_position(newHead, key).float3();
+			queueAdd(key, pos);
+
+			const Entity* added = (const Entity*)value;
+
+			if (added->links->prototype.asU64 != 0)
 			{
-				constexpr float3 defaultColor =	{0.5f, 0.5f, 0.5f};
+				const Entity* proto = (const Entity*)g_truth->read(newHead, added->links->prototype);
 
-				auto instantiations = rootEntity->instantiatedRoots.find(edit.key.asU64);
-				if (instantiations)
+				for (truth::Key childKey : proto->hierarchy->children)
 				{
-					for (truth::Key instantiated : *instantiations)
-					{
-						float3 newPos = get_position(newHead, instantiated).float3();
-						updateInstance(instantiated.asU64, newPos, defaultColor);
-					}
+					float3 cpos = get_position(newHead, childKey).float3();
+					queueAdd(childKey, cpos);
 				}
-
-				updateInstance(edit.key.asU64, get_position(newHead, edit.key).float3(), defaultColor);
 			}
 		}
+		else if (isReferenced(rootEntity, value))
+		{
+			float3 pos = get_position(newHead, key).float3();
+			queueAdd(key, pos);
+		}
+	}
 
-		for (const KeyEntry& remove : removes)
+	void onEdit(truth::Key key, TruthObject* before, TruthObject* value)
+	{
+		// renames and hierarchy edits leave every instance where it was
+		if ((value->changedFields(before) & EntityField_Transform) == 0)
+		{
+			return;
+		}
+
+		if (value->root == tab->m_root)
+		{
+			float3 newPos = get_position(newHead, key).float3();
+			queueMove(key, newPos);
+		}
+		else if (isReferenced(rootEntity, value))
 		{
-			if (remove.value->root == m_root || isReferenced(rootEntity, remove.value))
+			// instances of the edited prototype in this tab inherit from it
+			g_truth->forEachReferrer(newHead, key, [&](truth::Key referrer)
 			{
-				popInstance(remove.key.asU64);
-				Entity* i = (Entity*)remove.value;
-				for (auto& instantiated : i->instantiatedRoots)
+				const Entity* instance = (const Entity*)g_truth->read(newHead, referrer);
+				if (instance->root == tab->m_root && instance->links->prototype == key)
 				{
-					
+					float3 newPos = get_position(newHead, referrer).float3();
+					queueMove(referrer, newPos);
 				}
-			}
+			});
+
+			queueMove(key, get_position(newHead, key).float3());
+		}
+	}
+
+	void onRemove(truth::Key key, TruthObject* value)
+	{
+		if (value->root == tab->m_root || isReferenced(rootEntity, value))
+		{
+			tab->popInstance(key.asU64);
 		}
+	}
+};
+
+void EditorTab::update()
+{
+	ReadOnlySnapshot newHead = g_truth->head();
+
+	// an undo followed by a redo of the same edit lands on equal content, nothing to redraw
+	if (m_state.s != newHead.s && g_truth->sameContent(m_state, newHead))
+	{
+		g_truth->retain(newHead);
+		g_truth->release(m_state);
+		m_state = newHead;
+	}
+	else if (m_state.s != newHead.s)
+	{
+		TempAllocator ta;
+		TabDiffVisitor visitor;
+		visitor.tab = this;
+		visitor.rootEntity = (const Entity*)g_truth->read(m_state, m_root);
+		visitor.newHead = newHead;
+		visitor.addedIds.set_allocator(&ta);
+		visitor.addedPositions.set_allocator(&ta);
+		visitor.movedIds.set_allocator(&ta);
+		visitor.movedPositions.set_allocator(&ta);
+
+		// the commit records cover everything still in the undo history
+		if (!g_truth->changes(m_state, newHead, visitor))
+		{
+			diff(m_state.s, newHead.s, visitor);
+		}
+
+		addInstances(visitor.addedIds.data(), visitor.addedPositions.data(), visitor.addedIds.size());
+		updateInstances(visitor.movedIds.data(), visitor.movedPositions.data(), visitor.movedIds.size());
 
 		buildDrawList();
 
+		g_truth->retain(newHead);
+		g_truth->release(m_state);
 		m_state = newHead;
 	}
 
@@ -389,7 +466,7 @@ DrawList EditorTab::getDrawList()
 
 void addPrototypeInstances(Transaction& tx, Entity* instantiated, const Entity* prototype)
 {
-	for (truth::Key childKey : prototype->children)
+	for (truth::Key childKey : prototype->hierarchy->children)
 	{
 	}
 }
@@ -409,18 +486,19 @@ void EditorTab::addPrototype(truth::Key parent, truth::Key prototype)
 	Entity* instantiatedPrototype = Entity::createFromPrototype(g_truth->allocator(), prototype);
 	instantiatedPrototype->root = m_root;
 
-	truth::Key instantiatedPrototypeId = nextKey();
+	truth::Key instantiatedPrototypeId = nextKey(m_root);
 
-	Array<truth::Key>* ids = parentEntity->instantiatedRoots.find(prototype.asU64);
+	EntityPrototype& links = parentEntity->links.write();
+	PersistentArray<truth::Key>* ids = links.instantiatedRoots.find(prototype.asU64);
 	
 	if (!ids)
 	{
-		ids = &parentEntity->instantiatedRoots[prototype.asU64];
+		ids = &links.instantiatedRoots[prototype.asU64];
 		ids->set_allocator(g_truth->allocator());
 	}
 
 	ids->push_back(instantiatedPrototypeId);
-	parentEntity->children.push_back(instantiatedPrototypeId);
+	parentEntity->hierarchy.write().children.push_back(instantiatedPrototypeId);
 
 	//addPrototypeInstances(instantiatedPrototype, prototypeEntity);
 
@@ -433,7 +511,7 @@ void EditorTab::instantiatePrototypeChild(truth::Key parent, truth::Key child)
 {
 	const Entity* parentEntity = (const Entity*)g_truth->read(m_state, parent);
 
-	if (parentEntity->prototype.asU64 == 0)
+	if (parentEntity->links->prototype.asU64 == 0)
 	{
 		return;
 	}
@@ -453,11 +531,11 @@ void EditorTab::addEntity(ReadOnlySnapshot from, ReadOnlySnapshot to, const KeyE
 
 		const Entity* added = (const Entity*)add.value;
 
-		if (added->prototype.asU64 != 0)
+		if (added->links->prototype.asU64 != 0)
 		{
-			const Entity* proto = (const Entity*)g_truth->read(newHead, added->prototype);
+			const Entity* proto = (const Entity*)g_truth->read(newHead, added->links->prototype);
 
-			for (truth::Key childKey : proto->children)
+			for (truth::Key childKey : proto->hierarchy->children)
 			{
 				float3 cpos = get_position(newHead, childKey).float3();
 				addInstance(childKey.asU64, cpos);
@@ -490,6 +568,37 @@ void EditorTab::updateInstance(u64 id, float3 pos, float3 color)
 	}
 }
 
+// Sizes the map once for a whole diff's worth of adds, opening a big scene
+// would otherwise rehash at every doubling on the way.
+void EditorTab::addInstances(const u64* ids, const float3* positions, i32 count)
+{
+	m_instances.reserve(m_instances.size() + count);
+
+	for (i32 i = 0; i < count; ++i)
+	{
+		addInstance(ids[i], positions[i]);
+	}
+}
+
+void EditorTab::updateInstances(const u64* ids, const float3* positions, i32 count)
+{
+	constexpr float3 defaultColor = { 0.5f, 0.5f, 0.5f };
+
+	TempAllocator ta;
+	Array<Instance*> instances(&ta);
+	instances.resize(count);
+	m_instances.find_many(ids, instances.data(), count);
+
+	for (i32 i = 0; i < count; ++i)
+	{
+		if (Instance* instance = instances[i])
+		{
+			instance->pos = positions[i];
+			instance->color = defaultColor;
+		}
+	}
+}
+
 void EditorTab::popInstance(u64 id)
 {
 	m_instances.erase(id);
@@ -539,6 +648,9 @@ void EditorApp::run()
         update();
 		renderFrame(m_renderer);
         present(m_renderer);
+
+		// frame is done with every snapshot it read from head()
+		g_truth->collect();
 	}
 }
 
@@ -660,12 +772,14 @@ Truth* g_truth;
 EditorApp::EditorApp(Allocator* a)
 {
 	InitializeRandomContext(&g_rand);
+	s_keySequence = g_rand.next();
 	m_openTabs.set_allocator(a);
 	m_assetWindow = create<AssetBrowserWindow>(a);
     m_renderer = nullptr;
     m_hFocusedTab = 0;
 
 	g_truth = create<Truth>(GLOBAL_HEAP, GLOBAL_HEAP);
+	g_truth->enableReferenceIndex();
     
 	i32 x = GetSystemMetrics(SM_CXSCREEN) - 60;
 	i32 y = GetSystemMetrics(SM_CYSCREEN) - 60;
@@ -6,6 +6,7 @@
 #include "TruthMap.h"
 #include "TruthView.h"
 #include "Core/HashMap.h"
+#include "Core/SwissMap.h"
 
 struct Entity;
 class AssetBrowserWindow;
@@ -53,13 +54,16 @@ struct EditorTab
 	void updateInstance(u64 id, float3 pos, float3 color);
 	void popInstance(u64 id);
 
+	void addInstances(const u64* ids, const float3* positions, i32 count);
+	void updateInstances(const u64* ids, const float3* positions, i32 count);
+
 	void buildDrawList();
 
 	EditorRenderer* m_renderer;
 	Array<IEditorWindow*> m_windows;
 	Array<EditorViewport*> m_viewports;
 
-	HashMap<Instance> m_instances;
+	SwissMap<Instance> m_instances;
 	DrawList m_drawList;
 	u64 m_id;
 
@@ -11,24 +11,25 @@ Position get_position(ReadOnlySnapshot s, truth::Key objectId)
 {
 	const Entity* entity = (const Entity*)g_truth->read(s, objectId);
 
-	Position res = entity->position;
+	const Position& position = entity->transform->position;
+	Position res = position;
 
-	if (entity->prototype.u64 != 0 && (entity->position.inheritsX || entity->position.inheritsY || entity->position.inheritsZ))
+	if (entity->links->prototype.asU64 != 0 && (position.inheritsX || position.inheritsY || position.inheritsZ))
 	{
-		Position prototypePosition = get_position(s, entity->prototype);
+		Position prototypePosition = get_position(s, entity->links->prototype);
 
-		if (entity->position.inheritsX)
+		if (position.inheritsX)
 		{
 			res.x = prototypePosition.x;
 
 		}
 
-		if (entity->position.inheritsY)
+		if (position.inheritsY)
 		{
 			res.y = prototypePosition.y;
 		}
 
-		if (entity->position.inheritsZ)
+		if (position.inheritsZ)
 		{
 			res.z = prototypePosition.z;
 		}
@@ -48,53 +49,60 @@ void set_position(Transaction& tx, truth::Key objectId, Position p)
 	Entity* entity = (Entity*)g_truth->edit(tx, objectId);
 	Position current = get_position(tx.uncommitted.asImmutable(), objectId);
 
-	if (entity->prototype.u64 != 0)
+	// copies the transform group only, children and prototype links stay shared
+	Position& position = entity->transform.write().position;
+
+	if (entity->links->prototype.asU64 != 0)
 	{
-		if (entity->position.inheritsX && !float_almost_equal(current.x, p.x))
+		if (position.inheritsX && !float_almost_equal(current.x, p.x))
 		{
-			entity->position.inheritsX = false;
+			position.inheritsX = false;
 		}
 
-		if (entity->position.inheritsY && !float_almost_equal(current.y,p.y))
+		if (position.inheritsY && !float_almost_equal(current.y,p.y))
 		{
-			entity->position.inheritsY = false;
+			position.inheritsY = false;
 		}
 
-		if (entity->position.inheritsZ && !float_almost_equal(current.z, p.z))
+		if (position.inheritsZ && !float_almost_equal(current.z, p.z))
 		{
-			entity->position.inheritsZ = false;
+			position.inheritsZ = false;
 		}
 	}
 
-	entity->position.x = p.x;
-	entity->position.y = p.y;
-	entity->position.z = p.z;
+	position.x = p.x;
+	position.y = p.y;
+	position.z = p.z;
 }
 
 Entity* Entity::create(Allocator* a)
 {
 	Entity* entity = alloc<Entity>(a);
-	entity->children.set_allocator(a);
-	entity->instantiatedRoots.set_allocator(a);
-	sprintf_s(entity->name, "New Entity (%d)", s_nextId++);
+	entity->transform.init(a);
+	entity->hierarchy.init(a);
+	entity->links.init(a);
+	entity->name.init(a);
+
+	entity->hierarchy.write().children.set_allocator(a);
+	entity->links.write().instantiatedRoots.set_allocator(a);
+	sprintf_s(entity->name.write().name, "New Entity (%d)", s_nextId++);
 
 	return entity;
 }
 
 Entity* Entity::createFromPrototype(Allocator* a, truth::Key prototype)
 {
-	Entity* entity = alloc<Entity>(a);
+	Entity* entity = create(a);
 	const Entity* prototypeEntity  = (const Entity*)g_truth->read(g_truth->snap(), prototype);
 
-	entity->position = prototypeEntity->position;
-	entity->prototype = prototype;
-	entity->position.inheritsX = true;
-	entity->position.inheritsY = true;
-	entity->position.inheritsZ = true;
+	Position& position = entity->transform.write().position;
+	position = prototypeEntity->transform->position;
+	position.inheritsX = true;
+	position.inheritsY = true;
+	position.inheritsZ = true;
 
-	entity->children.set_allocator(a);
-	entity->instantiatedRoots.set_allocator(a);
-	sprintf_s(entity->name, "Instance of prototype (%s) ", prototypeEntity->name);
+	entity->links.write().prototype = prototype;
+	sprintf_s(entity->name.write().name, "Instance of prototype (%s) ", prototypeEntity->name->name);
 
 	return entity;
 }
@@ -105,11 +113,122 @@ TruthObject* Entity::clone(Allocator* a) const
 	Entity* entityClone = alloc<Entity>(a);
 	entityClone->root = root;
 
-	entityClone->children = children.clone();
-	entityClone->instantiatedRoots = instantiatedRoots.clone();
-	entityClone->position = position;
-	entityClone->prototype = prototype;
+	entityClone->transform = transform;
+	entityClone->hierarchy = hierarchy;
+	entityClone->links = links;
+	entityClone->name = name;
 
-	memcpy(entityClone->name, name, sizeof(name));
 	return entityClone;
 }
+
+u64 Entity::contentHash() const
+{
+	u64 groups[4] = { transform.contentHash(), hierarchy.contentHash(), links.contentHash(), name.contentHash() };
+
+	MetroHash64 hash(kTypeId);
+	hash.Update((const u8*)&root, sizeof(root));
+	hash.Update((const u8*)groups, sizeof(groups));
+
+	return hash.Finalize();
+}
+
+void Entity::references(Array<truth::Key>& out) const
+{
+	hierarchy->children.forEachChunk([&](const truth::Key* children, i32 count)
+	{
+		for (i32 i = 0; i < count; ++i)
+		{
+			out.push_back(children[i]);
+		}
+	});
+
+	if (links->prototype.asU64 != 0)
+	{
+		out.push_back(links->prototype);
+	}
+
+	for (auto& entry : links->instantiatedRoots)
+	{
+		out.push_back(truth::Key{ entry.key });
+		for (truth::Key instance : entry.value)
+		{
+			out.push_back(instance);
+		}
+	}
+}
+
+u32 Entity::changedFields(const TruthObject* before) const
+{
+	if (before->typeId() != kTypeId)
+	{
+		return ~0u;
+	}
+
+	const Entity* entity = (const Entity*)before;
+
+	u32 fields = 0;
+	fields |= transform.same(entity->transform) ? 0 : EntityField_Transform;
+	fields |= hierarchy.same(entity->hierarchy) ? 0 : EntityField_Hierarchy;
+	fields |= links.same(entity->links) ? 0 : EntityField_Prototype;
+	fields |= name.same(entity->name) ? 0 : EntityField_Name;
+
+	return fields;
+}
+
+u64 EntityTransform::contentHash() const
+{
+	// field by field, Position has padding
+	MetroHash64 hash(EntityField_Transform);
+	hash.Update((const u8*)&position.inheritsX, sizeof(bool));
+	hash.Update((const u8*)&position.inheritsY, sizeof(bool));
+	hash.Update((const u8*)&position.inheritsZ, sizeof(bool));
+	hash.Update((const u8*)&position.x, sizeof(float) * 3);
+
+	return hash.Finalize();
+}
+
+EntityHierarchy EntityHierarchy::clone() const
+{
+	EntityHierarchy copy;
+	copy.children = children.clone();
+
+	return copy;
+}
+
+u64 EntityHierarchy::contentHash() const
+{
+	// node hashes are cached in the array, only the path of the last write is hashed again
+	u64 hash = children.contentHash([](truth::Key child) { return truth::mixHash(child.asU64); });
+	return truth::mixHash(hash + EntityField_Hierarchy);
+}
+
+EntityPrototype EntityPrototype::clone() const
+{
+	EntityPrototype copy;
+	copy.prototype = prototype;
+	copy.instantiatedRoots = instantiatedRoots.clone();
+
+	return copy;
+}
+
+u64 EntityPrototype::contentHash() const
+{
+	// map order depends on insertion history, combine entries order independently
+	u64 instantiated = 0;
+	for (auto& entry : instantiatedRoots)
+	{
+		u64 ids = entry.value.contentHash([](truth::Key instance) { return truth::mixHash(instance.asU64); });
+		instantiated += truth::mixHash(ids ^ entry.key);
+	}
+
+	MetroHash64 hash(EntityField_Prototype);
+	hash.Update((const u8*)&prototype, sizeof(prototype));
+	hash.Update((const u8*)&instantiated, sizeof(instantiated));
+
+	return hash.Finalize();
+}
+
+u64 EntityName::contentHash() const
+{
+	return MetroHash64::Hash((const u8*)name, strnlen(name, sizeof(name)), EntityField_Name);
+}
@@ -6,6 +6,8 @@
 #include "TruthView.h"
 #include "Core/Array.h"
 #include "Core/HashMap.h"
+#include "Core/PersistentArray.h"
+#include "Core/PersistentHashMap.h"
 
 
 
@@ -32,6 +34,49 @@ struct Position
 Position get_position(ReadOnlySnapshot snap, truth::Key objectId);
 void set_position(Transaction& tx, truth::Key objectId, Position p);
 
+// Field groups of an Entity, each shared between versions until written.
+enum EntityField : u32
+{
+	EntityField_Transform = 1 << 0,
+	EntityField_Hierarchy = 1 << 1,
+	EntityField_Prototype = 1 << 2,
+	EntityField_Name = 1 << 3,
+};
+
+struct EntityTransform
+{
+	Position position = {};
+
+	u64 contentHash() const;
+};
+
+struct EntityHierarchy
+{
+	// shared between versions, adding a child copies a path instead of the list
+	PersistentArray<truth::Key> children;
+
+	EntityHierarchy clone() const;
+	u64 contentHash() const;
+};
+
+struct EntityPrototype
+{
+	truth::Key prototype = {};
+
+	// instances by prototype root, cloning shares the whole map
+	PersistentHashMap<PersistentArray<truth::Key>> instantiatedRoots;
+
+	EntityPrototype clone() const;
+	u64 contentHash() const;
+};
+
+struct EntityName
+{
+	char name[64] = {};
+
+	u64 contentHash() const;
+};
+
 struct Entity : TruthObject
 {
 	constexpr static const char* kName = "Entity";
@@ -48,15 +93,17 @@ struct Entity : TruthObject
 	}
 
 	TruthObject* clone(Allocator* a) const override;
+	u64 contentHash() const override;
+	void references(Array<truth::Key>& out) const override;
+	u32 changedFields(const TruthObject* before) const override;
 
-	Array<truth::Key> children;
-	HashMap<Array<truth::Key>> instantiatedRoots;
-
-	truth::Key prototype;
-
-	char name[64];
+	u32 referenceFields() const override
+	{
+		return EntityField_Hierarchy | EntityField_Prototype;
+	}
 
-	
-	Position position = {};
+	TruthField<EntityTransform> transform;
+	TruthField<EntityHierarchy> hierarchy;
+	TruthField<EntityPrototype> links;
+	TruthField<EntityName> name;
 };
-
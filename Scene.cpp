@@ -298,7 +298,7 @@ void DoEntityContextMenu(Truth* truth, truth::Key key, const Entity* entity) {
 	{
 		if (ImGui::MenuItem("Rename"))
 		{
-			strncpy_s(nameBuffer, entity->name, sizeof(nameBuffer) - 1);
+			strncpy_s(nameBuffer, entity->name->name, sizeof(nameBuffer) - 1);
 			nameBuffer[sizeof(nameBuffer) - 1] = '\0';
 			isRenaming = true;
 			ImGui::OpenPopup("Rename Entity");
@@ -367,7 +367,7 @@ void DrawEntityHierarchy(Truth* truth, ReadOnlySnapshot snap, truth::Key key, tr
 	ImGui::PushID((int)key.u64);
 
 	ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_OpenOnArrow | ImGuiTreeNodeFlags_OpenOnDoubleClick;
-	if (entity->children.empty())
+	if (entity->hierarchy->children.empty())
 	{
 		flags |= ImGuiTreeNodeFlags_Leaf;
 	}
@@ -378,13 +378,13 @@ void DrawEntityHierarchy(Truth* truth, ReadOnlySnapshot snap, truth::Key key, tr
 	}
 
 	char buf[64];
-	if (entity->children.empty())
+	if (entity->hierarchy->children.empty())
 	{
-		sprintf_s(buf, "%s", entity->name);
+		sprintf_s(buf, "%s", entity->name->name);
 	}
 	else
 	{
-		sprintf_s(buf, "%s [%d]", entity->name, entity->children.size());
+		sprintf_s(buf, "%s [%d]", entity->name->name, entity->hierarchy->children.size());
 	}
 	if (ImGui::TreeNodeEx(buf, flags))
 	{
@@ -393,7 +393,7 @@ void DrawEntityHierarchy(Truth* truth, ReadOnlySnapshot snap, truth::Key key, tr
 			*selected = key;
 		}
 
-		for (truth::Key child : entity->children)
+		for (truth::Key child : entity->hierarchy->children)
 		{
 			DrawEntityHierarchy(truth, snap, child, selected);
 		}
@@ -509,7 +509,7 @@ void OutlinerWindow::update()
 
 	if (ImGui::Button("Add Entity"))
 	{
-		truth::Key newEntityId = nextKey();
+		truth::Key newEntityId = nextKey(m_root);
 		Entity* newEntity = Entity::create(m_truth->allocator());
 		newEntity->root = m_root;
 
@@ -517,7 +517,7 @@ void OutlinerWindow::update()
 
 		Entity* parent = (Entity*)m_truth->edit(tx, m_root);
 		
-		parent->children.push_back(newEntityId);
+		parent->hierarchy.write().children.push_back(newEntityId);
 		newEntity->root = m_root;
 
 		m_truth->add(tx, newEntityId, newEntity);
@@ -543,7 +543,7 @@ void AssetBrowserWindow::update(truth::Key* outClicked)
 	for (truth::Key root : roots)
 	{
 		const Entity* entity = (const Entity*)g_truth->read(s, root);
-		if (ImGui::Button(entity->name))
+		if (ImGui::Button(entity->name->name))
 		{
 			*outClicked = root;
 		}
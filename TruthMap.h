@@ -3,32 +3,33 @@
 #include <cassert>
 
 #include "Core/Allocator.h"
+#include "Core/ArenaAllocator.h"
 #include "Core/Array.h"
+#include "Core/Atomic.h"
+#include "Core/Bits.h"
+#include "Core/HashMap.h"
 #include "Core/Types.h"
 
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TRUTH_SSE2 1
+#endif
+
 namespace truth
 {
-constexpr static int BlockBits = 2;
-constexpr static int NumBlocks = (1 << BlockBits);
+// Every node consumes NodeBits of the key, starting from the top bits.
+constexpr static int NodeBits = 5;
+constexpr static int NodeFanout = (1 << NodeBits);
+
+// Deepest level that still has a full NodeBits of key left to index with.
+constexpr static int MaxDepth = 64 / NodeBits;
 
-constexpr static int EntryBits = 2;
-constexpr static int NumEntries = (1 << EntryBits);
+// A leaf growing past this is pushed one level down into a new node.
+constexpr static u32 LeafSplitSize = 64;
 
 struct Key
 {
-#pragma warning(push)
-#pragma warning(disable: 4201)
-	union
-	{
-		u64 asU64;
-		struct
-		{
-			u64 Index : 64 - (BlockBits + EntryBits);
-			u64 Entry : EntryBits;
-			u64 Block : BlockBits;
-		};
-	};
-#pragma warning (pop)
+	u64 asU64;
 };
 
 inline bool operator==(truth::Key a, truth::Key b)
@@ -40,6 +41,77 @@ inline bool operator!=(truth::Key a, truth::Key b)
 	return a.asU64 != b.asU64;
 }
 
+inline u32 slotAt(u64 key, u32 level)
+{
+	return u32(key >> (64 - (level + 1) * NodeBits)) & (NodeFanout - 1);
+}
+
+inline u32 slotAt(truth::Key key, u32 level)
+{
+	return slotAt(key.asU64, level);
+}
+
+// Keys allocated for one partition (a root, tab or prototype asset) share their
+// top PartitionBits, so they all sit in a single subtree below the first
+// PartitionBits / NodeBits levels. Commits editing one partition then path
+// copy only that subtree, and a diff can skip every other one.
+constexpr static int PartitionBits = 4 * NodeBits;
+constexpr static int UniqueBits = 64 - PartitionBits;
+constexpr static u64 UniqueMask = (u64(1) << UniqueBits) - 1;
+
+inline u64 partitionOf(u64 key)
+{
+	return key >> UniqueBits;
+}
+
+inline u64 partitionOf(truth::Key key)
+{
+	return partitionOf(key.asU64);
+}
+
+// First and last key of the partition key belongs to.
+inline u64 partitionFirst(truth::Key key)
+{
+	return key.asU64 & ~UniqueMask;
+}
+
+inline u64 partitionLast(truth::Key key)
+{
+	return key.asU64 | UniqueMask;
+}
+
+// Key number sequence of partition. The low bits go through a bijection so
+// distinct sequence numbers give distinct keys that still spread evenly over
+// the partition's subtree instead of piling up in one leaf.
+inline truth::Key partitionKey(truth::Key partition, u64 sequence)
+{
+	u64 x = sequence & UniqueMask;
+	x = (x * 0x9e3779b97f4a7c15ULL) & UniqueMask;
+	x ^= x >> (UniqueBits / 2);
+	x = (x * 0xbf58476d1ce4e5b9ULL) & UniqueMask;
+	x ^= x >> (UniqueBits / 2 - 1);
+
+	return truth::Key{ partitionFirst(partition) | x };
+}
+
+// splitmix64 finalizer, spreads every input bit over the whole result.
+inline u64 mixHash(u64 x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+// Subtree hashes are the sum of their entry hashes, so the same entries hash
+// the same whether they sit in one leaf or were split over a node.
+inline u64 entryHash(u64 key, u64 valueHash)
+{
+	return mixHash(key ^ mixHash(valueHash));
+}
+
 }
 
 enum PrototypeRelation : u8 
@@ -58,7 +130,144 @@ struct TruthObject
 	virtual u64 typeId() const = 0;
 	virtual TruthObject* clone(Allocator* a) const = 0;
 
+	// Hash of everything the object holds, equal objects must hash equal.
+	virtual u64 contentHash() const = 0;
+
+	// Appends every key the object refers to, duplicates are fine.
+	virtual void references(Array<truth::Key>& /*out*/) const {}
+
+	// Bit per field group (see TruthField) that may differ from before, an
+	// object without groups is always changed as a whole.
+	virtual u32 changedFields(const TruthObject* /*before*/) const { return ~0u; }
+
+	// Field groups holding the keys returned by references().
+	virtual u32 referenceFields() const { return ~0u; }
+
 	truth::Key root;
+
+	// Number of leaf slots across all live snapshots holding this object.
+	u32 refs = 0;
+
+	// contentHash() cached when the object is first committed, 0 until then.
+	u64 hash = 0;
+};
+
+// A group of an object's fields, shared by every clone of the object until one
+// of them writes to it. Cloning an object made of groups copies the group
+// pointers, and an edit copies just the groups it calls write() on.
+// T provides contentHash() and clone() if a plain copy would share its memory.
+template<typename T>
+class TruthField
+{
+public:
+	template<typename U>
+	static auto test_clone(U* p) -> decltype(p->clone(), char(0)) { return 0; }
+	static char(&test_clone(...))[2] { static char arr[2] = {}; return arr; }
+
+	static constexpr bool has_clone = sizeof(test_clone((T*)0)) == 1;
+
+	TruthField() = default;
+
+	TruthField(const TruthField& other)
+		: m_group(other.m_group)
+	{
+		if (m_group)
+		{
+			atomicIncrement(&m_group->refs);
+		}
+	}
+
+	TruthField& operator=(const TruthField& other)
+	{
+		if (other.m_group)
+		{
+			atomicIncrement(&other.m_group->refs);
+		}
+		release();
+		m_group = other.m_group;
+
+		return *this;
+	}
+
+	~TruthField()
+	{
+		release();
+	}
+
+	// Gives the field a group of its own with default contents.
+	void init(Allocator* allocator)
+	{
+		release();
+		m_group = create<Group>(allocator);
+		m_group->refs = 1;
+		m_group->allocator = allocator;
+	}
+
+	const T& operator*() const { return m_group->value; }
+	const T* operator->() const { return &m_group->value; }
+
+	// Contents to write to, copied first while any other object shares them.
+	T& write()
+	{
+		if (m_group->refs > 1)
+		{
+			Group* copy = create<Group>(m_group->allocator);
+			copy->refs = 1;
+			copy->allocator = m_group->allocator;
+			if constexpr (has_clone)
+			{
+				copy->value = m_group->value.clone();
+			}
+			else
+			{
+				copy->value = m_group->value;
+			}
+
+			release();
+			m_group = copy;
+		}
+
+		m_group->hash = 0;
+		return m_group->value;
+	}
+
+	// False once either side wrote to the group since they were cloned.
+	bool same(const TruthField& other) const
+	{
+		return m_group == other.m_group;
+	}
+
+	// T::contentHash() of the contents, cached in the group until its next write.
+	u64 contentHash() const
+	{
+		if (m_group->hash == 0)
+		{
+			m_group->hash = m_group->value.contentHash();
+		}
+
+		return m_group->hash;
+	}
+
+private:
+	struct Group
+	{
+		T value;
+		u32 refs = 0;
+		u64 hash = 0;
+		Allocator* allocator = nullptr;
+	};
+
+	void release()
+	{
+		if (m_group && atomicDecrement(&m_group->refs) == 0)
+		{
+			Allocator* allocator = m_group->allocator;
+			destroy(*allocator, m_group);
+		}
+		m_group = nullptr;
+	}
+
+	Group* m_group = nullptr;
 };
 
 struct KeyEntry
@@ -67,7 +276,38 @@ struct KeyEntry
 	TruthObject* value;
 
 	bool operator==(const KeyEntry& other) const { return value == other.value; }
-	bool operator<(const KeyEntry& other) const { return key.Index < other.key.Index; }
+	bool operator<(const KeyEntry& other) const { return key.asU64 < other.key.asU64; }
+};
+
+// Receives diff results as they are found. Derive and hide what is needed,
+// visitRange lets a visitor skip every subtree holding keys in [first, last]
+// it has no interest in. after->changedFields(before) tells an onEdit which
+// field groups were written.
+struct TruthDiffVisitor
+{
+	bool visitRange(u64 /*first*/, u64 /*last*/) { return true; }
+
+	void onAdd(truth::Key /*key*/, TruthObject* /*value*/) {}
+	void onEdit(truth::Key /*key*/, TruthObject* /*before*/, TruthObject* /*after*/) {}
+	void onRemove(truth::Key /*key*/, TruthObject* /*value*/) {}
+};
+
+// Gathers a diff into arrays. Edits and adds carry the new value, removes the old one.
+struct DiffCollector : TruthDiffVisitor
+{
+	DiffCollector(Array<KeyEntry>& adds, Array<KeyEntry>& edits, Array<KeyEntry>& removes)
+		: adds(adds)
+		, edits(edits)
+		, removes(removes)
+	{}
+
+	Array<KeyEntry>& adds;
+	Array<KeyEntry>& edits;
+	Array<KeyEntry>& removes;
+
+	void onAdd(truth::Key key, TruthObject* value) { adds.push_back(KeyEntry{ key, value }); }
+	void onEdit(truth::Key key, TruthObject*, TruthObject* after) { edits.push_back(KeyEntry{ key, after }); }
+	void onRemove(truth::Key key, TruthObject* value) { removes.push_back(KeyEntry{ key, value }); }
 };
 
  inline u32 lower_bound(const KeyEntry *begin, const KeyEntry *end, const KeyEntry &key) 
@@ -90,527 +330,1693 @@ struct KeyEntry
 	return left;
 }
 
-class TruthMap;
-
-struct ReadOnlySnapshot
+namespace truth
 {
-	TruthMap* s;
-};
+// Leaves up to this size are searched with a SIMD compare scan, bigger ones are binary searched.
+constexpr static u32 LinearScanSize = 32;
 
-struct Snapshot
+// Branchless lower bound, the compare compiles to a cmov so there is nothing to mispredict.
+inline u32 lowerBound(const u64* keys, u32 count, u64 key)
 {
-	ReadOnlySnapshot asImmutable() { return ReadOnlySnapshot{ s }; }
-	TruthMap* s;
-};
+	if (count == 0)
+	{
+		return 0;
+	}
 
-class TruthMap
+	const u64* it = keys;
+	u32 n = count;
+	while (n > 1)
+	{
+		u32 half = n >> 1;
+		it = (it[half] < key) ? it + half : it;
+		n -= half;
+	}
+
+	return u32(it - keys) + (*it < key ? 1 : 0);
+}
+
+inline u32 scanKeys(const u64* keys, u32 count, u64 key)
 {
-public:
-	explicit TruthMap(Allocator* allocator)
-		: m_allocator(allocator)
-	{}
+	u32 i = 0;
 
-	struct InlineArray
+#if defined(TRUTH_SSE2)
+	const __m128i needle = _mm_set1_epi64x(i64(key));
+	for (; i + 4 <= count; i += 4)
 	{
-		u32 size;
-		u32 _pad;
+		__m128i lo = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(keys + i)), needle);
+		__m128i hi = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(keys + i + 2)), needle);
 
-#pragma warning(push)
-#pragma warning(disable:4200)
-		KeyEntry data[0];
-#pragma warning(pop)
+		// sse2 has no 64 bit compare, both 32 bit halves have to match
+		lo = _mm_and_si128(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+		hi = _mm_and_si128(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
 
-		KeyEntry* begin() { return data; }
-		KeyEntry* end() { return data + size; }
+		i32 mask = _mm_movemask_pd(_mm_castsi128_pd(lo)) | (_mm_movemask_pd(_mm_castsi128_pd(hi)) << 2);
+		if (mask)
+		{
+			while ((mask & 1) == 0)
+			{
+				mask >>= 1;
+				++i;
+			}
+			return i;
+		}
+	}
+#endif
 
-		static InlineArray* alloc(Allocator* arena, i32 capacity)
+	for (; i < count; ++i)
+	{
+		if (keys[i] == key)
 		{
-			i32 structSize = sizeof(InlineArray);
-			i32 dynamicArraySize = i32(sizeof(KeyEntry) * capacity);
-			InlineArray* arr = (InlineArray*)arena->alloc(structSize + dynamicArraySize);
-			arr->size = 0;
-			return arr;
+			return i;
 		}
-	};
+	}
 
-	static_assert(sizeof(InlineArray) == 8, "InlineArray size must be 8 bytes");
+	return u32(-1);
+}
 
-	struct Block
+inline u32 findKey(const u64* keys, u32 count, u64 key)
+{
+	if (count <= LinearScanSize)
 	{
-		InlineArray* entries[truth::NumEntries]{};
-	};
+		return scanKeys(keys, count, key);
+	}
 
-	struct BigBlock
-	{
-		Block* blocks[truth::NumBlocks]{};
-	};
+	u32 i = lowerBound(keys, count, key);
+	return (i < count && keys[i] == key) ? i : u32(-1);
+}
 
-	static void diff(
-		TruthMap* from,
-		TruthMap* to,
-		Array<Block*>& outBlocks,
-		Array<InlineArray*>& outEntryArrays,
-		Array<KeyEntry>& outEntries)
+// LSD radix sort on the key, scratch must hold count entries. Passes where every
+// key has the same byte are skipped. Result ends up back in entries.
+inline void sortByKey(KeyEntry* entries, KeyEntry* scratch, u32 count)
+{
+	if (count < 64)
 	{
-		outBlocks.clear();
-		outEntryArrays.clear();
-		outEntries.clear();
-
-		if (from->m_root != to->m_root)
+		for (u32 i = 1; i < count; ++i)
 		{
-			Block** arrFrom = from->m_root->blocks;
-			Block** arrTo = to->m_root->blocks;
-			for (u32 i = 0; i < truth::NumBlocks; ++i)
+			KeyEntry e = entries[i];
+			u32 j = i;
+			while (j > 0 && e < entries[j - 1])
 			{
-				if (arrFrom[i] != arrTo[i])
-				{
-					diff(arrFrom[i], arrTo[i], outEntryArrays, outEntries);
-					outBlocks.push_back(arrFrom[i]);
-				}
+				entries[j] = entries[j - 1];
+				--j;
 			}
+			entries[j] = e;
 		}
+		return;
 	}
 
-	static TruthMap* makeRoot(Allocator* allocator)
-	{
-		TruthMap* instance = create<TruthMap>(allocator, allocator);
-
-		instance->m_root = create<BigBlock>(allocator);
+	KeyEntry* from = entries;
+	KeyEntry* to = scratch;
 
-		for (Block*& block : instance->m_root->blocks)
+	for (u32 shift = 0; shift < 64; shift += 8)
+	{
+		u32 offsets[256] = {};
+		for (u32 i = 0; i < count; ++i)
 		{
-			block = create<Block>(allocator);
+			++offsets[(from[i].key.asU64 >> shift) & 0xff];
 		}
 
-		return instance;
-	}
+		if (offsets[(from[0].key.asU64 >> shift) & 0xff] == count)
+		{
+			continue;
+		}
 
-	static TruthMap* lookupForWrite(
-		const TruthMap* base,
-		TruthMap* head,
-		truth::Key key,
-		TruthObject** outEntry)
-	{
-		InlineArray* array;
-		u32 slot;
-		TruthMap* update = getWritableEntryArray(base, head, key, false, &array, &slot);
+		u32 sum = 0;
+		for (u32& offset : offsets)
+		{
+			u32 c = offset;
+			offset = sum;
+			sum += c;
+		}
 
-		if (array->data[slot].value == nullptr)
+		for (u32 i = 0; i < count; ++i)
 		{
-			array->data[slot].value = base->find(key)->clone(head->m_allocator);
+			to[offsets[(from[i].key.asU64 >> shift) & 0xff]++] = from[i];
 		}
-		*outEntry = array->data[slot].value;
 
-		return update;
+		KeyEntry* temp = from;
+		from = to;
+		to = temp;
 	}
 
-	static TruthMap* writeValue(const TruthMap* base, TruthMap* head, truth::Key key, TruthObject* value)
+	if (from != entries)
 	{
-		InlineArray* array;
-		u32 slot;
-		TruthMap* update = getWritableEntryArray(base, head, key, false, &array, &slot);
-		assert(array->data[slot].value == nullptr);
-		KeyEntry& dst = array->data[slot];
-		dst.value = value;
-
-		return update;
+		memcpy(entries, from, count * sizeof(KeyEntry));
 	}
+}
 
-	static TruthMap* erase(
-		const TruthMap* base,
-		TruthMap* head,
-		truth::Key key)
-	{
-		InlineArray* array;
-		u32 slot;
-		TruthMap* update = getWritableEntryArray(base, head, key, true, &array, &slot);
+}
 
-		// keep array in sorted order
-		array->data[slot] = {};
-		for (u32 i = slot; i < (array->size - 1); ++i)
-		{
-			array->data[i] = array->data[i + 1];
-		}
-		array->size -= 1;
+class TruthMap;
 
-		return update;
-	}
+struct ReadOnlySnapshot
+{
+	TruthMap* s;
+};
 
-	const TruthObject* find(truth::Key key) const
+struct Snapshot
+{
+	ReadOnlySnapshot asImmutable() { return ReadOnlySnapshot{ s }; }
+	TruthMap* s;
+};
+
+// Secondary index of a snapshot by TruthObject::typeId. Each type has its own
+// map holding the same key and object entries as the snapshot, so listing one
+// type costs O(result). A commit copies the small type table and path copies
+// the maps of the types it touched, the rest are shared with the index of
+// the snapshot before.
+struct TypeIndex
+{
+	struct Type
 	{
-		const InlineArray* entries = getEntries(key);
+		u64 typeId;
+		TruthMap* objects;
+	};
 
-		if (entries)
+	explicit TypeIndex(Allocator* allocator)
+		: types(allocator)
+	{}
+
+	// sorted by typeId
+	Array<Type> types;
+	u32 refs = 1;
+
+	i32 find(u64 typeId) const
+	{
+		i32 left = 0;
+		i32 right = types.size();
+		while (left < right)
 		{
-			for (u32 i = 0; i < entries->size; ++i)
+			i32 mid = left + ((right - left) >> 1);
+			if (types[mid].typeId < typeId)
 			{
-				if (entries->data[i].key.Index == key.Index)
-				{
-					return entries->data[i].value;
-				}
+				left = mid + 1;
+			}
+			else
+			{
+				right = mid;
 			}
 		}
+		return left;
+	}
 
-		return nullptr;
+	TruthMap* objects(u64 typeId) const
+	{
+		i32 i = find(typeId);
+		return (i < types.size() && types[i].typeId == typeId) ? types[i].objects : nullptr;
 	}
+};
 
-	u32 size() const { return m_size; }
+class TruthMap
+{
+public:
+	explicit TruthMap(Allocator* allocator)
+		: m_allocator(allocator)
+	{}
 
-	BigBlock* root() const
+	// Maps, nodes, leaves and objects are reference counted. A map starts with
+	// one reference owned by its creator, nodes and leaves by the parent they
+	// are linked into and objects by every leaf slot holding them. Releasing
+	// the last reference to a map frees exactly what no other snapshot shares.
+	// Counts are interlocked since transactions on other threads path copy
+	// from the same shared nodes.
+	static void retain(TruthMap* map)
 	{
-		return m_root;
+		atomicIncrement(&map->m_refs);
 	}
 
-private:
-	static TruthMap* getWritableEntryArray(
-		const TruthMap* base,
-		TruthMap* head,
-		truth::Key key,
-		bool erasing,
-		InlineArray** outArray,
-		u32* outSlot)
+	static void release(TruthMap* map)
 	{
-		TruthMap* updated = head;
-		Allocator* allocator = head->m_allocator;
-
-		if (updated == base)
+		if (atomicDecrement(&map->m_refs) == 0)
 		{
-			updated = create<TruthMap>(allocator, allocator);
-			updated->m_size = head->size();
-			updated->m_root = head->m_root;
+			Allocator* allocator = map->m_allocator;
+			releaseNode(allocator, map->m_root);
+			releaseTypes(map->m_types);
+			if (map->m_referrers)
+			{
+				release(map->m_referrers);
+			}
+			allocator->free(map);
 		}
+	}
 
-		BigBlock* bigBlockUpdate = updated->m_root;
-		const BigBlock* baseBigBlock = base->m_root;
-		if (bigBlockUpdate == baseBigBlock)
+	static void releaseTypes(TypeIndex* index)
+	{
+		if (index && atomicDecrement(&index->refs) == 0)
 		{
-			bigBlockUpdate = create<BigBlock>(allocator);
-			memcpy(bigBlockUpdate, baseBigBlock, sizeof(BigBlock));
-			updated->m_root = bigBlockUpdate;
-		}
+			Allocator* allocator = index->types.get_allocator();
+			for (const TypeIndex::Type& type : index->types)
+			{
+				release(type.objects);
+			}
+			destroy(*allocator, index);
+		}
+	}
+
+	// Keys and values live in separate arrays so a search only touches keys.
+	// The values start right after the last key slot.
+	struct InlineArray
+	{
+		u32 size;
+		u32 capacity;
+		u32 refs;
+
+		// Set once hash is computed, see seal(). Sealed leaves are never written again.
+		u32 sealed;
+		u64 hash;
+
+#pragma warning(push)
+#pragma warning(disable:4200)
+		u64 keys[0];
+#pragma warning(pop)
+
+		TruthObject** values() { return (TruthObject**)(keys + capacity); }
+		TruthObject* const* values() const { return (TruthObject* const*)(keys + capacity); }
+
+		KeyEntry entry(u32 i) const { return KeyEntry{ truth::Key{ keys[i] }, values()[i] }; }
+
+		u32 find(truth::Key key) const { return truth::findKey(keys, size, key.asU64); }
+
+		void insert(u32 slot, truth::Key key, TruthObject* value)
+		{
+			assert(size < capacity);
+
+			TruthObject** vals = values();
+			memmove(keys + slot + 1, keys + slot, (size - slot) * sizeof(u64));
+			memmove(vals + slot + 1, vals + slot, (size - slot) * sizeof(TruthObject*));
+			keys[slot] = key.asU64;
+			vals[slot] = value;
+			++size;
+		}
+
+		void remove(u32 slot)
+		{
+			TruthObject** vals = values();
+			memmove(keys + slot, keys + slot + 1, (size - slot - 1) * sizeof(u64));
+			memmove(vals + slot, vals + slot + 1, (size - slot - 1) * sizeof(TruthObject*));
+			--size;
+		}
+
+		static InlineArray* alloc(Allocator* arena, i32 capacity)
+		{
+			i32 structSize = sizeof(InlineArray);
+			i32 dynamicArraySize = i32((sizeof(u64) + sizeof(TruthObject*)) * capacity);
+			InlineArray* arr = (InlineArray*)arena->alloc(structSize + dynamicArraySize);
+			arr->size = 0;
+			arr->capacity = u32(capacity);
+			arr->refs = 1;
+			arr->sealed = 0;
+			arr->hash = 0;
+			return arr;
+		}
+
+		static InlineArray* copy(Allocator* arena, const InlineArray* from, i32 capacity)
+		{
+			assert(u32(capacity) >= from->size);
+
+			InlineArray* arr = alloc(arena, capacity);
+			arr->size = from->size;
+			memcpy(arr->keys, from->keys, from->size * sizeof(u64));
+			memcpy(arr->values(), from->values(), from->size * sizeof(TruthObject*));
+			return arr;
+		}
+	};
+
+	static_assert(sizeof(InlineArray) == 24, "InlineArray size must be 24 bytes");
+
+	// Children are either nodes one level down or leaves, leafMask tells which.
+	// Empty slots are nullptr and read as empty leaves.
+	struct Node
+	{
+		u32 leafMask = 0;
+		u32 refs = 1;
+
+		// Sum of the entry hashes below, valid once sealed.
+		u32 sealed = 0;
+		u32 _pad = 0;
+		u64 hash = 0;
+
+		void* children[truth::NodeFanout]{};
+
+		bool isLeaf(u32 i) const { return (leafMask >> i) & 1; }
+		bool isNode(u32 i) const { return children[i] != nullptr && !isLeaf(i); }
+
+		Node* node(u32 i) const { return isLeaf(i) ? nullptr : (Node*)children[i]; }
+		InlineArray* leaf(u32 i) const { return isLeaf(i) ? (InlineArray*)children[i] : nullptr; }
+
+		void setNode(u32 i, Node* n)
+		{
+			children[i] = n;
+			leafMask &= ~(1u << i);
+		}
+
+		void setLeaf(u32 i, InlineArray* a)
+		{
+			children[i] = a;
+			leafMask |= (1u << i);
+		}
+	};
+
+	static void diff(
+		const TruthMap* base,
+		const TruthMap* compare,
+		Array<KeyEntry>& adds,
+		Array<KeyEntry>& edits,
+		Array<KeyEntry>& removes)
+	{
+		DiffCollector collector(adds, edits, removes);
+		diff(base, compare, collector);
+	}
+
+	// Streams what changed from base to compare into the visitor, see
+	// TruthDiffVisitor. Shared subtrees, sealed subtrees with equal hashes and
+	// key ranges the visitor rejects are never descended into, and sealed
+	// objects with equal hashes are no edit.
+	template<typename Visitor>
+	static void diff(const TruthMap* base, const TruthMap* compare, Visitor& visitor)
+	{
+		if (base != compare && base->m_root != compare->m_root)
+		{
+			diff(rootRef(base->m_root), rootRef(compare->m_root), 0, 0, visitor);
+		}
+	}
+
+	class Interner;
+
+	// Computes the hashes of every node, leaf and object the map does not yet
+	// share with a sealed snapshot, bottom up so it costs O(path copies). With
+	// an interner, subtrees equal to one it already holds are swapped for that
+	// one and the private copy is released. The map must not be written after.
+	static void seal(TruthMap* map, Interner* interner);
+
+	// Hash of every key and object in the map, only meaningful once sealed.
+	u64 contentHash() const { return m_root->hash; }
+
+	// Equal by content, which may hold for maps that share no nodes at all.
+	// Relies on 64 bit hashes so it is exact up to hash collisions.
+	static bool sameContent(const TruthMap* a, const TruthMap* b)
+	{
+		if (a == b || a->m_root == b->m_root)
+		{
+			return true;
+		}
+
+		return a->m_root->sealed && b->m_root->sealed && a->m_size == b->m_size && a->m_root->hash == b->m_root->hash;
+	}
+
+	static TruthMap* makeRoot(Allocator* allocator)
+	{
+		TruthMap* instance = create<TruthMap>(allocator, allocator);
+
+		instance->m_root = create<Node>(allocator);
+
+		return instance;
+	}
+
+	// Writable map sharing base's root until its first write. Path copies and
+	// clones made through it come from allocator.
+	static TruthMap* fork(const TruthMap* base, Allocator* allocator)
+	{
+		TruthMap* instance = create<TruthMap>(allocator, allocator);
+
+		instance->m_root = base->m_root;
+		instance->m_size = base->m_size;
+		atomicIncrement(&instance->m_root->refs);
+
+		return instance;
+	}
+
+	// Moves everything map allocated from arena into allocator so the arena can
+	// be freed wholesale. Shared nodes, leaves and objects stay where they are,
+	// moved ones keep their reference counts. Returns the map to use instead.
+	// Objects move by clone(allocator), which may share what they point to, so
+	// only objects holding no arena memory of their own may sit in the arena.
+	// Those are the clones edit() makes of committed objects.
+	static TruthMap* adopt(TruthMap* map, const ArenaAllocator* arena, Allocator* allocator)
+	{
+		if (!arena->owns(map))
+		{
+			return map;
+		}
+
+		TruthMap* instance = create<TruthMap>(allocator, allocator);
+
+		instance->m_root = adoptNode(map->m_root, arena, allocator);
+		instance->m_size = map->m_size;
+		instance->m_refs = map->m_refs;
+
+		return instance;
+	}
+
+	// Builds a map bottom up from entries sorted by key without duplicates.
+	// Every node and leaf is allocated once at its final size.
+	static TruthMap* buildFromSorted(Allocator* allocator, const KeyEntry* entries, u32 count)
+	{
+#if !defined(NDEBUG)
+		for (u32 i = 1; i < count; ++i)
+		{
+			assert(entries[i - 1] < entries[i] && "Entries must be sorted by key and unique");
+		}
+#endif
+
+		TruthMap* instance = create<TruthMap>(allocator, allocator);
+
+		for (u32 i = 0; i < count; ++i)
+		{
+			atomicIncrement(&entries[i].value->refs);
+		}
+
+		instance->m_root = buildNode(allocator, EntryRun{ entries }, count, 0);
+		instance->m_size = count;
+
+		return instance;
+	}
+
+	static TruthMap* lookupForWrite(
+		const TruthMap* base,
+		TruthMap* head,
+		truth::Key key,
+		TruthObject** outEntry)
+	{
+		InlineArray* array;
+		u32 slot;
+		TruthMap* update = getWritableEntryArray(base, head, key, false, &array, &slot);
+
+		TruthObject*& value = array->values()[slot];
+		if (value == nullptr)
+		{
+			value = base->find(key)->clone(update->m_allocator);
+			value->refs = 1;
+		}
+		*outEntry = value;
+
+		return update;
+	}
+
+	static TruthMap* writeValue(const TruthMap* base, TruthMap* head, truth::Key key, TruthObject* value)
+	{
+		InlineArray* array;
+		u32 slot;
+		TruthMap* update = getWritableEntryArray(base, head, key, false, &array, &slot);
+		assert(array->values()[slot] == nullptr);
+		array->values()[slot] = value;
+		atomicIncrement(&value->refs);
+
+		return update;
+	}
+
+	// Adds count new keys in one pass. Entries are sorted, then every touched
+	// node is path copied once and each touched leaf is merged into once.
+	static TruthMap* writeValues(const TruthMap* base, TruthMap* head, const truth::Key* keys, TruthObject* const* values, u32 count)
+	{
+		if (count == 0)
+		{
+			return head;
+		}
+
+		TruthMap* updated = writableRoot(base, head);
+		Allocator* allocator = head->m_allocator;
+
+		KeyEntry* sorted = (KeyEntry*)allocator->alloc(i32(2 * count * sizeof(KeyEntry)));
+		for (u32 i = 0; i < count; ++i)
+		{
+			sorted[i] = KeyEntry{ keys[i], values[i] };
+		}
+		truth::sortByKey(sorted, sorted + count, count);
+
+		mergeSorted(allocator, updated->m_root, base->m_root, sorted, count, 0);
+		updated->m_size += count;
+
+		allocator->freeSizeKnown(sorted, i32(2 * count * sizeof(KeyEntry)));
+
+		return updated;
+	}
+
+	static TruthMap* erase(
+		const TruthMap* base,
+		TruthMap* head,
+		truth::Key key)
+	{
+		InlineArray* array;
+		u32 slot;
+		TruthMap* update = getWritableEntryArray(base, head, key, true, &array, &slot);
+
+		// keep array in sorted order
+		releaseObject(head->m_allocator, array->values()[slot]);
+		array->remove(slot);
+		update->m_size -= 1;
+
+		return update;
+	}
+
+	const TruthObject* find(truth::Key key) const
+	{
+		const InlineArray* entries = getEntries(key);
+
+		if (entries)
+		{
+			u32 slot = entries->find(key);
+			if (slot != u32(-1))
+			{
+				return entries->values()[slot];
+			}
+		}
+
+		return nullptr;
+	}
+
+	u32 size() const { return m_size; }
+
+	// Calls fn(key, value) for every entry in key order.
+	template<typename Fn>
+	void forEach(Fn&& fn) const
+	{
+		forEach(m_root, fn);
+	}
+
+	// Null unless Truth maintains a type index for the snapshot.
+	const TypeIndex* types() const { return m_types; }
+
+	// Takes over the caller's reference, only before the map is published.
+	void setTypes(TypeIndex* index)
+	{
+		assert(m_types == nullptr);
+		m_types = index;
+	}
+
+	// Referenced key to the keys referring to it, null unless Truth maintains
+	// a reference index for the snapshot.
+	const TruthMap* referrers() const { return m_referrers; }
+
+	void setReferrers(TruthMap* referrers)
+	{
+		assert(m_referrers == nullptr);
+		m_referrers = referrers;
+	}
+
+	// Bytes of nodes and leaves reachable from to but not shared with from.
+	// Only walks subtrees whose pointers differ, so it costs O(changes).
+	static u64 bytesAdded(const TruthMap* from, const TruthMap* to)
+	{
+		if (from == to)
+		{
+			return 0;
+		}
+
+		return sizeof(TruthMap) + bytesAdded(from->m_root, to->m_root);
+	}
+
+	Node* root() const
+	{
+		return m_root;
+	}
+
+private:
+	static TruthMap* getWritableEntryArray(
+		const TruthMap* base,
+		TruthMap* head,
+		truth::Key key,
+		bool erasing,
+		InlineArray** outArray,
+		u32* outSlot)
+	{
+		TruthMap* updated = writableRoot(base, head);
+		Allocator* allocator = head->m_allocator;
+
+		Node* nodeUpdate = updated->m_root;
+		const Node* baseNode = base->m_root;
+
+		// Walk down copying every node still shared with base. Base may have a
+		// different shape when this transaction already split a leaf, in which
+		// case nothing below that point can be shared.
+		u32 level = 0;
+		u32 childSlot = truth::slotAt(key, level);
+		while (nodeUpdate->isNode(childSlot))
+		{
+			Node* childUpdate = nodeUpdate->node(childSlot);
+			const Node* baseChild = baseNode ? baseNode->node(childSlot) : nullptr;
+			if (childUpdate == baseChild)
+			{
+				childUpdate = copyNode(allocator, baseChild);
+				releaseNode(allocator, baseChild);
+				nodeUpdate->setNode(childSlot, childUpdate);
+			}
+
+			nodeUpdate = childUpdate;
+			baseNode = baseChild;
+			++level;
+			childSlot = truth::slotAt(key, level);
+		}
+
+		///
+		InlineArray* entriesUpdate = nodeUpdate->leaf(childSlot);
+		const InlineArray* baseEntries = baseNode ? baseNode->leaf(childSlot) : nullptr;
+
+		// if array didnt exist we just put yourself in
+		if (entriesUpdate == nullptr)
+		{
+			entriesUpdate = InlineArray::alloc(allocator, 1);
+			nodeUpdate->setLeaf(childSlot, entriesUpdate);
+			entriesUpdate->insert(0, key, nullptr);
+
+			*outSlot = 0;
+			*outArray = entriesUpdate;
+			++updated->m_size;
+
+			return updated;
+		}
+
+		u32 slotUpdate = entriesUpdate->find(key);
+
+		// it already exists in entriesUpdate
+		if (slotUpdate != u32(-1))
+		{
+			// need to aquire write access to entriesUpdate
+			if (entriesUpdate == baseEntries)
+			{
+				u32 newCapacity = baseEntries->size;
+				entriesUpdate = copyLeaf(allocator, baseEntries, newCapacity);
+				releaseLeaf(allocator, baseEntries);
+				nodeUpdate->setLeaf(childSlot, entriesUpdate);
+			}
+
+			// need to aquire ownership of KeyEntry if we are not removing it from the list.
+			// Looked up by key since the leaf holding it in base may sit at another level.
+			TruthObject*& value = entriesUpdate->values()[slotUpdate];
+			if (value == base->find(key) && !erasing)
+			{
+				releaseObject(allocator, value);
+				value = nullptr;
+			}
+			*outSlot = slotUpdate;
+			*outArray = entriesUpdate;
+
+			return updated;
+		}
+		// it does not exist in entriesUpdate
+		else if (slotUpdate == u32(-1))
+		{
+			// need to aquire write access to entriesUpdate
+			if (entriesUpdate == baseEntries)
+			{
+				u32 newCapacity = baseEntries->size + 1;
+				entriesUpdate = copyLeaf(allocator, baseEntries, newCapacity);
+				releaseLeaf(allocator, baseEntries);
+				nodeUpdate->setLeaf(childSlot, entriesUpdate);
+			}
+			else if (entriesUpdate->size == entriesUpdate->capacity)
+			{
+				// entriesUpdate is not committed yet but we need to make space for our element
+				// must copy to new array and free. Grow geometrically so repeated adds to
+				// the same leaf in one transaction stay amortized O(1) copies each.
+
+				InlineArray* temp = InlineArray::copy(allocator, entriesUpdate, grownCapacity(entriesUpdate->capacity));
+				allocator->free(entriesUpdate);
+				entriesUpdate = temp;
+				nodeUpdate->setLeaf(childSlot, entriesUpdate);
+			}
+
+			++updated->m_size;
+
+			u32 desiredSlot = truth::lowerBound(entriesUpdate->keys, entriesUpdate->size, key.asU64);
+			entriesUpdate->insert(desiredSlot, key, nullptr);
+
+			*outArray = entriesUpdate;
+			*outSlot = desiredSlot;
+
+			// leaf is private to this transaction, push it down a level once it gets too big
+			if (entriesUpdate->size > truth::LeafSplitSize && level + 1 < truth::MaxDepth)
+			{
+				Node* split = buildNode(allocator, SplitRun{ entriesUpdate->keys, entriesUpdate->values() }, entriesUpdate->size, level + 1);
+				allocator->free(entriesUpdate);
+				nodeUpdate->setNode(childSlot, split);
+
+				locate(split, level + 1, key, outArray, outSlot);
+			}
+		}
+
+		return updated;
+	}
+
+	static TruthMap* writableRoot(const TruthMap* base, TruthMap* head)
+	{
+		TruthMap* updated = head;
+		Allocator* allocator = head->m_allocator;
+
+		if (updated == base)
+		{
+			updated = create<TruthMap>(allocator, allocator);
+			updated->m_size = head->size();
+			updated->m_root = copyNode(allocator, base->m_root);
+		}
+		else if (updated->m_root == base->m_root)
+		{
+			// a fork holds a reference to the base root until its first write
+			updated->m_root = copyNode(allocator, base->m_root);
+			releaseNode(allocator, base->m_root);
+		}
+
+		return updated;
+	}
+
+	static u32 grownCapacity(u32 capacity)
+	{
+		// a leaf past LeafSplitSize gets split right away, no point growing beyond that
+		u32 grown = capacity < 4 ? 4 : capacity * 2;
+		return grown > truth::LeafSplitSize + 1 ? truth::LeafSplitSize + 1 : grown;
+	}
+
+	// Merges sorted new entries into the private node at level. Children still
+	// shared with base are copied once before descending into them.
+	static void mergeSorted(Allocator* allocator, Node* nodeUpdate, const Node* baseNode, const KeyEntry* entries, u32 count, u32 level)
+	{
+		u32 begin = 0;
+		while (begin < count)
+		{
+			u32 childSlot = truth::slotAt(entries[begin].key, level);
+			u32 end = begin + 1;
+			while (end < count && truth::slotAt(entries[end].key, level) == childSlot)
+			{
+				++end;
+			}
+
+			const KeyEntry* run = entries + begin;
+			u32 runSize = end - begin;
+			begin = end;
+
+			if (nodeUpdate->isNode(childSlot))
+			{
+				Node* childUpdate = nodeUpdate->node(childSlot);
+				const Node* baseChild = baseNode ? baseNode->node(childSlot) : nullptr;
+				if (childUpdate == baseChild)
+				{
+					childUpdate = copyNode(allocator, baseChild);
+					releaseNode(allocator, baseChild);
+					nodeUpdate->setNode(childSlot, childUpdate);
+				}
+
+				mergeSorted(allocator, childUpdate, baseChild, run, runSize, level + 1);
+				continue;
+			}
+
+			InlineArray* entriesUpdate = nodeUpdate->leaf(childSlot);
+			const InlineArray* baseEntries = baseNode ? baseNode->leaf(childSlot) : nullptr;
+			u32 oldSize = entriesUpdate ? entriesUpdate->size : 0;
+			u32 newSize = oldSize + runSize;
+
+			// shared or full leaves are merged into a fresh one, private leaves with room in place
+			InlineArray* merged = entriesUpdate;
+			if (entriesUpdate == nullptr || entriesUpdate == baseEntries || entriesUpdate->capacity < newSize)
+			{
+				merged = InlineArray::alloc(allocator, newSize);
+			}
+
+			if (entriesUpdate != nullptr && entriesUpdate == baseEntries)
+			{
+				retainValues(entriesUpdate);
+			}
+
+			// merge from the back so doing it in place never overwrites unread entries
+			TruthObject** mergedValues = merged->values();
+			i32 i = i32(oldSize) - 1;
+			i32 j = i32(runSize) - 1;
+			for (i32 k = i32(newSize) - 1; k >= 0; --k)
+			{
+				if (j < 0 || (i >= 0 && entriesUpdate->keys[i] > run[j].key.asU64))
+				{
+					mergedValues[k] = entriesUpdate->values()[i];
+					merged->keys[k] = entriesUpdate->keys[i];
+					--i;
+				}
+				else
+				{
+					assert((i < 0 || entriesUpdate->keys[i] != run[j].key.asU64) && "Cannot add same key twice");
+					mergedValues[k] = run[j].value;
+					merged->keys[k] = run[j].key.asU64;
+					atomicIncrement(&run[j].value->refs);
+					--j;
+				}
+			}
+			merged->size = newSize;
+
+			if (merged != entriesUpdate && entriesUpdate != nullptr)
+			{
+				if (entriesUpdate == baseEntries)
+				{
+					releaseLeaf(allocator, baseEntries);
+				}
+				else
+				{
+					allocator->free(entriesUpdate);
+				}
+			}
+
+			if (newSize > truth::LeafSplitSize && level + 1 < truth::MaxDepth)
+			{
+				nodeUpdate->setNode(childSlot, buildNode(allocator, SplitRun{ merged->keys, merged->values() }, newSize, level + 1));
+				allocator->free(merged);
+			}
+			else
+			{
+				nodeUpdate->setLeaf(childSlot, merged);
+			}
+		}
+	}
+
+	static Node* copyNode(Allocator* allocator, const Node* from)
+	{
+		Node* node = create<Node>(allocator);
+		memcpy(node, from, sizeof(Node));
+		node->refs = 1;
+		node->sealed = 0;
+
+		for (u32 i = 0; i < truth::NodeFanout; ++i)
+		{
+			if (node->isNode(i))
+			{
+				atomicIncrement(&node->node(i)->refs);
+			}
+			else if (InlineArray* leaf = node->leaf(i))
+			{
+				atomicIncrement(&leaf->refs);
+			}
+		}
+
+		return node;
+	}
+
+	// Copy of a leaf still shared with other snapshots, its values gain a holder.
+	static InlineArray* copyLeaf(Allocator* allocator, const InlineArray* from, u32 capacity)
+	{
+		InlineArray* leaf = InlineArray::copy(allocator, from, capacity);
+		retainValues(leaf);
+		return leaf;
+	}
+
+	static void retainValues(const InlineArray* leaf)
+	{
+		TruthObject* const* values = leaf->values();
+		for (u32 i = 0; i < leaf->size; ++i)
+		{
+			if (values[i])
+			{
+				atomicIncrement(&values[i]->refs);
+			}
+		}
+	}
+
+	static void releaseNode(Allocator* allocator, const Node* node)
+	{
+		Node* mutableNode = (Node*)node;
+		if (atomicDecrement(&mutableNode->refs) != 0)
+		{
+			return;
+		}
+
+		for (u32 i = 0; i < truth::NodeFanout; ++i)
+		{
+			if (node->isNode(i))
+			{
+				releaseNode(allocator, node->node(i));
+			}
+			else if (InlineArray* leaf = node->leaf(i))
+			{
+				releaseLeaf(allocator, leaf);
+			}
+		}
+
+		allocator->free(mutableNode);
+	}
+
+	static void releaseLeaf(Allocator* allocator, const InlineArray* leaf)
+	{
+		InlineArray* mutableLeaf = (InlineArray*)leaf;
+		if (atomicDecrement(&mutableLeaf->refs) != 0)
+		{
+			return;
+		}
+
+		TruthObject* const* values = leaf->values();
+		for (u32 i = 0; i < leaf->size; ++i)
+		{
+			releaseObject(allocator, values[i]);
+		}
+
+		allocator->free(mutableLeaf);
+	}
+
+	static void releaseObject(Allocator* allocator, TruthObject* object)
+	{
+		if (object && atomicDecrement(&object->refs) == 0)
+		{
+			object->~TruthObject();
+			allocator->free(object);
+		}
+	}
+
+	static Node* adoptNode(Node* node, const ArenaAllocator* arena, Allocator* allocator)
+	{
+		if (!arena->owns(node))
+		{
+			return node;
+		}
+
+		Node* adopted = create<Node>(allocator);
+		memcpy(adopted, node, sizeof(Node));
+
+		for (u32 i = 0; i < truth::NodeFanout; ++i)
+		{
+			if (adopted->isNode(i))
+			{
+				adopted->setNode(i, adoptNode(adopted->node(i), arena, allocator));
+			}
+			else if (InlineArray* leaf = adopted->leaf(i))
+			{
+				adopted->setLeaf(i, adoptLeaf(leaf, arena, allocator));
+			}
+		}
+
+		return adopted;
+	}
+
+	static InlineArray* adoptLeaf(InlineArray* leaf, const ArenaAllocator* arena, Allocator* allocator)
+	{
+		if (!arena->owns(leaf))
+		{
+			return leaf;
+		}
+
+		// trims the slack left by growing the leaf during the transaction
+		InlineArray* adopted = InlineArray::copy(allocator, leaf, i32(leaf->size));
+		adopted->refs = leaf->refs;
+
+		TruthObject** values = adopted->values();
+		for (u32 i = 0; i < adopted->size; ++i)
+		{
+			TruthObject* object = values[i];
+			if (arena->owns(object))
+			{
+				values[i] = object->clone(allocator);
+				values[i]->refs = object->refs;
+				object->~TruthObject();
+			}
+		}
+
+		return adopted;
+	}
+
+	// Sorted input to buildNode, either a leaf being split or a caller's KeyEntry stream.
+	struct SplitRun
+	{
+		const u64* keys;
+		TruthObject* const* values;
+
+		u64 key(u32 i) const { return keys[i]; }
+		SplitRun from(u32 i) const { return SplitRun{ keys + i, values + i }; }
+
+		void copyTo(InlineArray* leaf, u32 count) const
+		{
+			memcpy(leaf->keys, keys, count * sizeof(u64));
+			memcpy(leaf->values(), values, count * sizeof(TruthObject*));
+		}
+	};
+
+	struct EntryRun
+	{
+		const KeyEntry* entries;
+
+		u64 key(u32 i) const { return entries[i].key.asU64; }
+		EntryRun from(u32 i) const { return EntryRun{ entries + i }; }
+
+		void copyTo(InlineArray* leaf, u32 count) const
+		{
+			TruthObject** values = leaf->values();
+			for (u32 i = 0; i < count; ++i)
+			{
+				leaf->keys[i] = entries[i].key.asU64;
+				values[i] = entries[i].value;
+			}
+		}
+	};
+
+	// Lays out sorted entries below a new node at level. Entries sharing a slot
+	// are contiguous since the slot is taken from the higher key bits first.
+	template<typename Run>
+	static Node* buildNode(Allocator* allocator, Run run, u32 count, u32 level)
+	{
+		Node* node = create<Node>(allocator);
+
+		u32 begin = 0;
+		while (begin < count)
+		{
+			u32 slot = truth::slotAt(run.key(begin), level);
+			u32 end = begin + 1;
+			while (end < count && truth::slotAt(run.key(end), level) == slot)
+			{
+				++end;
+			}
 
-		Block* blockUpdate = bigBlockUpdate->blocks[key.Block];
-		const Block* baseBlock = baseBigBlock->blocks[key.Block];
-		if (blockUpdate == baseBlock)
-		{
-			blockUpdate = create<Block>(allocator);
-			memcpy(blockUpdate, baseBlock, sizeof(Block));
-			bigBlockUpdate->blocks[key.Block] = blockUpdate;
+			u32 runSize = end - begin;
+			if (runSize > truth::LeafSplitSize && level + 1 < truth::MaxDepth)
+			{
+				node->setNode(slot, buildNode(allocator, run.from(begin), runSize, level + 1));
+			}
+			else
+			{
+				InlineArray* leaf = InlineArray::alloc(allocator, runSize);
+				leaf->size = runSize;
+				run.from(begin).copyTo(leaf, runSize);
+				node->setLeaf(slot, leaf);
+			}
+
+			begin = end;
 		}
 
-		///
-		InlineArray* entriesUpdate = blockUpdate->entries[key.Entry];
-		const InlineArray* baseEntries = baseBlock->entries[key.Entry];
+		return node;
+	}
 
-		// if array didnt exist we just put yourself in
-		if (entriesUpdate == nullptr)
+	static void locate(Node* node, u32 level, truth::Key key, InlineArray** outArray, u32* outSlot)
+	{
+		u32 childSlot = truth::slotAt(key, level);
+		while (node->isNode(childSlot))
 		{
-			entriesUpdate = InlineArray::alloc(allocator, 1);
-			blockUpdate->entries[key.Entry] = entriesUpdate;
+			node = node->node(childSlot);
+			++level;
+			childSlot = truth::slotAt(key, level);
+		}
 
-			KeyEntry toInsert{};
-			toInsert.key = key;
+		InlineArray* entries = node->leaf(childSlot);
+		*outArray = entries;
+		*outSlot = entries->find(key);
+	}
 
-			entriesUpdate->data[0] = toInsert;
-			entriesUpdate->size = 1;
+	const InlineArray* getEntries(truth::Key key) const
+	{
+		const Node* node = m_root;
+		u32 level = 0;
+		u32 childSlot = truth::slotAt(key, level);
+		while (node->isNode(childSlot))
+		{
+			node = node->node(childSlot);
+			++level;
+			childSlot = truth::slotAt(key, level);
+		}
 
-			*outSlot = 0;
-			*outArray = entriesUpdate;
-			++updated->m_size;
+		return node->leaf(childSlot);
+	}
 
-			return updated;
+	static u64 bytesAdded(const Node* from, const Node* to)
+	{
+		if (from == to)
+		{
+			return 0;
 		}
 
-		u32 slotUpdate = u32(-1);
-		u32 baseSlot = u32(-1);
-
-		// todo binary serach
-		if (baseEntries)
+		u64 bytes = sizeof(Node);
+		for (u32 i = 0; i < truth::NodeFanout; ++i)
 		{
-			for (u32 i = 0; i < baseEntries->size; ++i)
+			if (to->isNode(i))
+			{
+				bytes += bytesAdded(from ? from->node(i) : nullptr, to->node(i));
+			}
+			else if (const InlineArray* leaf = to->leaf(i))
 			{
-				if (baseEntries->data[i].key.Index == key.Index)
+				if (!from || from->leaf(i) != leaf)
 				{
-					baseSlot = i;
-					break;
+					bytes += sizeof(InlineArray) + leaf->capacity * (sizeof(u64) + sizeof(TruthObject*));
 				}
 			}
 		}
 
-		for (u32 i = 0; i < entriesUpdate->size; ++i)
+		return bytes;
+	}
+
+	// Either a node or a run of sorted entries covering the same key range,
+	// lets diff compare subtrees where one side has split and the other not.
+	// Whole sealed nodes and leaves carry their hash, partial runs do not.
+	struct ChildRef
+	{
+		const Node* node = nullptr;
+		const u64* keys = nullptr;
+		TruthObject* const* values = nullptr;
+		u32 count = 0;
+		bool sealed = false;
+		u64 hash = 0;
+
+		// values come from a sealed leaf and carry their contentHash, also
+		// true for a part of one where hash does not apply
+		bool hashedValues = false;
+	};
+
+	static ChildRef rootRef(const Node* root)
+	{
+		ChildRef ref;
+		ref.node = root;
+		ref.sealed = root->sealed != 0;
+		ref.hash = root->hash;
+		return ref;
+	}
+
+	static ChildRef childRef(const Node* node, u32 i)
+	{
+		ChildRef ref;
+		if (node->isNode(i))
+		{
+			ref = rootRef(node->node(i));
+		}
+		else if (const InlineArray* leaf = node->leaf(i))
+		{
+			ref.keys = leaf->keys;
+			ref.values = leaf->values();
+			ref.count = leaf->size;
+			ref.sealed = leaf->sealed != 0;
+			ref.hash = leaf->hash;
+			ref.hashedValues = ref.sealed;
+		}
+		return ref;
+	}
+
+	static ChildRef childRef(ChildRef run, u32 i, u32 level)
+	{
+		u32 begin = 0;
+		while (begin < run.count && truth::slotAt(run.keys[begin], level) < i)
 		{
-			if (entriesUpdate->data[i].key.Index == key.Index)
-			{
-				slotUpdate = i;
-				break;
-			}
+			++begin;
 		}
 
-		// if we dont exist in the array. allocate space for us
-		const KeyEntry baseEntry = baseSlot == u32(-1) ? KeyEntry{} : baseEntries->data[baseSlot];
+		u32 end = begin;
+		while (end < run.count && truth::slotAt(run.keys[end], level) == i)
+		{
+			++end;
+		}
 
-		// it already exists in entriesUpdate
-		if (slotUpdate != u32(-1))
+		ChildRef ref;
+		ref.keys = run.keys + begin;
+		ref.values = run.values + begin;
+		ref.count = end - begin;
+		ref.hashedValues = run.hashedValues;
+		return ref;
+	}
+
+	template<typename Visitor>
+	static void diff(ChildRef base, ChildRef compare, u32 level, u64 prefix, Visitor& visitor)
+	{
+		// equal content reached through different paths, e.g. an edit and its revert
+		if (base.sealed && compare.sealed && base.hash == compare.hash)
 		{
-			// need to aquire write access to entriesUpdate
-			if (entriesUpdate == baseEntries)
+			return;
+		}
+
+		if (base.node || compare.node)
+		{
+			if (base.node == compare.node)
 			{
-				u32 newCapacity = baseEntries->size;
-				entriesUpdate = InlineArray::alloc(allocator, newCapacity);
-				entriesUpdate->size = baseEntries->size;
-				memcpy(entriesUpdate->data, baseEntries->data, baseEntries->size * sizeof(KeyEntry));
-				blockUpdate->entries[key.Entry] = entriesUpdate;
+				return;
 			}
 
-			// need to aquire ownership of KeyEntry if we are not removing it from the list
-			if (entriesUpdate->data[slotUpdate] == baseEntry && !erasing)
+			// bits below the ones this level indexes with are free within a child
+			u32 shift = 64 - (level + 1) * truth::NodeBits;
+			u64 span = (u64(1) << shift) - 1;
+
+			for (u32 i = 0; i < truth::NodeFanout; ++i)
 			{
-				entriesUpdate->data[slotUpdate].value = nullptr;
-				entriesUpdate->data[slotUpdate].key = key;
+				u64 first = prefix | (u64(i) << shift);
+				if (!visitor.visitRange(first, first | span))
+				{
+					continue;
+				}
+
+				ChildRef baseChild = base.node ? childRef(base.node, i) : childRef(base, i, level);
+				ChildRef compareChild = compare.node ? childRef(compare.node, i) : childRef(compare, i, level);
+				diff(baseChild, compareChild, level + 1, first, visitor);
 			}
-			*outSlot = slotUpdate;
-			*outArray = entriesUpdate;
+			return;
+		}
 
-			return updated;
+		if (base.keys == compare.keys && base.count == compare.count)
+		{
+			return;
 		}
-		// it does not exist in entriesUpdate
-		else if (slotUpdate == u32(-1))
+
+		u32 baseIterator = 0;
+		u32 compareIterator = 0;
+
+		while (baseIterator != base.count && compareIterator != compare.count)
 		{
-			// need to aquire write access to entriesUpdate
-			if (entriesUpdate == baseEntries)
+			u64 baseKey = base.keys[baseIterator];
+			u64 compareKey = compare.keys[compareIterator];
+
+			if (baseKey < compareKey)
 			{
-				u32 baseSize = baseEntries->size;
-				u32 newCapacity = baseSize + 1;
-				entriesUpdate = InlineArray::alloc(allocator, newCapacity);
-				entriesUpdate->size = baseSize;
-				memcpy(entriesUpdate->data, baseEntries->data, baseSize * sizeof(KeyEntry));
-				blockUpdate->entries[key.Entry] = entriesUpdate;
+				visitor.onRemove(truth::Key{ baseKey }, base.values[baseIterator]);
+				++baseIterator;
 			}
-			else
+			else if (baseKey > compareKey)
 			{
-				// entriesUpdate is not committed yet but we need to make space for our element
-				// must copy to new array and free
-
-				InlineArray* temp = InlineArray::alloc(allocator, entriesUpdate->size + 1);
-				temp->size = entriesUpdate->size;
-				memcpy(temp->data, entriesUpdate->data, entriesUpdate->size * sizeof(KeyEntry));
-				allocator->free(entriesUpdate);
-				entriesUpdate = temp;
-				blockUpdate->entries[key.Entry] = entriesUpdate;
+				visitor.onAdd(truth::Key{ compareKey }, compare.values[compareIterator]);
+				++compareIterator;
 			}
+			else  // baseKey == compareKey
+			{
+				TruthObject* before = base.values[baseIterator];
+				TruthObject* after = compare.values[compareIterator];
 
-			KeyEntry toInsert{};
-			toInsert.key = key;
+				// sealed objects carry their hash, equal ones are skipped like equal subtrees
+				bool sameContent = base.hashedValues && compare.hashedValues && before->hash == after->hash;
+				if (before != after && !sameContent)
+				{
+					visitor.onEdit(truth::Key{ compareKey }, before, after);
+				}
+				++compareIterator;
+				++baseIterator;
+			}
+		}
 
-			++updated->m_size;
+		while (baseIterator != base.count)
+		{
+			visitor.onRemove(truth::Key{ base.keys[baseIterator] }, base.values[baseIterator]);
+			++baseIterator;
+		}
 
-			u32 desiredSlot = lower_bound(entriesUpdate->begin(), entriesUpdate->end(), toInsert);
+		while (compareIterator != compare.count)
+		{
+			visitor.onAdd(truth::Key{ compare.keys[compareIterator] }, compare.values[compareIterator]);
+			++compareIterator;
+		}
+	}
 
-			if (desiredSlot == entriesUpdate->size)
+	template<typename Fn>
+	static void forEach(const Node* node, Fn& fn)
+	{
+		for (u32 i = 0; i < truth::NodeFanout; ++i)
+		{
+			if (node->isNode(i))
 			{
-				entriesUpdate->data[desiredSlot] = toInsert;
+				forEach(node->node(i), fn);
 			}
-			else
+			else if (const InlineArray* leaf = node->leaf(i))
 			{
-				u32 i = entriesUpdate->size;
-				while (i > desiredSlot)
+				TruthObject* const* values = leaf->values();
+				for (u32 j = 0; j < leaf->size; ++j)
 				{
-					entriesUpdate->data[i] = entriesUpdate->data[i - 1];
-					--i;
+					fn(truth::Key{ leaf->keys[j] }, values[j]);
 				}
-				entriesUpdate->data[desiredSlot] = toInsert;
 			}
+		}
+	}
 
-			entriesUpdate->size += 1;
-			*outArray = entriesUpdate;
-			*outSlot = desiredSlot;
+	static Node* sealNode(Node* node, Interner* interner);
+	static InlineArray* sealLeaf(InlineArray* leaf, Interner* interner);
+
+	static u64 objectHash(TruthObject* object)
+	{
+		if (object->hash == 0)
+		{
+			u64 hash = object->contentHash();
+			object->hash = hash != 0 ? hash : 1;
 		}
 
-		return updated;
+		return object->hash;
 	}
 
-	const InlineArray* getEntries(truth::Key key) const
+	Node* m_root = nullptr;
+	TypeIndex* m_types = nullptr;
+	TruthMap* m_referrers = nullptr;
+	u32 m_size = 0;
+	u32 m_refs = 1;
+	Allocator* m_allocator;
+};
+
+// Table of sealed subtrees by hash, so equal content committed at different
+// times, e.g. by undoing and redoing the same edit or by two branches that
+// converge, is stored once. The table holds a reference to every subtree in
+// it, sweep() hands back the ones no snapshot uses any more. Not thread
+// safe, callers serialize seal() and sweep() on it.
+class TruthMap::Interner
+{
+public:
+	explicit Interner(Allocator* allocator)
+		: m_allocator(allocator)
+		, m_table(allocator)
+	{}
+
+	~Interner()
 	{
-		Block& block = *m_root->blocks[key.Block];
-		return block.entries[key.Entry];
+		clear();
 	}
 
-	static void diff(InlineArray* from, InlineArray* to, Array<KeyEntry>& outEntries)
+	Interner(const Interner&) = delete;
+	Interner& operator=(const Interner&) = delete;
+
+	// Returns the held subtree equal to the given sealed one, releasing the
+	// given one, or starts holding it when there is none.
+	Node* intern(Node* node)
 	{
-		if (to == nullptr)
+		if (Interned* held = m_table.find(node->hash))
 		{
-			for (KeyEntry e : *from)
+			Node* existing = (Node*)held->subtree;
+			if (!held->isLeaf && existing->leafMask == node->leafMask && memcmp(existing->children, node->children, sizeof(node->children)) == 0)
 			{
-				outEntries.push_back(e);
+				atomicIncrement(&existing->refs);
+				releaseNode(m_allocator, node);
+				return existing;
 			}
-		}
 
-		KeyEntry* old_it = from->begin();
-		KeyEntry* old_end = from->end();
+			// a hash collision, the first one keeps the slot
+			return node;
+		}
 
-		KeyEntry* new_it = to->begin();
-		KeyEntry* new_end = to->end();
+		atomicIncrement(&node->refs);
+		m_table.add(node->hash, Interned{ node, false });
+		return node;
+	}
 
-		while (old_it != old_end && new_it != new_end)
+	InlineArray* intern(InlineArray* leaf)
+	{
+		if (Interned* held = m_table.find(leaf->hash))
 		{
-			KeyEntry oldData = *old_it;
-			KeyEntry newData = *new_it;
-
-			if (oldData.key.Index < newData.key.Index)
+			InlineArray* existing = (InlineArray*)held->subtree;
+			if (held->isLeaf && sameEntries(existing, leaf))
 			{
-				outEntries.push_back(oldData);
-				++old_it;
+				atomicIncrement(&existing->refs);
+				releaseLeaf(m_allocator, leaf);
+				return existing;
 			}
-			else if (oldData.key.Index > newData.key.Index)
+
+			return leaf;
+		}
+
+		atomicIncrement(&leaf->refs);
+		m_table.add(leaf->hash, Interned{ leaf, true });
+		return leaf;
+	}
+
+	// Looks at up to budget entries, continuing where the last call stopped,
+	// and releases those only the table still refers to. A released node
+	// makes its children collectable on a later pass.
+	void sweep(i32 budget)
+	{
+		for (i32 visited = 0; visited < budget && m_table.size() > 0; ++visited)
+		{
+			if (m_cursor >= m_table.size())
 			{
-				++new_it;
+				m_cursor = 0;
 			}
-			else
+
+			auto& entry = m_table.data()[m_cursor];
+			Interned held = entry.value;
+			u32 refs = held.isLeaf ? ((InlineArray*)held.subtree)->refs : ((Node*)held.subtree)->refs;
+			if (refs != 1)
 			{
-				if (oldData.value != newData.value)
-				{
-					outEntries.push_back(oldData);
-				}
-				++new_it;
-				++old_it;
+				++m_cursor;
+				continue;
 			}
+
+			// erase moves the last entry into the cursor slot, so the cursor stays
+			m_table.erase(entry.key);
+			release(held);
 		}
+	}
 
-		while (old_it != old_end)
+	void clear()
+	{
+		while (m_table.size() > 0)
 		{
-			outEntries.push_back(*old_it);
-			++old_it;
+			auto& entry = m_table.data()[m_table.size() - 1];
+			Interned held = entry.value;
+			m_table.erase(entry.key);
+			release(held);
 		}
+
+		m_cursor = 0;
 	}
 
-	static void diff(
-		Block* from,
-		Block* to,
-		Array<InlineArray*>& outEntryArrays,
-		Array<KeyEntry>& outEntries)
+	i32 size() const { return m_table.size(); }
+
+private:
+	struct Interned
 	{
-		if (from != to)
+		void* subtree;
+		bool isLeaf;
+	};
+
+	static bool sameEntries(const InlineArray* a, const InlineArray* b)
+	{
+		if (a->size != b->size || memcmp(a->keys, b->keys, a->size * sizeof(u64)) != 0)
 		{
-			InlineArray** arrFrom = from->entries;
-			InlineArray** arrTo = to->entries;
+			return false;
+		}
 
-			for (u32 i = 0; i < truth::NumEntries; ++i)
+		TruthObject* const* aValues = a->values();
+		TruthObject* const* bValues = b->values();
+		for (u32 i = 0; i < a->size; ++i)
+		{
+			if (aValues[i] != bValues[i] && aValues[i]->hash != bValues[i]->hash)
 			{
-				if (arrFrom[i] != arrTo[i])
-				{
-					if (arrFrom[i] != nullptr)
-					{
-						diff(arrFrom[i], arrTo[i], outEntries);
-						outEntryArrays.push_back(arrFrom[i]);
-					}
-				}
+				return false;
 			}
 		}
+
+		return true;
+	}
+
+	void release(Interned held)
+	{
+		if (held.isLeaf)
+		{
+			releaseLeaf(m_allocator, (InlineArray*)held.subtree);
+		}
+		else
+		{
+			releaseNode(m_allocator, (Node*)held.subtree);
+		}
 	}
 
-	BigBlock* m_root = nullptr;
-	u32 m_size = 0;
 	Allocator* m_allocator;
+	// keyed by content hash, already random
+	HashMap<Interned, HashIdentity> m_table;
+	i32 m_cursor = 0;
+};
+
+// Walks a snapshot in key order, optionally limited to keys in [first, last).
+// Only reads, so any number of cursors can run over the same snapshot from
+// any thread as long as the snapshot is kept alive, e.g. by a ReadScope or
+// Truth::retain. Landing on a leaf prefetches the one after it, so its keys
+// and values are on the way while the current leaf is processed.
+class TruthCursor
+{
+public:
+	explicit TruthCursor(const TruthMap* map)
+		: m_root(map->root())
+	{
+		seek(truth::Key{ 0 });
+	}
+
+	TruthCursor(const TruthMap* map, truth::Key first, truth::Key last)
+		: m_root(map->root())
+		, m_last(last.asU64)
+		, m_bounded(true)
+	{
+		seek(first);
+	}
+
+	// Moves to the first entry with a key at or after key.
+	void seek(truth::Key key)
+	{
+		const TruthMap::Node* node = m_root;
+		m_depth = 0;
+
+		for (u32 level = 0;; ++level)
+		{
+			u32 slot = truth::slotAt(key, level);
+			m_stack[m_depth++] = Frame{ node, slot };
+
+			if (!node->isNode(slot))
+			{
+				const TruthMap::InlineArray* leaf = node->leaf(slot);
+				m_index = leaf ? truth::lowerBound(leaf->keys, leaf->size, key.asU64) : 0;
+				break;
+			}
+
+			node = node->node(slot);
+		}
+
+		settle();
+	}
+
+	bool valid() const { return m_leaf != nullptr; }
+
+	truth::Key key() const { return truth::Key{ m_leaf->keys[m_index] }; }
+	const TruthObject* value() const { return m_leaf->values()[m_index]; }
+
+	void next()
+	{
+		if (++m_index == m_leaf->size)
+		{
+			++m_stack[m_depth - 1].slot;
+			m_index = 0;
+			settle();
+		}
+		else
+		{
+			checkBounds();
+		}
+	}
 
-	struct EntryComparer
+private:
+	struct Frame
 	{
-		bool operator()(const KeyEntry* lhs, const KeyEntry* rhs) const { return lhs->key.Index < rhs->key.Index; }
+		const TruthMap::Node* node;
+		u32 slot;
 	};
-};
 
-inline void diff(const TruthMap* base, const TruthMap* compare, 
-Array<KeyEntry>& adds,
-Array<KeyEntry>& edits,
-Array<KeyEntry>& removes)
-{
-	if (base != compare)
+	// Moves forward from the current position to the first existing entry.
+	void settle()
 	{
-		auto* baseBig = base->root();
-		auto* compareBig = compare->root();
-		if (baseBig != compareBig)
+		while (m_depth > 0)
 		{
-			for (u32 iBlock = 0; iBlock < truth::NumBlocks; ++iBlock)
+			Frame& frame = m_stack[m_depth - 1];
+			if (frame.slot == truth::NodeFanout)
+			{
+				--m_depth;
+				if (m_depth > 0)
+				{
+					++m_stack[m_depth - 1].slot;
+				}
+				continue;
+			}
+
+			if (frame.node->isNode(frame.slot))
+			{
+				m_stack[m_depth++] = Frame{ frame.node->node(frame.slot), 0 };
+				continue;
+			}
+
+			const TruthMap::InlineArray* leaf = frame.node->leaf(frame.slot);
+			if (leaf && m_index < leaf->size)
 			{
-				auto* baseBlock = baseBig->blocks[iBlock];
-				auto* compareBlock = compareBig->blocks[iBlock];
+				m_leaf = leaf;
+				prefetchNext();
+				checkBounds();
+				return;
+			}
+
+			++frame.slot;
+			m_index = 0;
+		}
+
+		m_leaf = nullptr;
+	}
+
+	void checkBounds()
+	{
+		if (m_bounded && m_leaf->keys[m_index] >= m_last)
+		{
+			m_leaf = nullptr;
+		}
+	}
 
-				if (baseBlock == compareBlock)
+	// The closest non-empty slot after the current leaf, on whatever level it is.
+	void prefetchNext() const
+	{
+		for (u32 depth = m_depth; depth > 0; --depth)
+		{
+			const Frame& frame = m_stack[depth - 1];
+			for (u32 slot = frame.slot + 1; slot < truth::NodeFanout; ++slot)
+			{
+				if (frame.node->isNode(slot))
 				{
-					continue;
+					prefetch(frame.node->node(slot));
+					return;
 				}
 
-				for (u32 iEntry = 0; iEntry < truth::NumEntries; ++iEntry)
+				if (const TruthMap::InlineArray* leaf = frame.node->leaf(slot))
 				{
-					auto* baseEntries = baseBig->blocks[iBlock]->entries[iEntry];
-					auto* compareEntries = compareBig->blocks[iBlock]->entries[iEntry];
-
-					// Not in BASE, only in COMPARE
-					if (!baseEntries && compareEntries)
-					{
-						for (KeyEntry entry : *compareEntries)
-						{
-							adds.push_back(entry);
-						}
-					}
-
-					// Only in BASE, not in COMPARE
-					else if (baseEntries && !compareEntries)
-					{
-						for (KeyEntry entry : *baseEntries)
-						{
-							removes.push_back(entry);
-						}
-					}
-
-					// Both entries exist. Compare Element wise
-					else if (baseEntries && compareEntries)
-					{
-						KeyEntry* baseIterator = baseEntries->begin();
-						KeyEntry* baseEnd = baseEntries->end();
-
-						KeyEntry* compareIterator = compareEntries->begin();
-						KeyEntry* compareEnd = compareEntries->end();
-
-						while (baseIterator != baseEnd && compareIterator != compareEnd)
-						{
-							KeyEntry baseData = *baseIterator;
-							KeyEntry compareData = *compareIterator;
-
-							if (baseData.key.Index < compareData.key.Index)
-							{
-								removes.push_back(baseData);
-								++baseIterator;
-							}
-							else if (baseData.key.Index > compareData.key.Index)
-							{
-								adds.push_back(compareData);
-								++compareIterator;
-							}
-							else  // baseKey == compareKey
-							{
-								if (baseData.value != compareData.value)
-								{
-									edits.push_back(compareData);
-								}
-								++compareIterator;
-								++baseIterator;
-							}
-						}
-
-						while (baseIterator != baseEnd)
-						{
-							removes.push_back(*baseIterator);
-							++baseIterator;
-						}
-
-						while (compareIterator != compareEnd)
-						{
-							adds.push_back(*compareIterator);
-							++compareIterator;
-						}
-					}
+					prefetch(leaf);
+					prefetch(leaf->values());
+					return;
 				}
 			}
 		}
 	}
+
+	const TruthMap::Node* m_root;
+	Frame m_stack[truth::MaxDepth + 1];
+	u32 m_depth = 0;
+
+	const TruthMap::InlineArray* m_leaf = nullptr;
+	u32 m_index = 0;
+
+	u64 m_last = 0;
+	bool m_bounded = false;
+};
+
+inline void TruthMap::seal(TruthMap* map, Interner* interner)
+{
+	map->m_root = sealNode(map->m_root, interner);
+}
+
+inline TruthMap::Node* TruthMap::sealNode(Node* node, Interner* interner)
+{
+	if (node->sealed)
+	{
+		return node;
+	}
+
+	// anything unsealed was path copied by the map being sealed and is private to it
+	u64 hash = 0;
+	for (u32 i = 0; i < truth::NodeFanout; ++i)
+	{
+		if (node->isNode(i))
+		{
+			Node* child = sealNode(node->node(i), interner);
+			node->setNode(i, child);
+			hash += child->hash;
+		}
+		else if (InlineArray* leaf = node->leaf(i))
+		{
+			leaf = sealLeaf(leaf, interner);
+			node->setLeaf(i, leaf);
+			hash += leaf->hash;
+		}
+	}
+
+	node->hash = hash;
+	node->sealed = 1;
+
+	return interner ? interner->intern(node) : node;
+}
+
+inline TruthMap::InlineArray* TruthMap::sealLeaf(InlineArray* leaf, Interner* interner)
+{
+	if (leaf->sealed)
+	{
+		return leaf;
+	}
+
+	u64 hash = 0;
+	TruthObject** values = leaf->values();
+	for (u32 i = 0; i < leaf->size; ++i)
+	{
+		hash += truth::entryHash(leaf->keys[i], objectHash(values[i]));
+	}
+
+	leaf->hash = hash;
+	leaf->sealed = 1;
+
+	return interner ? interner->intern(leaf) : leaf;
+}
+
+inline void diff(const TruthMap* base, const TruthMap* compare, 
+Array<KeyEntry>& adds,
+Array<KeyEntry>& edits,
+Array<KeyEntry>& removes)
+{
+	TruthMap::diff(base, compare, adds, edits, removes);
+}
+
+template<typename Visitor>
+inline void diff(const TruthMap* base, const TruthMap* compare, Visitor& visitor)
+{
+	TruthMap::diff(base, compare, visitor);
 }
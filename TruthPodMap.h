@@ -0,0 +1,417 @@
+#pragma once
+
+#include <type_traits>
+
+#include "TruthMap.h"
+
+// Map of keys to small plain values held inline in the leaves, next to their
+// keys, instead of one TruthObject allocation per value. Bulk reads of a
+// component then walk each leaf's values front to back.
+//
+// Same trie as TruthMap, NodeBits per level from the top of the key and leaves
+// split past LeafSplitSize. clone() shares the root and a write copies the
+// nodes and the one leaf on its path that another version still holds, so
+// versions share every leaf they did not write to.
+template<typename T>
+class TruthPodMap
+{
+	static_assert(std::is_trivially_copyable<T>::value, "TruthPodMap values are memcpy'd");
+	static_assert(sizeof(T) <= 64, "values this big are cheaper behind a TruthObject");
+	static_assert(alignof(T) <= 16, "leaves are only as aligned as the heap");
+
+	struct Leaf
+	{
+		u32 refs;
+		u32 size;
+		u32 capacity;
+		u32 _pad;
+
+		// capacity keys followed by capacity values, the keys padded so the
+		// values stay aligned for an odd capacity
+		u64* keys() { return (u64*)(this + 1); }
+		const u64* keys() const { return (const u64*)(this + 1); }
+		T* values() { return (T*)((char*)keys() + keyBytes(capacity)); }
+		const T* values() const { return (const T*)((const char*)keys() + keyBytes(capacity)); }
+
+		static u32 keyBytes(u32 capacity)
+		{
+			return (capacity * u32(sizeof(u64)) + u32(alignof(T)) - 1) & ~(u32(alignof(T)) - 1);
+		}
+	};
+
+	struct Node
+	{
+		u32 refs;
+		u32 leafMask;
+		void* children[truth::NodeFanout];
+
+		bool isLeaf(u32 i) const { return (leafMask >> i) & 1; }
+	};
+
+public:
+	explicit TruthPodMap(Allocator* allocator)
+		: m_allocator(allocator)
+	{}
+
+	~TruthPodMap()
+	{
+		release(m_root);
+	}
+
+	TruthPodMap(TruthPodMap&& r)
+		: m_allocator(r.m_allocator)
+		, m_root(r.m_root)
+		, m_size(r.m_size)
+	{
+		r.m_root = nullptr;
+		r.m_size = 0;
+	}
+
+	TruthPodMap& operator=(TruthPodMap&& rhs)
+	{
+		if (&rhs != this)
+		{
+			release(m_root);
+
+			m_allocator = rhs.m_allocator;
+			m_root = rhs.m_root;
+			m_size = rhs.m_size;
+
+			rhs.m_root = nullptr;
+			rhs.m_size = 0;
+		}
+
+		return *this;
+	}
+
+	// O(1), the copy shares every node and leaf until either side writes.
+	TruthPodMap clone() const
+	{
+		TruthPodMap copy(m_allocator);
+		if (m_root)
+		{
+			atomicIncrement(&m_root->refs);
+		}
+
+		copy.m_root = m_root;
+		copy.m_size = m_size;
+
+		return copy;
+	}
+
+	const T* find(truth::Key key) const
+	{
+		const Node* node = m_root;
+		for (u32 level = 0; node; ++level)
+		{
+			u32 slot = truth::slotAt(key, level);
+			if (node->isLeaf(slot))
+			{
+				const Leaf* leaf = (const Leaf*)node->children[slot];
+				u32 at = truth::findKey(leaf->keys(), leaf->size, key.asU64);
+				return at != u32(-1) ? &leaf->values()[at] : nullptr;
+			}
+
+			node = (const Node*)node->children[slot];
+		}
+
+		return nullptr;
+	}
+
+	// Inserts or overwrites the value of key.
+	void set(truth::Key key, const T& value)
+	{
+		m_root = m_root ? writable(m_root) : newNode();
+
+		Node* node = m_root;
+		for (u32 level = 0; ; ++level)
+		{
+			u32 slot = truth::slotAt(key, level);
+			void* child = node->children[slot];
+
+			if (child == nullptr)
+			{
+				Leaf* leaf = newLeaf(4);
+				leaf->keys()[0] = key.asU64;
+				leaf->values()[0] = value;
+				leaf->size = 1;
+
+				node->children[slot] = leaf;
+				node->leafMask |= 1u << slot;
+				++m_size;
+				return;
+			}
+
+			if (!node->isLeaf(slot))
+			{
+				Node* next = writable((Node*)child);
+				node->children[slot] = next;
+				node = next;
+				continue;
+			}
+
+			Leaf* leaf = (Leaf*)child;
+			u32 at = truth::lowerBound(leaf->keys(), leaf->size, key.asU64);
+			if (at < leaf->size && leaf->keys()[at] == key.asU64)
+			{
+				leaf = writable(leaf, leaf->capacity);
+				leaf->values()[at] = value;
+				node->children[slot] = leaf;
+				return;
+			}
+
+			// a full leaf is pushed one level down and the insert continues there
+			if (leaf->size >= truth::LeafSplitSize && level + 1 < truth::MaxDepth)
+			{
+				Node* split = splitLeaf(leaf, level + 1);
+				release(leaf);
+
+				node->children[slot] = split;
+				node->leafMask &= ~(1u << slot);
+				node = split;
+				continue;
+			}
+
+			leaf = writable(leaf, leaf->size < leaf->capacity ? leaf->capacity : leaf->capacity * 2);
+			memmove(leaf->keys() + at + 1, leaf->keys() + at, (leaf->size - at) * sizeof(u64));
+			memmove(leaf->values() + at + 1, leaf->values() + at, (leaf->size - at) * sizeof(T));
+			leaf->keys()[at] = key.asU64;
+			leaf->values()[at] = value;
+			++leaf->size;
+
+			node->children[slot] = leaf;
+			++m_size;
+			return;
+		}
+	}
+
+	void erase(truth::Key key)
+	{
+		if (find(key) == nullptr)
+		{
+			return;
+		}
+
+		m_root = writable(m_root);
+
+		Node* node = m_root;
+		for (u32 level = 0; ; ++level)
+		{
+			u32 slot = truth::slotAt(key, level);
+			if (!node->isLeaf(slot))
+			{
+				Node* next = writable((Node*)node->children[slot]);
+				node->children[slot] = next;
+				node = next;
+				continue;
+			}
+
+			Leaf* leaf = (Leaf*)node->children[slot];
+			if (leaf->size == 1)
+			{
+				release(leaf);
+				node->children[slot] = nullptr;
+				node->leafMask &= ~(1u << slot);
+			}
+			else
+			{
+				leaf = writable(leaf, leaf->capacity);
+				u32 at = truth::findKey(leaf->keys(), leaf->size, key.asU64);
+				memmove(leaf->keys() + at, leaf->keys() + at + 1, (leaf->size - at - 1) * sizeof(u64));
+				memmove(leaf->values() + at, leaf->values() + at + 1, (leaf->size - at - 1) * sizeof(T));
+				--leaf->size;
+				node->children[slot] = leaf;
+			}
+
+			--m_size;
+			return;
+		}
+	}
+
+	u32 size() const { return m_size; }
+
+	// Calls fn(const u64* keys, const T* values, u32 count) for every leaf in
+	// key order, each a contiguous run of values.
+	template<typename Fn>
+	void forEachChunk(Fn&& fn) const
+	{
+		if (m_root)
+		{
+			forEachChunk(m_root, fn);
+		}
+	}
+
+	// Calls fn(key, value) for every entry in key order.
+	template<typename Fn>
+	void forEach(Fn&& fn) const
+	{
+		forEachChunk([&](const u64* keys, const T* values, u32 count)
+		{
+			for (u32 i = 0; i < count; ++i)
+			{
+				fn(truth::Key{ keys[i] }, values[i]);
+			}
+		});
+	}
+
+private:
+	Node* newNode()
+	{
+		Node* node = create<Node>(m_allocator);
+		node->refs = 1;
+		node->leafMask = 0;
+		memset(node->children, 0, sizeof(node->children));
+
+		return node;
+	}
+
+	Leaf* newLeaf(u32 capacity)
+	{
+		Leaf* leaf = (Leaf*)m_allocator->alloc(leafBytes(capacity));
+		leaf->refs = 1;
+		leaf->size = 0;
+		leaf->capacity = capacity;
+		leaf->_pad = 0;
+
+		return leaf;
+	}
+
+	static i32 leafBytes(u32 capacity)
+	{
+		return i32(sizeof(Leaf) + Leaf::keyBytes(capacity) + capacity * sizeof(T));
+	}
+
+	// Node itself when this version is its only holder, else a copy taking its place.
+	Node* writable(Node* node)
+	{
+		if (node->refs == 1)
+		{
+			return node;
+		}
+
+		Node* copy = create<Node>(m_allocator);
+		memcpy(copy, node, sizeof(Node));
+		copy->refs = 1;
+
+		// nodes and leaves both start with their refs
+		for (u32 i = 0; i < truth::NodeFanout; ++i)
+		{
+			if (copy->children[i])
+			{
+				atomicIncrement((u32*)copy->children[i]);
+			}
+		}
+
+		release(node);
+		return copy;
+	}
+
+	// Leaf itself when unshared and big enough, else a copy with the capacity asked for.
+	Leaf* writable(Leaf* leaf, u32 capacity)
+	{
+		if (leaf->refs == 1 && leaf->capacity == capacity)
+		{
+			return leaf;
+		}
+
+		Leaf* copy = newLeaf(capacity);
+		copy->size = leaf->size;
+		memcpy(copy->keys(), leaf->keys(), leaf->size * sizeof(u64));
+		memcpy(copy->values(), leaf->values(), leaf->size * sizeof(T));
+
+		release(leaf);
+		return copy;
+	}
+
+	// Node at level holding the entries of leaf, which the caller releases.
+	Node* splitLeaf(const Leaf* leaf, u32 level)
+	{
+		Node* node = newNode();
+
+		u32 i = 0;
+		while (i < leaf->size)
+		{
+			u32 slot = truth::slotAt(leaf->keys()[i], level);
+			u32 end = i + 1;
+			while (end < leaf->size && truth::slotAt(leaf->keys()[end], level) == slot)
+			{
+				++end;
+			}
+
+			Leaf* run = newLeaf(end - i);
+			run->size = end - i;
+			memcpy(run->keys(), leaf->keys() + i, run->size * sizeof(u64));
+			memcpy(run->values(), leaf->values() + i, run->size * sizeof(T));
+
+			node->children[slot] = run;
+			node->leafMask |= 1u << slot;
+			i = end;
+		}
+
+		return node;
+	}
+
+	void release(Leaf* leaf)
+	{
+		if (atomicDecrement(&leaf->refs) == 0)
+		{
+			m_allocator->freeSizeKnown(leaf, leafBytes(leaf->capacity));
+		}
+	}
+
+	void release(Node* node)
+	{
+		if (node == nullptr || atomicDecrement(&node->refs) != 0)
+		{
+			return;
+		}
+
+		for (u32 i = 0; i < truth::NodeFanout; ++i)
+		{
+			if (node->isLeaf(i))
+			{
+				release((Leaf*)node->children[i]);
+			}
+			else if (node->children[i])
+			{
+				release((Node*)node->children[i]);
+			}
+		}
+
+		destroy(*m_allocator, node);
+	}
+
+	template<typename Fn>
+	static void forEachChunk(const Node* node, Fn& fn)
+	{
+		for (u32 i = 0; i < truth::NodeFanout; ++i)
+		{
+			if (node->isLeaf(i))
+			{
+				// leaves are scattered over the heap, ask for the next one's header
+				// and all of this one's values at once instead of a miss at a time
+				if (i + 1 < truth::NodeFanout)
+				{
+					prefetch(node->children[i + 1]);
+				}
+
+				const Leaf* leaf = (const Leaf*)node->children[i];
+				const char* values = (const char*)leaf->values();
+				for (u32 offset = 0; offset < leaf->size * sizeof(T); offset += 64)
+				{
+					prefetch(values + offset);
+				}
+
+				fn(leaf->keys(), leaf->values(), leaf->size);
+			}
+			else if (node->children[i])
+			{
+				forEachChunk((const Node*)node->children[i], fn);
+			}
+		}
+	}
+
+	Allocator* m_allocator;
+	Node* m_root = nullptr;
+	u32 m_size = 0;
+};
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "Core/ArenaAllocator.h"
 #include "Core/Array.h"
+#include "Core/Atomic.h"
+#include "Core/HashMap.h"
 #include "Math.h"
 #include "mh64.h"
 #include "TruthMap.h"
@@ -11,22 +14,193 @@ struct Transaction
 
 	ReadOnlySnapshot base;
 	Snapshot uncommitted;
+
+	// Path copies and clones of this transaction, created on its first write.
+	// Objects passed to add() come from the Truth heap, only clones made by
+	// edit() live here.
+	ArenaAllocator* arena = nullptr;
 };
 
+// A key in a partition of its own, for new roots.
 truth::Key nextKey();
 
+// A key in the same partition as partition, for everything under a root.
+truth::Key nextKey(truth::Key partition);
+
+// Limits on what the undo history keeps alive. Zero disables a limit.
+struct HistoryPolicy
+{
+	// Oldest units are released once there are more than this many to undo.
+	i32 maxUndoUnits = 0;
+
+	// Oldest units are released once the path copies pinned by the undo history exceed this.
+	u64 maxBytes = 0;
+
+	// Units older than the newest keepRecent are coalesced with their older
+	// neighbour until a single unit spans coalesceCommits commits.
+	i32 keepRecent = 0;
+	i32 coalesceCommits = 1;
+};
+
+// What one commit changed relative to the snapshot before it, built once
+// from the transaction's own path copies and never modified afterwards.
+// before points into the older snapshot and is null for adds, after points
+// into the newer one and is null for removes.
+struct ChangeRecord
+{
+	struct Change
+	{
+		truth::Key key;
+		TruthObject* before;
+		TruthObject* after;
+	};
+
+	explicit ChangeRecord(Allocator* allocator)
+		: changes(allocator)
+	{}
+
+	Array<Change> changes;
+};
+
+// Keys referring to one key, sorted. The values of a snapshot's reference
+// index, copied on write like any other object so it is versioned with it.
+struct ReferrerSet : TruthObject
+{
+	constexpr static u64 kTypeId = TM_STATIC_HASH("ReferrerSet", 0xf10a472b6e4e603cULL);
+
+	explicit ReferrerSet(Allocator* a)
+		: keys(a)
+	{}
+
+	u64 typeId() const override
+	{
+		return kTypeId;
+	}
+
+	TruthObject* clone(Allocator* a) const override
+	{
+		ReferrerSet* copy = create<ReferrerSet>(a, a);
+		copy->root = root;
+		copy->keys = keys.clone();
+		return copy;
+	}
+
+	u64 contentHash() const override
+	{
+		return MetroHash64::Hash((const u8*)keys.data(), keys.size() * sizeof(truth::Key), kTypeId);
+	}
+
+	void insert(truth::Key key)
+	{
+		u32 at = truth::lowerBound((const u64*)keys.data(), u32(keys.size()), key.asU64);
+		if (at < u32(keys.size()) && keys[at] == key)
+		{
+			return;
+		}
+
+		keys.push_back(key);
+		memmove(keys.data() + at + 1, keys.data() + at, (keys.size() - 1 - at) * sizeof(truth::Key));
+		keys[at] = key;
+	}
+
+	void erase(truth::Key key)
+	{
+		u32 at = truth::lowerBound((const u64*)keys.data(), u32(keys.size()), key.asU64);
+		if (at < u32(keys.size()) && keys[at] == key)
+		{
+			memmove(keys.data() + at, keys.data() + at + 1, (keys.size() - 1 - at) * sizeof(truth::Key));
+			keys.resize(keys.size() - 1);
+		}
+	}
+
+	Array<truth::Key> keys;
+};
+
+// The published head is a single atomic pointer. Readers on any thread load
+// it wait-free through head()/read(). Writers commit with a compare and swap
+// against their transaction's base and either publish or report a conflict,
+// the short write lock only keeps the undo history in commit order.
+//
+// Snapshots dropped from the history are retired, not released. The owning
+// thread frees them in collect() once no ReadScope from an older epoch is
+// still open. The owning thread itself needs no scope since it is the one
+// calling collect(), other threads read inside a ReadScope and retain
+// anything they keep past it.
 class Truth
 {
 public:
+	class ReadScope
+	{
+	public:
+		explicit ReadScope(Truth& truth)
+			: m_truth(truth)
+			, m_slot(truth.enterRead())
+		{}
+
+		~ReadScope()
+		{
+			m_truth.exitRead(m_slot);
+		}
+
+		ReadScope(const ReadScope&) = delete;
+		ReadScope& operator=(const ReadScope&) = delete;
+
+	private:
+		Truth& m_truth;
+		u32 m_slot;
+	};
+
 	explicit Truth(Allocator* allocator)
 		: m_allocator(allocator)
 		, m_history(allocator)
+		, m_retired(allocator)
+		, m_limbo(allocator)
+		, m_interner(allocator)
 	{
 		TruthMap* emptyState = TruthMap::makeRoot(allocator);
-		m_history.push_back(Snapshot{ emptyState }.asImmutable());
+		TruthMap::seal(emptyState, nullptr);
+		m_history.push_back(HistoryEntry{ Snapshot{ emptyState }.asImmutable(), 0, 1, nullptr });
+		m_readIndex = 0;
+		m_head.store(emptyState, std::memory_order_release);
+	}
+
+	// Starts the history from entries sorted by key, e.g. a scene loaded from disk.
+	Truth(Allocator* allocator, const KeyEntry* sorted, u32 count)
+		: m_allocator(allocator)
+		, m_history(allocator)
+		, m_retired(allocator)
+		, m_limbo(allocator)
+		, m_interner(allocator)
+	{
+		TruthMap* initialState = TruthMap::buildFromSorted(allocator, sorted, count);
+		TruthMap::seal(initialState, nullptr);
+		m_history.push_back(HistoryEntry{ Snapshot{ initialState }.asImmutable(), 0, 1, nullptr });
 		m_readIndex = 0;
+		m_head.store(initialState, std::memory_order_release);
+	}
+
+	// Nothing may still be reading, head is one of the history entries. The
+	// interner goes after, dropping what only its table still holds.
+	~Truth()
+	{
+		for (HistoryEntry& entry : m_history)
+		{
+			TruthMap::release(entry.snap.s);
+			destroy(*m_allocator, entry.changes);
+		}
+		for (TruthMap* map : m_limbo)
+		{
+			TruthMap::release(map);
+		}
+		for (TruthMap* map : m_retired)
+		{
+			TruthMap::release(map);
+		}
 	}
 
+	Truth(const Truth&) = delete;
+	Truth& operator=(const Truth&) = delete;
+
 	/// Single shot API
 
 	const TruthObject* get(truth::Key key);
@@ -35,22 +209,65 @@ public:
 
 	ReadOnlySnapshot snap();
 
+	// head() and snap() stay valid until the next collect(). Anything kept past
+	// that, like a tab diffing against its last seen state, has to be retained.
+	void retain(ReadOnlySnapshot snap);
+	void release(ReadOnlySnapshot snap);
+
+	// Releases snapshots retired from the history once every ReadScope that
+	// could still see them has closed. Never blocks, call once per frame.
+	void collect();
+
+	// Equal by content, see TruthMap::sameContent. O(1) for any two snapshots.
+	bool sameContent(ReadOnlySnapshot a, ReadOnlySnapshot b) const
+	{
+		return TruthMap::sameContent(a.s, b.s);
+	}
+
+	// Commits made while enabled share subtrees equal to ones already held
+	// instead of keeping their own copy. Disabling drops the table.
+	void setInterning(bool enabled);
+
+	// Keeps a TypeIndex on every snapshot committed from now on, head gets one
+	// right away from a full walk. Call before other threads start reading.
+	void enableTypeIndex();
+
+	// Calls fn(key, object) for every object of typeId in snap, in key order.
+	// O(result) on snapshots with a type index, a full walk on older ones.
+	template<typename Fn>
+	void forEachOfType(ReadOnlySnapshot snap, u64 typeId, Fn&& fn);
+
+	// Keeps an index from every referenced key to its referrers on every
+	// snapshot committed from now on, see TruthObject::references. Head gets
+	// one right away from a full walk. Call before other threads start reading.
+	void enableReferenceIndex();
+
+	// Calls fn(referrer) for every key in snap whose object refers to key, in
+	// key order. O(referrers) on snapshots with a reference index, a full walk
+	// on older ones.
+	template<typename Fn>
+	void forEachReferrer(ReadOnlySnapshot snap, truth::Key key, Fn&& fn);
+
 	/// Transaction API
 
 	Transaction openTransaction();
+
+	// Publishes the transaction. If head moved since it was opened its writes
+	// are replayed onto the new head, false only when another commit touched
+	// one of the same keys.
 	bool commit(Transaction& tx);
 	void drop(Transaction& tx);
 
 	const TruthObject* read(ReadOnlySnapshot snap, truth::Key key);
 	const TruthObject* read(Transaction& tx, truth::Key key);
 	void add(Transaction& tx, truth::Key key, TruthObject* element);
+	void addMany(Transaction& tx, const truth::Key* keys, TruthObject* const* elements, u32 count);
 	TruthObject* edit(Transaction& tx, truth::Key key);
 	void erase(Transaction& tx, truth::Key key);
 
-
 	Allocator* allocator() const { return m_allocator; }
 
-	/// Undo Stack API
+	/// Undo Stack API, owning thread only
 	
 	i32 undoUnits()
 	{
@@ -65,53 +282,401 @@ public:
 
 	void setReadIndex(i32 index)
 	{
+		ScopedSpinLock lock(m_writeLock);
 		m_readIndex = index;
+		m_head.store(m_history[index].snap.s, std::memory_order_release);
 	}
 
+	// Net adds, edits and removes taking from to to, folded from the change
+	// records of the history entries in between, in either direction. Costs
+	// O(changes) instead of a tree walk. Returns false when either snapshot
+	// is no longer in the history, callers fall back to diff() then.
+	bool changes(
+		ReadOnlySnapshot from,
+		ReadOnlySnapshot to,
+		Array<KeyEntry>& adds,
+		Array<KeyEntry>& edits,
+		Array<KeyEntry>& removes);
+
+	// Same, streamed into a TruthDiffVisitor. Keys it rejects through
+	// visitRange(key, key) are left out.
+	template<typename Visitor>
+	bool changes(ReadOnlySnapshot from, ReadOnlySnapshot to, Visitor& visitor);
+
 	bool canUndo()
 	{
 		return m_readIndex > 0;
 	}
 
+	void setHistoryPolicy(const HistoryPolicy& policy);
+
+	// Bytes of nodes and leaves the unit path copied on top of the unit before it,
+	// i.e. what releasing it would give back. The oldest unit is the floor and reports 0.
+	u64 bytesRetained(i32 undoUnit) const { return m_history[undoUnit].bytes; }
+	u64 historyBytes() const { return m_historyBytes; }
+
+	// Commits folded into the unit by coalescing.
+	i32 commitsInUnit(i32 undoUnit) const { return m_history[undoUnit].commits; }
+
 	void undo()
 	{
 		if (canUndo())
 		{
-			--m_readIndex;
+			setReadIndex(m_readIndex - 1);
 		}
 	}
 
 	ReadOnlySnapshot head()
 	{
-		// todo little lock
-		i32 readIndex = m_readIndex;
-
-		return m_history[readIndex];
+		return ReadOnlySnapshot{ m_head.load(std::memory_order_acquire) };
 	}
 
-	void push(Snapshot snapshot)
+private:
+	// Records a snapshot that was just published as head, write lock held.
+	void push(Snapshot snapshot, ChangeRecord* record)
 	{
-		// todo hold a little lock
+		TruthMap::retain(snapshot.s);
 
 		if (m_readIndex == (m_history.size() - 1))
 		{
-			m_history.push_back(snapshot.asImmutable());
+			m_history.push_back(makeEntry(m_history[m_readIndex].snap, snapshot.asImmutable(), record));
 		}
 		else
 		{
+			// redo entries can never be reached again
+			for (i32 i = m_readIndex + 1; i < m_history.size(); ++i)
+			{
+				m_historyBytes -= m_history[i].bytes;
+				m_retired.push_back(m_history[i].snap.s);
+				destroy(*m_allocator, m_history[i].changes);
+			}
+
 			m_history.resize(m_readIndex + 1);
-			m_history.push_back(snapshot.asImmutable());
+			m_history.push_back(makeEntry(m_history[m_readIndex].snap, snapshot.asImmutable(), record));
 		}
 
 		++m_readIndex;
+		m_historyBytes += m_history[m_readIndex].bytes;
+
+		applyPolicy();
 	}
 
-private:
+	struct HistoryEntry
+	{
+		ReadOnlySnapshot snap;
+		u64 bytes;
+		i32 commits;
+
+		// changes from the entry before, null when there are none or for the oldest
+		ChangeRecord* changes;
+	};
+
+	static HistoryEntry makeEntry(ReadOnlySnapshot previous, ReadOnlySnapshot snap, ChangeRecord* record)
+	{
+		return HistoryEntry{ snap, TruthMap::bytesAdded(previous.s, snap.s), 1, record };
+	}
+
+	struct NetChange
+	{
+		TruthObject* before;
+		TruthObject* after;
+	};
+
+	struct RecordWriter : TruthDiffVisitor
+	{
+		explicit RecordWriter(ChangeRecord* record)
+			: record(record)
+		{}
+
+		void onAdd(truth::Key key, TruthObject* value) { record->changes.push_back(ChangeRecord::Change{ key, nullptr, value }); }
+		void onEdit(truth::Key key, TruthObject* before, TruthObject* after) { record->changes.push_back(ChangeRecord::Change{ key, before, after }); }
+		void onRemove(truth::Key key, TruthObject* value) { record->changes.push_back(ChangeRecord::Change{ key, value, nullptr }); }
+
+		ChangeRecord* record;
+	};
+
+	// Keys a transaction wrote, whatever they were written to.
+	struct KeyWriter : TruthDiffVisitor
+	{
+		explicit KeyWriter(Array<truth::Key>& keys)
+			: keys(keys)
+		{}
+
+		void onAdd(truth::Key key, TruthObject*) { keys.push_back(key); }
+		void onEdit(truth::Key key, TruthObject*, TruthObject*) { keys.push_back(key); }
+		void onRemove(truth::Key key, TruthObject*) { keys.push_back(key); }
+
+		Array<truth::Key>& keys;
+	};
+
+	ChangeRecord* makeRecord(const TruthMap* from, const TruthMap* to);
+	static void fold(HashMap<NetChange, HashIdentity>& net, const ChangeRecord* record, bool forward);
+	ChangeRecord* compose(const ChangeRecord* older, const ChangeRecord* newer);
+	i32 historyIndex(const TruthMap* snap) const;
+
+	void applyPolicy();
+	void removeEntry(i32 index);
+
+	bool rebase(Transaction& tx, const Array<truth::Key>& written);
+	TruthMap* writable(Transaction& tx);
+	void seal(Transaction& tx);
+
+	TypeIndex* indexTypes(const TruthMap* base, const ChangeRecord* record);
+	TypeIndex* buildTypeIndex(const TruthMap* map);
+
+	TruthMap* indexReferences(const TruthMap* base, const ChangeRecord* record);
+	TruthMap* buildReferenceIndex(const TruthMap* map);
+	void sortedReferences(const TruthObject* object, Array<truth::Key>& out);
+
+	u32 enterRead();
+	void exitRead(u32 slot);
+
 	Allocator* m_allocator;
-	Array<ReadOnlySnapshot> m_history;
+	std::atomic<TruthMap*> m_head{ nullptr };
+	SpinLock m_writeLock;
+	Array<HistoryEntry> m_history;
+	Array<TruthMap*> m_retired;
+	Array<TruthMap*> m_limbo;
+	std::atomic<u64> m_epoch{ 1 };
+	std::atomic<u32> m_readers[2] = {};
+	HistoryPolicy m_policy;
+	u64 m_historyBytes = 0;
 	i32 m_readIndex = 0;
+
+	// Interned subtrees looked at per collect() when searching for dead ones.
+	constexpr static i32 InternSweepBudget = 1024;
+
+	SpinLock m_internLock;
+	TruthMap::Interner m_interner;
+	bool m_interning = false;
+
+	bool m_typeIndex = false;
+	bool m_referenceIndex = false;
 };
 
+inline void Truth::setHistoryPolicy(const HistoryPolicy& policy)
+{
+	ScopedSpinLock lock(m_writeLock);
+	m_policy = policy;
+	applyPolicy();
+}
+
+inline void Truth::applyPolicy()
+{
+	// Coalesce the unit leaving the recent window into its older neighbour by
+	// dropping the neighbour, undo then steps over both commits at once.
+	if (m_policy.keepRecent > 0 && m_policy.coalesceCommits > 1)
+	{
+		i32 index = m_history.size() - 1 - m_policy.keepRecent;
+		while (index > 1 && index <= m_readIndex)
+		{
+			HistoryEntry& older = m_history[index - 1];
+			HistoryEntry& entry = m_history[index];
+			if (older.commits + entry.commits > m_policy.coalesceCommits)
+			{
+				break;
+			}
+
+			entry.commits += older.commits;
+			removeEntry(index - 1);
+			--index;
+		}
+	}
+
+	// Release the oldest units while over budget, never the one being read.
+	while (m_readIndex > 0)
+	{
+		bool overUnits = m_policy.maxUndoUnits > 0 && (m_history.size() - 1) > m_policy.maxUndoUnits;
+		bool overBytes = m_policy.maxBytes > 0 && m_historyBytes > m_policy.maxBytes;
+		if (!overUnits && !overBytes)
+		{
+			break;
+		}
+
+		removeEntry(0);
+	}
+}
+
+inline void Truth::removeEntry(i32 index)
+{
+	m_historyBytes -= m_history[index].bytes;
+	m_retired.push_back(m_history[index].snap.s);
+	ChangeRecord* removed = m_history[index].changes;
+
+	for (i32 i = index; i < m_history.size() - 1; ++i)
+	{
+		m_history[i] = m_history[i + 1];
+	}
+	m_history.resize(m_history.size() - 1);
+
+	if (m_readIndex >= index)
+	{
+		--m_readIndex;
+	}
+
+	// the unit after the removed one now sits on top of a different snapshot
+	if (index == 0)
+	{
+		m_historyBytes -= m_history[0].bytes;
+		m_history[0].bytes = 0;
+
+		destroy(*m_allocator, m_history[0].changes);
+		m_history[0].changes = nullptr;
+	}
+	else if (index < m_history.size())
+	{
+		HistoryEntry& next = m_history[index];
+		m_historyBytes -= next.bytes;
+		next.bytes = TruthMap::bytesAdded(m_history[index - 1].snap.s, next.snap.s);
+		m_historyBytes += next.bytes;
+
+		ChangeRecord* composed = compose(removed, next.changes);
+		destroy(*m_allocator, next.changes);
+		next.changes = composed;
+	}
+
+	destroy(*m_allocator, removed);
+}
+
+inline ChangeRecord* Truth::makeRecord(const TruthMap* from, const TruthMap* to)
+{
+	ChangeRecord* record = create<ChangeRecord>(m_allocator, m_allocator);
+
+	RecordWriter writer(record);
+	TruthMap::diff(from, to, writer);
+
+	if (record->changes.empty())
+	{
+		destroy(*m_allocator, record);
+		return nullptr;
+	}
+
+	return record;
+}
+
+inline void Truth::fold(HashMap<NetChange, HashIdentity>& net, const ChangeRecord* record, bool forward)
+{
+	if (record == nullptr)
+	{
+		return;
+	}
+
+	// a record touches every key once, only the order across records matters
+	for (const ChangeRecord::Change& change : record->changes)
+	{
+		TruthObject* before = forward ? change.before : change.after;
+		TruthObject* after = forward ? change.after : change.before;
+
+		if (NetChange* existing = net.find(change.key.asU64))
+		{
+			existing->after = after;
+		}
+		else
+		{
+			net.add(change.key.asU64, NetChange{ before, after });
+		}
+	}
+}
+
+inline ChangeRecord* Truth::compose(const ChangeRecord* older, const ChangeRecord* newer)
+{
+	HashMap<NetChange, HashIdentity> net(m_allocator);
+	fold(net, older, true);
+	fold(net, newer, true);
+
+	ChangeRecord* record = nullptr;
+	for (auto& entry : net)
+	{
+		if (entry.value.before != entry.value.after)
+		{
+			if (record == nullptr)
+			{
+				record = create<ChangeRecord>(m_allocator, m_allocator);
+			}
+			record->changes.push_back(ChangeRecord::Change{ truth::Key{ entry.key }, entry.value.before, entry.value.after });
+		}
+	}
+
+	return record;
+}
+
+inline i32 Truth::historyIndex(const TruthMap* snap) const
+{
+	for (i32 i = m_history.size() - 1; i >= 0; --i)
+	{
+		if (m_history[i].snap.s == snap)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+inline bool Truth::changes(
+	ReadOnlySnapshot from,
+	ReadOnlySnapshot to,
+	Array<KeyEntry>& adds,
+	Array<KeyEntry>& edits,
+	Array<KeyEntry>& removes)
+{
+	DiffCollector collector(adds, edits, removes);
+	return changes(from, to, collector);
+}
+
+template<typename Visitor>
+inline bool Truth::changes(ReadOnlySnapshot from, ReadOnlySnapshot to, Visitor& visitor)
+{
+	HashMap<NetChange, HashIdentity> net(m_allocator);
+	{
+		ScopedSpinLock lock(m_writeLock);
+
+		i32 fromIndex = historyIndex(from.s);
+		i32 toIndex = historyIndex(to.s);
+		if (fromIndex < 0 || toIndex < 0)
+		{
+			return false;
+		}
+
+		// undo walks the records backwards and applies them inverted
+		for (i32 i = fromIndex + 1; i <= toIndex; ++i)
+		{
+			fold(net, m_history[i].changes, true);
+		}
+		for (i32 i = fromIndex; i > toIndex; --i)
+		{
+			fold(net, m_history[i].changes, false);
+		}
+	}
+
+	for (auto& entry : net)
+	{
+		NetChange change = entry.value;
+		truth::Key key{ entry.key };
+
+		// committed objects are sealed, edits that ended up back at the same content are no change
+		bool unchanged = change.before == change.after || (change.before && change.after && change.before->hash == change.after->hash);
+		if (unchanged || !visitor.visitRange(key.asU64, key.asU64))
+		{
+			continue;
+		}
+		else if (change.before == nullptr)
+		{
+			visitor.onAdd(key, change.after);
+		}
+		else if (change.after == nullptr)
+		{
+			visitor.onRemove(key, change.before);
+		}
+		else
+		{
+			visitor.onEdit(key, change.before, change.after);
+		}
+	}
+
+	return true;
+}
+
 inline const TruthObject* Truth::get(truth::Key key)
 {
 	ReadOnlySnapshot snap = head();
@@ -122,11 +687,15 @@ inline const TruthObject* Truth::get(truth::Key key)
 inline bool Truth::set(truth::Key key, TruthObject* element)
 {
 	Transaction tx = openTransaction();
-	tx.uncommitted.s = TruthMap::writeValue(tx.base.s, tx.uncommitted.s, key, element);
+	add(tx, key, element);
 
-	// todo: handle dropping
+	if (!commit(tx))
+	{
+		drop(tx);
+		return false;
+	}
 
-	return commit(tx);
+	return true;
 }
 
 inline bool Truth::erase(truth::Key key)
@@ -134,9 +703,13 @@ inline bool Truth::erase(truth::Key key)
 	Transaction tx = openTransaction();
 	erase(tx, key);
 
-	// todo: handle dropping
+	if (!commit(tx))
+	{
+		drop(tx);
+		return false;
+	}
 
-	return commit(tx);
+	return true;
 }
 
 inline ReadOnlySnapshot Truth::snap()
@@ -144,9 +717,434 @@ inline ReadOnlySnapshot Truth::snap()
 	return head();
 }
 
+inline void Truth::retain(ReadOnlySnapshot snap)
+{
+	TruthMap::retain(snap.s);
+}
+
+inline void Truth::release(ReadOnlySnapshot snap)
+{
+	TruthMap::release(snap.s);
+}
+
+inline u32 Truth::enterRead()
+{
+	for (;;)
+	{
+		u64 epoch = m_epoch.load();
+		u32 slot = u32(epoch & 1);
+		m_readers[slot].fetch_add(1);
+
+		// collect() may have moved on between the load and the increment
+		if (m_epoch.load() == epoch)
+		{
+			return slot;
+		}
+
+		m_readers[slot].fetch_sub(1);
+	}
+}
+
+inline void Truth::exitRead(u32 slot)
+{
+	m_readers[slot].fetch_sub(1);
+}
+
+inline void Truth::collect()
+{
+	// Limbo holds what was retired before the last epoch bump. Only readers
+	// that entered before that bump can still see it, once those are gone it
+	// is freed and the current retirees take its place.
+	Array<TruthMap*> freeing(m_allocator);
+	{
+		ScopedSpinLock lock(m_writeLock);
+
+		u64 epoch = m_epoch.load();
+		if (m_readers[(epoch - 1) & 1].load() != 0)
+		{
+			return;
+		}
+
+		freeing.swap(m_limbo);
+		m_limbo.swap(m_retired);
+		m_epoch.store(epoch + 1);
+	}
+
+	for (TruthMap* map : freeing)
+	{
+		TruthMap::release(map);
+	}
+
+	// only the table can still reach what it frees, no ReadScope to wait for
+	ScopedSpinLock lock(m_internLock);
+	m_interner.sweep(InternSweepBudget);
+}
+
+inline void Truth::enableTypeIndex()
+{
+	ScopedSpinLock lock(m_writeLock);
+	m_typeIndex = true;
+
+	TruthMap* current = m_head.load(std::memory_order_acquire);
+	if (current->types() == nullptr)
+	{
+		current->setTypes(buildTypeIndex(current));
+	}
+}
+
+template<typename Fn>
+inline void Truth::forEachOfType(ReadOnlySnapshot snap, u64 typeId, Fn&& fn)
+{
+	if (const TypeIndex* index = snap.s->types())
+	{
+		if (const TruthMap* objects = index->objects(typeId))
+		{
+			objects->forEach(fn);
+		}
+		return;
+	}
+
+	snap.s->forEach([&](truth::Key key, TruthObject* value)
+	{
+		if (value->typeId() == typeId)
+		{
+			fn(key, value);
+		}
+	});
+}
+
+inline TypeIndex* Truth::buildTypeIndex(const TruthMap* map)
+{
+	// the walk is in key order, so every per type run comes out sorted
+	HashMap<Array<KeyEntry>> byType(m_allocator);
+	map->forEach([&](truth::Key key, TruthObject* value)
+	{
+		Array<KeyEntry>* entries = byType.find(value->typeId());
+		if (entries == nullptr)
+		{
+			entries = &byType[value->typeId()];
+			entries->set_allocator(m_allocator);
+		}
+		entries->push_back(KeyEntry{ key, value });
+	});
+
+	TypeIndex* index = create<TypeIndex>(m_allocator, m_allocator);
+	for (auto& entry : byType)
+	{
+		TruthMap* objects = TruthMap::buildFromSorted(m_allocator, entry.value.data(), u32(entry.value.size()));
+
+		i32 at = index->find(entry.key);
+		index->types.push_back(TypeIndex::Type{});
+		for (i32 i = index->types.size() - 1; i > at; --i)
+		{
+			index->types[i] = index->types[i - 1];
+		}
+		index->types[at] = TypeIndex::Type{ entry.key, objects };
+	}
+
+	return index;
+}
+
+// Index of the map record leads to from base. Only the types the record
+// touches are written, each through a path copy of its map in base's index.
+inline TypeIndex* Truth::indexTypes(const TruthMap* base, const ChangeRecord* record)
+{
+	TypeIndex* previous = (TypeIndex*)base->types();
+	if (previous == nullptr)
+	{
+		return nullptr;
+	}
+
+	if (record == nullptr)
+	{
+		atomicIncrement(&previous->refs);
+		return previous;
+	}
+
+	TypeIndex* index = create<TypeIndex>(m_allocator, m_allocator);
+	index->types = previous->types.clone();
+
+	// Types keep base's map until their first write replaces it with a copy.
+	// New types start from an empty map that only lives through the build.
+	Array<TruthMap*> bases(m_allocator);
+	for (const TypeIndex::Type& type : previous->types)
+	{
+		bases.push_back(type.objects);
+	}
+
+	auto objectsOf = [&](u64 typeId) -> i32
+	{
+		i32 at = index->find(typeId);
+		if (at == index->types.size() || index->types[at].typeId != typeId)
+		{
+			TruthMap* empty = TruthMap::makeRoot(m_allocator);
+			index->types.push_back(TypeIndex::Type{});
+			bases.push_back(nullptr);
+			for (i32 i = index->types.size() - 1; i > at; --i)
+			{
+				index->types[i] = index->types[i - 1];
+				bases[i] = bases[i - 1];
+			}
+			index->types[at] = TypeIndex::Type{ typeId, empty };
+			bases[at] = empty;
+		}
+		return at;
+	};
+
+	for (const ChangeRecord::Change& change : record->changes)
+	{
+		u64 beforeType = change.before ? change.before->typeId() : 0;
+		u64 afterType = change.after ? change.after->typeId() : 0;
+
+		if (change.before && (!change.after || beforeType != afterType))
+		{
+			i32 at = objectsOf(beforeType);
+			index->types[at].objects = TruthMap::erase(bases[at], index->types[at].objects, change.key);
+		}
+
+		if (change.after)
+		{
+			i32 at = objectsOf(afterType);
+			index->types[at].objects = TruthMap::writeValue(bases[at], index->types[at].objects, change.key, change.after);
+		}
+	}
+
+	// the new index holds a reference to every map it keeps, written ones
+	// were created with theirs
+	i32 kept = 0;
+	for (i32 i = 0; i < index->types.size(); ++i)
+	{
+		TypeIndex::Type type = index->types[i];
+		bool fresh = type.objects != bases[i];
+		bool temporary = bases[i] != nullptr && previous->objects(type.typeId) != bases[i];
+
+		if (!fresh)
+		{
+			TruthMap::retain(type.objects);
+		}
+		if (temporary)
+		{
+			TruthMap::release(bases[i]);
+		}
+
+		if (type.objects->size() == 0)
+		{
+			TruthMap::release(type.objects);
+			continue;
+		}
+
+		index->types[kept++] = type;
+	}
+	index->types.resize(kept);
+
+	return index;
+}
+
+inline void Truth::enableReferenceIndex()
+{
+	ScopedSpinLock lock(m_writeLock);
+	m_referenceIndex = true;
+
+	TruthMap* current = m_head.load(std::memory_order_acquire);
+	if (current->referrers() == nullptr)
+	{
+		current->setReferrers(buildReferenceIndex(current));
+	}
+}
+
+template<typename Fn>
+inline void Truth::forEachReferrer(ReadOnlySnapshot snap, truth::Key key, Fn&& fn)
+{
+	if (const TruthMap* referrers = snap.s->referrers())
+	{
+		if (const ReferrerSet* set = (const ReferrerSet*)referrers->find(key))
+		{
+			for (truth::Key referrer : set->keys)
+			{
+				fn(referrer);
+			}
+		}
+		return;
+	}
+
+	Array<truth::Key> references(m_allocator);
+	snap.s->forEach([&](truth::Key referrer, TruthObject* value)
+	{
+		references.clear();
+		value->references(references);
+		for (truth::Key reference : references)
+		{
+			if (reference == key)
+			{
+				fn(referrer);
+				break;
+			}
+		}
+	});
+}
+
+inline void Truth::sortedReferences(const TruthObject* object, Array<truth::Key>& out)
+{
+	out.clear();
+	if (object == nullptr)
+	{
+		return;
+	}
+
+	object->references(out);
+
+	Array<KeyEntry> entries(m_allocator);
+	entries.resize(out.size() * 2);
+	for (i32 i = 0; i < out.size(); ++i)
+	{
+		entries[i] = KeyEntry{ out[i], nullptr };
+	}
+	truth::sortByKey(entries.data(), entries.data() + out.size(), u32(out.size()));
+
+	i32 unique = 0;
+	for (i32 i = 0; i < out.size(); ++i)
+	{
+		if (unique == 0 || out[unique - 1] != entries[i].key)
+		{
+			out[unique++] = entries[i].key;
+		}
+	}
+	out.resize(unique);
+}
+
+inline TruthMap* Truth::buildReferenceIndex(const TruthMap* map)
+{
+	// (referenced, referrer) pairs, the walk is in referrer order and the sort
+	// is stable so every referenced key's referrers come out sorted
+	Array<KeyEntry> pairs(m_allocator);
+	Array<truth::Key> references(m_allocator);
+	map->forEach([&](truth::Key referrer, TruthObject* value)
+	{
+		sortedReferences(value, references);
+		for (truth::Key reference : references)
+		{
+			pairs.push_back(KeyEntry{ reference, (TruthObject*)referrer.asU64 });
+		}
+	});
+
+	i32 count = pairs.size();
+	pairs.resize(count * 2);
+	truth::sortByKey(pairs.data(), pairs.data() + count, u32(count));
+
+	Array<KeyEntry> sets(m_allocator);
+	for (i32 i = 0; i < count; ++i)
+	{
+		if (sets.empty() || sets.back().key != pairs[i].key)
+		{
+			sets.push_back(KeyEntry{ pairs[i].key, create<ReferrerSet>(m_allocator, m_allocator) });
+		}
+		((ReferrerSet*)sets.back().value)->keys.push_back(truth::Key{ u64(pairs[i].value) });
+	}
+
+	return TruthMap::buildFromSorted(m_allocator, sets.data(), u32(sets.size()));
+}
+
+// Index of the map record leads to from base. Only the referenced keys whose
+// referrers changed are written, through a path copy of base's index.
+inline TruthMap* Truth::indexReferences(const TruthMap* base, const ChangeRecord* record)
+{
+	TruthMap* previous = (TruthMap*)base->referrers();
+	if (previous == nullptr)
+	{
+		return nullptr;
+	}
+
+	TruthMap::retain(previous);
+	if (record == nullptr)
+	{
+		return previous;
+	}
+
+	TruthMap* index = previous;
+	auto link = [&](truth::Key reference, truth::Key referrer)
+	{
+		if (index->find(reference) == nullptr)
+		{
+			ReferrerSet* set = create<ReferrerSet>(m_allocator, m_allocator);
+			set->keys.push_back(referrer);
+			index = TruthMap::writeValue(previous, index, reference, set);
+			return;
+		}
+
+		TruthObject* set;
+		index = TruthMap::lookupForWrite(previous, index, reference, &set);
+		((ReferrerSet*)set)->insert(referrer);
+	};
+
+	auto unlink = [&](truth::Key reference, truth::Key referrer)
+	{
+		TruthObject* set;
+		index = TruthMap::lookupForWrite(previous, index, reference, &set);
+		((ReferrerSet*)set)->erase(referrer);
+		if (((ReferrerSet*)set)->keys.empty())
+		{
+			index = TruthMap::erase(previous, index, reference);
+		}
+	};
+
+	Array<truth::Key> before(m_allocator);
+	Array<truth::Key> after(m_allocator);
+	for (const ChangeRecord::Change& change : record->changes)
+	{
+		// an edit sharing the groups that hold references refers to the same keys
+		if (change.before && change.after && (change.after->changedFields(change.before) & change.after->referenceFields()) == 0)
+		{
+			continue;
+		}
+
+		sortedReferences(change.before, before);
+		sortedReferences(change.after, after);
+
+		i32 i = 0;
+		i32 j = 0;
+		while (i < before.size() || j < after.size())
+		{
+			if (j == after.size() || (i < before.size() && before[i].asU64 < after[j].asU64))
+			{
+				unlink(before[i++], change.key);
+			}
+			else if (i == before.size() || after[j].asU64 < before[i].asU64)
+			{
+				link(after[j++], change.key);
+			}
+			else
+			{
+				++i;
+				++j;
+			}
+		}
+	}
+
+	// the first write replaced the reference taken above with a fresh map
+	if (index != previous)
+	{
+		TruthMap::release(previous);
+	}
+
+	return index;
+}
+
+inline void Truth::setInterning(bool enabled)
+{
+	ScopedSpinLock lock(m_internLock);
+	m_interning = enabled;
+
+	if (!enabled)
+	{
+		m_interner.clear();
+	}
+}
+
 inline Transaction Truth::openTransaction()
 {
+	ReadScope scope(*this);
 	ReadOnlySnapshot current_head = head();
+	TruthMap::retain(current_head.s);
 	
 	// Note: Initialize transaction with non const head. all write ops on compares base and head and wont overwrite values owned by base
 	return Transaction{ current_head, Snapshot{current_head.s} };
@@ -154,21 +1152,158 @@ inline Transaction Truth::openTransaction()
 
 inline bool Truth::commit(Transaction& tx)
 {
-	ReadOnlySnapshot current_head = head();
 	assert(tx.uncommitted.s != nullptr);
 
-	// todo need exclusive head 
-	if (current_head.s == tx.base.s)
+	Array<truth::Key> written(m_allocator);
+	for (;;)
 	{
-		push(tx.uncommitted);
-		tx.uncommitted.s = nullptr;
-		tx.base.s = nullptr;
-		return true;
+		// the arena goes away with the transaction, move what survives to the heap first
+		if (tx.arena)
+		{
+			tx.uncommitted.s = TruthMap::adopt(tx.uncommitted.s, tx.arena, m_allocator);
+		}
+
+		// Sealing drops edits back to content base had from diff, interning
+		// can even swap their leaf for base's own. A rebase still has to see
+		// them as writes, a concurrent change to one of those keys conflicts.
+		written.clear();
+		KeyWriter keyWriter(written);
+		TruthMap::diff(tx.base.s, tx.uncommitted.s, keyWriter);
+
+		seal(tx);
+
+		// only walks the transaction's own path copies
+		ChangeRecord* record = makeRecord(tx.base.s, tx.uncommitted.s);
+
+		if (m_typeIndex && tx.uncommitted.s != tx.base.s)
+		{
+			tx.uncommitted.s->setTypes(indexTypes(tx.base.s, record));
+		}
+		if (m_referenceIndex && tx.uncommitted.s != tx.base.s)
+		{
+			tx.uncommitted.s->setReferrers(indexReferences(tx.base.s, record));
+		}
+
+		{
+			ScopedSpinLock lock(m_writeLock);
+
+			TruthMap* expected = tx.base.s;
+			if (m_head.compare_exchange_strong(expected, tx.uncommitted.s, std::memory_order_acq_rel))
+			{
+				push(tx.uncommitted, record);
+				break;
+			}
+		}
+
+		destroy(*m_allocator, record);
+
+		// replaying happens outside the lock, head may move again meanwhile
+		if (!rebase(tx, written))
+		{
+			return false;
+		}
 	}
-	else
+
+	drop(tx);
+	return true;
+}
+
+inline bool Truth::rebase(Transaction& tx, const Array<truth::Key>& written)
+{
+	ReadScope scope(*this);
+	TruthMap* current = m_head.load(std::memory_order_acquire);
+
+	// Edits clone and removes drop the object, so a key some other commit
+	// touched since base no longer maps to the same pointer in head. With
+	// interning a key edited back to its old content can map to the old
+	// pointer again, writing over it then is still what the other commit left.
+	for (truth::Key key : written)
 	{
-		return false;
+		if (current->find(key) != tx.base.s->find(key))
+		{
+			return false;
+		}
+	}
+
+	// What the sealed map no longer shows as written still holds base's
+	// content, and head holds that too, there is nothing to replay for it.
+	Array<KeyEntry> adds(m_allocator);
+	Array<KeyEntry> edits(m_allocator);
+	Array<KeyEntry> removes(m_allocator);
+	TruthMap::diff(tx.base.s, tx.uncommitted.s, adds, edits, removes);
+
+	TruthMap::retain(current);
+
+	// the old map keeps the written objects alive until they are replayed
+	TruthMap* previousBase = tx.base.s;
+	TruthMap* previous = tx.uncommitted.s;
+	tx.base.s = current;
+	tx.uncommitted.s = current;
+
+	for (const KeyEntry& entry : removes)
+	{
+		erase(tx, entry.key);
+	}
+	for (const KeyEntry& entry : edits)
+	{
+		tx.uncommitted.s = TruthMap::writeValue(current, writable(tx), entry.key, entry.value);
 	}
+	for (const KeyEntry& entry : adds)
+	{
+		add(tx, entry.key, entry.value);
+	}
+
+	if (previous != previousBase)
+	{
+		TruthMap::release(previous);
+	}
+	TruthMap::release(previousBase);
+
+	return true;
+}
+
+inline void Truth::seal(Transaction& tx)
+{
+	if (tx.uncommitted.s == tx.base.s)
+	{
+		return;
+	}
+
+	ScopedSpinLock lock(m_internLock);
+	TruthMap::seal(tx.uncommitted.s, m_interning ? &m_interner : nullptr);
+}
+
+inline TruthMap* Truth::writable(Transaction& tx)
+{
+	if (tx.uncommitted.s == tx.base.s)
+	{
+		if (tx.arena == nullptr)
+		{
+			tx.arena = create<ArenaAllocator>(m_allocator, m_allocator);
+		}
+
+		tx.uncommitted.s = TruthMap::fork(tx.base.s, tx.arena);
+	}
+
+	return tx.uncommitted.s;
+}
+
+inline void Truth::drop(Transaction& tx)
+{
+	// The transaction holds its base and, once it has written, its own map.
+	// Releasing that map only walks its path copies to hand back what they
+	// borrowed from base, the memory itself goes with the arena.
+	if (tx.uncommitted.s != tx.base.s)
+	{
+		TruthMap::release(tx.uncommitted.s);
+	}
+	TruthMap::release(tx.base.s);
+
+	destroy(*m_allocator, tx.arena);
+
+	tx.uncommitted.s = nullptr;
+	tx.base.s = nullptr;
+	tx.arena = nullptr;
 }
 
 inline const TruthObject* Truth::read(ReadOnlySnapshot snap, truth::Key key)
@@ -183,17 +1318,22 @@ inline const TruthObject* Truth::read(Transaction& tx, truth::Key key)
 
 inline void Truth::add(Transaction& tx, truth::Key key, TruthObject* element)
 {
-	tx.uncommitted.s = TruthMap::writeValue(tx.base.s, tx.uncommitted.s, key, element);
+	tx.uncommitted.s = TruthMap::writeValue(tx.base.s, writable(tx), key, element);
+}
+
+inline void Truth::addMany(Transaction& tx, const truth::Key* keys, TruthObject* const* elements, u32 count)
+{
+	tx.uncommitted.s = TruthMap::writeValues(tx.base.s, writable(tx), keys, elements, count);
 }
 
 inline TruthObject* Truth::edit(Transaction& tx, truth::Key key)
 {
 	TruthObject* element;
-	tx.uncommitted.s = TruthMap::lookupForWrite(tx.base.s, tx.uncommitted.s, key, &element);
+	tx.uncommitted.s = TruthMap::lookupForWrite(tx.base.s, writable(tx), key, &element);
 	return element;
 }
 
 inline void Truth::erase(Transaction& tx, truth::Key key)
 {
-	tx.uncommitted.s = TruthMap::erase(tx.base.s, tx.uncommitted.s, key);
+	tx.uncommitted.s = TruthMap::erase(tx.base.s, writable(tx), key);
 }
@@ -0,0 +1,40 @@
+@echo off
+
+if not exist build mkdir build
+if not exist build\bench mkdir build\bench
+
+:: Check if env_cache.txt exists
+if not exist build\env_cache.txt (
+    echo Environment cache not found, running setup...
+    call setup_env.bat
+    if errorlevel 1 (
+        echo Failed to setup environment
+        exit /b 1
+    )
+) else (
+    echo Loading cached environment variables...
+    for /f "tokens=*" %%i in (build\env_cache.txt) do (
+        set "%%i"
+    )
+)
+
+:: Benchmarks are optimized, unlike the editor build
+set COMPILER_FLAGS=/std:c++17 /EHsc /O2 /MT /DNDEBUG
+set OUTPUT_DIR=build\bench
+
+for %%f in (bench\*.cpp) do (
+    echo Compiling %%~nf...
+    cl.exe %%f mh64.cpp %COMPILER_FLAGS% /Fe:%OUTPUT_DIR%\%%~nf.exe /Fo:%OUTPUT_DIR%\
+    if errorlevel 1 (
+        echo Compilation of %%~nf failed
+        exit /b 1
+    )
+)
+
+for %%f in (bench\*.cpp) do (
+    %OUTPUT_DIR%\%%~nf.exe
+    if errorlevel 1 (
+        echo %%~nf failed
+        exit /b 1
+    )
+)
@@ -0,0 +1,149 @@
+// Building a map up front and resolving batches of keys, HashMap and SwissMap.
+//
+// Build fills a map with Count random keys one insert at a time, after a
+// reserve, and for HashMap through buildFrom. Lookups resolve Batch keys at a
+// time, the size of the edits a frame hands EditorTab::update, first with a
+// find per key and then with find_many.
+
+#include <chrono>
+#include <stdio.h>
+
+#include "../Core/HashMap.h"
+#include "../Core/SwissMap.h"
+
+Allocator* GLOBAL_HEAP;
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+constexpr static i32 Counts[] = { 100000, 1000000, 8000000 };
+constexpr static i32 Batch = 512;
+constexpr static i32 Lookups = 1 << 22;
+
+static double nanoseconds(std::chrono::steady_clock::time_point from)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - from).count();
+}
+
+template<typename Map>
+static double build(Map& map, const Array<u64>& keys, bool reserve)
+{
+	auto start = std::chrono::steady_clock::now();
+	if (reserve)
+	{
+		map.reserve(keys.size());
+	}
+
+	for (i32 i = 0; i < keys.size(); ++i)
+	{
+		map.insert_or_assign(keys[i], u64(i));
+	}
+
+	return nanoseconds(start) / 1000000.0;
+}
+
+template<typename Map>
+static void lookups(const char* name, Map& map, const Array<u64>& queries)
+{
+	u64* found[Batch];
+	u64 sum = 0;
+
+	auto singleStart = std::chrono::steady_clock::now();
+	for (i32 b = 0; b + Batch <= queries.size(); b += Batch)
+	{
+		for (i32 i = 0; i < Batch; ++i)
+		{
+			found[i] = map.find(queries[b + i]);
+		}
+
+		for (i32 i = 0; i < Batch; ++i)
+		{
+			sum += *found[i];
+		}
+	}
+	double single = nanoseconds(singleStart) / queries.size();
+
+	auto manyStart = std::chrono::steady_clock::now();
+	for (i32 b = 0; b + Batch <= queries.size(); b += Batch)
+	{
+		map.find_many(queries.data() + b, found, Batch);
+
+		for (i32 i = 0; i < Batch; ++i)
+		{
+			sum += *found[i];
+		}
+	}
+	double many = nanoseconds(manyStart) / queries.size();
+
+	printf("  %-9s find %6.1f ns | find_many %6.1f ns\n", name, single, many);
+
+	if (sum == 0)
+	{
+		printf("\n");
+	}
+}
+
+int main()
+{
+	HeapAllocator heap;
+
+	for (i32 count : Counts)
+	{
+		Xorshift rand;
+
+		Array<u64> keys(&heap);
+		Array<u64> values(&heap);
+		for (i32 i = 0; i < count; ++i)
+		{
+			keys.push_back(rand.next());
+			values.push_back(u64(i));
+		}
+
+		Array<u64> queries(&heap);
+		for (i32 i = 0; i < Lookups; ++i)
+		{
+			queries.push_back(keys[i32(rand.next() % u64(count))]);
+		}
+
+		printf("%d entries\n", count);
+
+		{
+			HashMap<u64> grown(&heap);
+			HashMap<u64> reserved(&heap);
+			HashMap<u64> built(&heap);
+
+			double grownMs = build(grown, keys, false);
+			double reservedMs = build(reserved, keys, true);
+
+			auto builtStart = std::chrono::steady_clock::now();
+			built.buildFrom(keys.data(), values.data(), count);
+			double builtMs = nanoseconds(builtStart) / 1000000.0;
+
+			printf("  HashMap   build %7.1f ms | reserve %7.1f ms | buildFrom %7.1f ms\n", grownMs, reservedMs, builtMs);
+			lookups("HashMap", built, queries);
+		}
+
+		{
+			SwissMap<u64> grown(&heap);
+			SwissMap<u64> reserved(&heap);
+
+			double grownMs = build(grown, keys, false);
+			double reservedMs = build(reserved, keys, true);
+
+			printf("  SwissMap  build %7.1f ms | reserve %7.1f ms\n", grownMs, reservedMs);
+			lookups("SwissMap", reserved, queries);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+// Chained HashMap against open addressing SwissMap.
+//
+// Both are filled to a load factor of a table of Slots slots, HashMap counting
+// its bucket heads and SwissMap its slots, with random keys the way entity ids
+// are. Insert times the fill including the growth on the way, hit looks every
+// key up in a shuffled order, miss looks up as many keys that are not there and
+// iterate sums all values.
+
+#include <chrono>
+#include <stdio.h>
+
+#include "../Core/HashMap.h"
+#include "../Core/SwissMap.h"
+
+Allocator* GLOBAL_HEAP;
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+constexpr static u32 SlotCounts[] = { 1u << 10, 1u << 14, 1u << 17, 1u << 20, 1u << 24 };
+constexpr static float LoadFactors[] = { 0.5f, 0.7f, 0.9f };
+
+static double nanoseconds(std::chrono::steady_clock::time_point from)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - from).count();
+}
+
+// Small tables are run enough times to be measurable.
+static i32 repeatsFor(i32 count)
+{
+	return count < (1 << 20) ? (1 << 22) / count : 1;
+}
+
+template<typename Map>
+static void run(const char* name, float loadFactor, const Array<u64>& keys, const Array<u64>& shuffled, const Array<u64>& missing)
+{
+	i32 count = keys.size();
+	i32 repeats = repeatsFor(count);
+
+	double insert = 0.0;
+	double hit = 0.0;
+	double miss = 0.0;
+	double iterate = 0.0;
+	u64 sum = 0;
+
+	for (i32 r = 0; r < repeats; ++r)
+	{
+		HeapAllocator heap;
+		Map map(&heap);
+
+		// a little above the target so the table stops growing just past it
+		map.set_max_load_factor(loadFactor + 0.05f);
+
+		auto insertStart = std::chrono::steady_clock::now();
+		for (i32 i = 0; i < count; ++i)
+		{
+			map.insert_or_assign(keys[i], u64(i));
+		}
+		insert += nanoseconds(insertStart);
+
+		auto hitStart = std::chrono::steady_clock::now();
+		for (u64 key : shuffled)
+		{
+			sum += *map.find(key);
+		}
+		hit += nanoseconds(hitStart);
+
+		auto missStart = std::chrono::steady_clock::now();
+		for (u64 key : missing)
+		{
+			sum += map.find(key) != nullptr;
+		}
+		miss += nanoseconds(missStart);
+
+		auto iterateStart = std::chrono::steady_clock::now();
+		for (auto& entry : map)
+		{
+			sum += entry.value;
+		}
+		iterate += nanoseconds(iterateStart);
+	}
+
+	double ops = double(count) * repeats;
+	printf("%-9s lf %.1f %9d entries | insert %6.1f | hit %6.1f | miss %6.1f | iterate %5.2f ns\n",
+		name, loadFactor, count, insert / ops, hit / ops, miss / ops, iterate / ops);
+
+	if (sum == 0)
+	{
+		printf("\n");
+	}
+}
+
+int main()
+{
+	HeapAllocator heap;
+
+	for (u32 slots : SlotCounts)
+	{
+		for (float loadFactor : LoadFactors)
+		{
+			Xorshift rand;
+			i32 count = i32(slots * loadFactor);
+
+			Array<u64> keys(&heap);
+			Array<u64> missing(&heap);
+			for (i32 i = 0; i < count; ++i)
+			{
+				keys.push_back(rand.next());
+				missing.push_back(rand.next());
+			}
+
+			Array<u64> shuffled = keys.clone();
+			for (i32 i = count - 1; i > 0; --i)
+			{
+				i32 j = i32(rand.next() % u64(i + 1));
+				u64 swap = shuffled[i];
+				shuffled[i] = shuffled[j];
+				shuffled[j] = swap;
+			}
+
+			run<HashMap<u64>>("HashMap", loadFactor, keys, shuffled, missing);
+			run<SwissMap<u64>>("SwissMap", loadFactor, keys, shuffled, missing);
+		}
+	}
+
+	return 0;
+}
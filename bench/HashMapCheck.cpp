@@ -0,0 +1,645 @@
+// Checks of the hash maps against std::unordered_map, run by bench.bat with the
+// benchmarks. Every check prints one line, the exit code is the number of
+// checks that failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
+#include "../Core/HashMap.h"
+#include "../Core/SwissMap.h"
+
+Allocator* GLOBAL_HEAP;
+
+// Heap that keeps count of what is still allocated.
+class CountingAllocator : public Allocator
+{
+public:
+	void* alloc(i32 size) override
+	{
+		++m_liveAllocations;
+		return ::malloc(size);
+	}
+
+	void free(void* block) override
+	{
+		if (block)
+		{
+			--m_liveAllocations;
+			::free(block);
+		}
+	}
+
+	void freeSizeKnown(void* block, i32) override
+	{
+		free(block);
+	}
+
+	i64 liveAllocations() const { return m_liveAllocations; }
+
+private:
+	i64 m_liveAllocations = 0;
+};
+
+// Move-only value owning a block, copied only through clone().
+struct CheckBox
+{
+	CheckBox() = default;
+	CheckBox(const CheckBox&) = delete;
+	CheckBox& operator=(const CheckBox&) = delete;
+
+	CheckBox(CheckBox&& r)
+		: allocator(r.allocator)
+		, value(r.value)
+	{
+		r.value = nullptr;
+	}
+
+	CheckBox& operator=(CheckBox&& rhs)
+	{
+		if (&rhs != this)
+		{
+			reset();
+			allocator = rhs.allocator;
+			value = rhs.value;
+			rhs.value = nullptr;
+		}
+
+		return *this;
+	}
+
+	~CheckBox()
+	{
+		reset();
+	}
+
+	CheckBox clone() const
+	{
+		CheckBox copy;
+		copy.allocator = allocator;
+		if (value)
+		{
+			copy.value = create<u64>(allocator);
+			*copy.value = *value;
+		}
+		return copy;
+	}
+
+	void reset()
+	{
+		if (value)
+		{
+			allocator->free(value);
+			value = nullptr;
+		}
+	}
+
+	Allocator* allocator = nullptr;
+	u64* value = nullptr;
+};
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+static i32 s_failures = 0;
+
+static void report(const char* name, bool ok)
+{
+	printf("%-36s %s\n", name, ok ? "ok" : "FAILED");
+	s_failures += ok ? 0 : 1;
+}
+
+// A set bit with random bits above it, at every position.
+static void checkCountTrailingZeros()
+{
+	Xorshift rand;
+
+	bool ok = true;
+	for (u32 bit = 0; bit < 64; ++bit)
+	{
+		for (i32 i = 0; i < 16; ++i)
+		{
+			u64 above = bit < 63 ? rand.next() & (~u64(0) << (bit + 1)) : 0;
+			ok = ok && countTrailingZeros((u64(1) << bit) | above) == bit;
+		}
+	}
+
+	report("count trailing zeros", ok);
+}
+
+template<typename Map>
+static bool matches(const Map& map, const std::unordered_map<u64, u64>& model)
+{
+	bool same = map.size() == i32(model.size());
+	size_t visited = 0;
+	for (const auto& entry : map)
+	{
+		auto it = model.find(entry.key);
+		same = same && it != model.end() && it->second == entry.value;
+		++visited;
+	}
+
+	return same && visited == model.size();
+}
+
+// Random inserts, erases and lookups against a std::unordered_map, on keys
+// drawn from a small range or spread out with only their high bits differing.
+// A clone taken now and then has to match the model at that point.
+template<typename Map>
+static void checkRandomOps(const char* name, float maxLoadFactor, bool clustered)
+{
+	constexpr i32 Steps = 400000;
+
+	HeapAllocator heap;
+	Xorshift rand;
+
+	Map map(&heap);
+	map.set_max_load_factor(maxLoadFactor);
+	std::unordered_map<u64, u64> model;
+
+	bool ok = true;
+	for (i32 step = 0; step < Steps; ++step)
+	{
+		u64 key = clustered ? (rand.next() % 5000) << 40 : rand.next() % 20000;
+		u64 op = rand.next() % 5;
+		if (op < 2)
+		{
+			map.insert_or_assign(key, u64(step));
+			model[key] = u64(step);
+		}
+		else if (op == 2)
+		{
+			map[key] += 1;
+			model[key] += 1;
+		}
+		else if (op == 3)
+		{
+			map.erase(key);
+			model.erase(key);
+		}
+		else
+		{
+			const u64* found = ((const Map&)map).find(key);
+			auto it = model.find(key);
+			ok = ok && (found != nullptr) == (it != model.end()) && (!found || *found == it->second);
+			ok = ok && map.contains(key) == (found != nullptr);
+		}
+
+		if (step % 50000 == 0)
+		{
+			Map copy = map.clone();
+			ok = ok && matches(copy, model);
+		}
+	}
+
+	report(name, ok && matches(map, model));
+}
+
+// Move-only values owning memory are inserted, erased, cloned and moved.
+// Every value has to keep its contents and be freed exactly once.
+template<typename Map>
+static void checkMoveOnly(const char* name)
+{
+	constexpr i32 Count = 5000;
+
+	CountingAllocator heap;
+
+	bool ok = true;
+	{
+		Map map(&heap);
+		for (i32 i = 0; i < Count; ++i)
+		{
+			CheckBox& box = map[u64(i)];
+			box.allocator = &heap;
+			box.value = create<u64>(&heap);
+			*box.value = u64(i);
+		}
+		for (i32 i = 0; i < Count; i += 2)
+		{
+			map.erase(u64(i));
+		}
+		for (i32 i = 0; i < Count / 4; ++i)
+		{
+			CheckBox box;
+			box.allocator = &heap;
+			box.value = create<u64>(&heap);
+			*box.value = u64(i * 4 + 1);
+			map.insert_or_assign(u64(i * 4 + 1), (CheckBox&&)box);
+		}
+
+		Map copy = map.clone();
+		Map moved((Map&&)copy);
+		for (const Map* each : { (const Map*)&map, (const Map*)&moved })
+		{
+			i32 visited = 0;
+			for (const auto& entry : *each)
+			{
+				ok = ok && entry.value.value && *entry.value.value == entry.key && entry.key % 2 == 1;
+				++visited;
+			}
+			ok = ok && visited == Count / 2 && each->size() == Count / 2;
+		}
+	}
+
+	report(name, ok && heap.liveAllocations() == 0);
+}
+
+// Random inserts, erases and lookups against a std::unordered_map while the
+// buckets and m_data grow a few at a time. Chains have to be whole in the
+// histogram, clones taken mid-grow have to match, and switching to growing
+// at once has to finish what is under way.
+static void checkIncrementalGrow()
+{
+	constexpr i32 Steps = 600000;
+
+	HeapAllocator heap;
+	Xorshift rand;
+
+	HashMap<u64> map(&heap);
+	map.set_incremental_rehash(true);
+	std::unordered_map<u64, u64> model;
+
+	bool ok = true;
+	for (i32 step = 0; step < Steps; ++step)
+	{
+		u64 key = rand.next() % 400000;
+		u64 op = rand.next() % 8;
+		if (op < 3)
+		{
+			map.insert_or_assign(key, u64(step));
+			model[key] = u64(step);
+		}
+		else if (op == 3)
+		{
+			map[key] += 1;
+			model[key] += 1;
+		}
+		else if (op == 4)
+		{
+			map.erase(key);
+			model.erase(key);
+		}
+		else
+		{
+			const u64* found = map.find(key);
+			auto it = model.find(key);
+			ok = ok && (found != nullptr) == (it != model.end()) && (!found || *found == it->second);
+		}
+
+		if (step % 10007 == 0)
+		{
+			HashMapHistogram histogram = map.histogram();
+			i64 entries = 0;
+			for (u32 count : histogram.probeCount)
+			{
+				entries += count;
+			}
+			ok = ok && entries == map.size();
+		}
+		if (step % 50021 == 0)
+		{
+			HashMap<u64> copy = map.clone();
+			ok = ok && matches(copy, model);
+		}
+		if (step % 100003 == 0)
+		{
+			map.set_incremental_rehash(false);
+			map.set_incremental_rehash(true);
+		}
+	}
+
+	report("hash map, incremental grow", ok && matches(map, model));
+}
+
+// A map of move-only values goes away in the middle of moving m_data, after
+// erasing entries from both blocks. Every value has to be freed exactly once.
+static void checkIncrementalMoveOnly()
+{
+	// one past a power of two, m_data has just doubled
+	constexpr i32 Count = (1 << 14) + 1;
+
+	CountingAllocator heap;
+
+	bool ok = true;
+	{
+		HashMap<CheckBox> map(&heap);
+		map.set_incremental_rehash(true);
+		for (i32 i = 0; i < Count; ++i)
+		{
+			CheckBox& box = map[u64(i)];
+			box.allocator = &heap;
+			box.value = create<u64>(&heap);
+			*box.value = u64(i);
+		}
+
+		// the newest entry, then the last one still in the old block, then one
+		// the move has taken and one it has not
+		for (u64 key : { u64(Count - 1), u64(Count - 2), u64(0), u64(Count / 2) })
+		{
+			map.erase(key);
+		}
+
+		for (i32 i = 0; i < Count; ++i)
+		{
+			const CheckBox* box = map.find(u64(i));
+			bool erased = i == Count - 1 || i == Count - 2 || i == 0 || i == Count / 2;
+			ok = ok && (box == nullptr) == erased && (!box || *box->value == u64(i));
+		}
+		ok = ok && map.size() == Count - 4;
+	}
+
+	report("hash map, move-only mid grow", ok && heap.liveAllocations() == 0);
+}
+
+// find_many against a find per key, for batches of every length around the
+// prefetch distance, with keys present, missing and repeated. Growing maps
+// are checked mid-grow too, where HashMap falls back to find.
+template<typename Map>
+static void checkFindMany(const char* name, bool incremental)
+{
+	constexpr i32 Keys = 50000;
+	constexpr i32 Queries = 4096;
+
+	HeapAllocator heap;
+	Xorshift rand;
+
+	Map map(&heap);
+	if constexpr (!std::is_same<Map, SwissMap<u64>>::value)
+	{
+		map.set_incremental_rehash(incremental);
+	}
+
+	Array<u64> keys(&heap);
+	Array<u64> queries(&heap);
+	Array<u64*> found(&heap);
+	found.resize(Queries);
+
+	bool ok = true;
+	for (i32 i = 0; i < Keys; ++i)
+	{
+		keys.push_back(rand.next());
+		map.insert_or_assign(keys.back(), u64(i));
+
+		// a few batches land while the last grow is still under way
+		if (i % 997 != 0)
+		{
+			continue;
+		}
+
+		queries.clear();
+		for (i32 q = 0; q < Queries; ++q)
+		{
+			u64 pick = rand.next() % 3;
+			queries.push_back(pick == 0 ? rand.next() : keys[i32(rand.next() % u64(keys.size()))]);
+		}
+
+		for (i32 count : { 0, 1, 7, 8, 9, 16, 17, 33, Queries })
+		{
+			map.find_many(queries.data(), found.data(), count);
+			for (i32 q = 0; q < count; ++q)
+			{
+				ok = ok && found[q] == map.find(queries[q]);
+			}
+		}
+	}
+
+	report(name, ok);
+}
+
+// Inserting up to what reserve() sized for moves no entry, so a value found
+// before the inserts is still where it was.
+template<typename Map>
+static void checkReserve(const char* name)
+{
+	HeapAllocator heap;
+	Xorshift rand;
+
+	bool ok = true;
+	for (i32 count : { 1, 15, 16, 1000, 100000 })
+	{
+		Map map(&heap);
+		map.insert_or_assign(1, 1);
+		map.reserve(count);
+
+		const u64* first = map.find(1);
+		for (i32 i = 1; i < count; ++i)
+		{
+			map.insert_or_assign(rand.next() | 2, u64(i));
+		}
+
+		ok = ok && map.find(1) == first && *first == 1 && map.size() == count;
+	}
+
+	report(name, ok);
+}
+
+// buildFrom against inserts of the same entries, on an empty map and over
+// one already holding others. The built map takes writes like any other.
+static void checkBuildFrom()
+{
+	HeapAllocator heap;
+	Xorshift rand;
+
+	bool ok = true;
+	for (i32 count : { 0, 1, 11, 12, 1000, 100000 })
+	{
+		Array<u64> keys(&heap);
+		Array<u64> values(&heap);
+		std::unordered_map<u64, u64> model;
+		for (i32 i = 0; i < count; ++i)
+		{
+			keys.push_back(rand.next());
+			values.push_back(rand.next());
+			model[keys.back()] = values.back();
+		}
+
+		for (bool overwrite : { false, true })
+		{
+			HashMap<u64> map(&heap);
+			for (i32 i = 0; overwrite && i < 5000; ++i)
+			{
+				map.insert_or_assign(rand.next(), 0);
+			}
+
+			map.buildFrom(keys.data(), values.data(), count);
+			ok = ok && matches(map, model);
+
+			std::unordered_map<u64, u64> written = model;
+			for (i32 i = 0; i < 2000; ++i)
+			{
+				u64 key = i % 2 == 0 || count == 0 ? rand.next() : keys[i32(rand.next() % u64(count))];
+				if (i % 3 == 0)
+				{
+					map.erase(key);
+					written.erase(key);
+				}
+				else
+				{
+					map.insert_or_assign(key, u64(i));
+					written[key] = u64(i);
+				}
+			}
+			ok = ok && matches(map, written);
+		}
+	}
+
+	report("hash map, buildFrom", ok);
+}
+
+using StringMap = KeyedHashMap<StringView, u64>;
+
+static bool matches(const StringMap& map, const std::unordered_map<std::string, u64>& model)
+{
+	bool same = map.size() == i32(model.size());
+	size_t visited = 0;
+	for (const auto& entry : map)
+	{
+		auto it = model.find(std::string(entry.key.data, entry.key.size));
+		same = same && it != model.end() && it->second == entry.value;
+		++visited;
+	}
+	for (const auto& entry : model)
+	{
+		const u64* found = map.find(StringView(entry.first.data(), u32(entry.first.size())));
+		same = same && found && *found == entry.second;
+	}
+
+	return same && visited == model.size();
+}
+
+// Names as keys against a std::unordered_map of std::string. Each name is
+// written into one buffer that is overwritten after every operation, so the
+// map must hold its own copies of the characters, and so must clones and
+// moved maps. Every copy is freed with the map.
+static void checkStringKeys(const char* name, bool incremental)
+{
+	constexpr i32 Steps = 200000;
+
+	CountingAllocator heap;
+	Xorshift rand;
+
+	bool ok = true;
+	{
+		StringMap map(&heap);
+		map.set_incremental_rehash(incremental);
+		std::unordered_map<std::string, u64> model;
+
+		char buffer[32];
+		for (i32 step = 0; step < Steps; ++step)
+		{
+			i32 length = snprintf(buffer, sizeof(buffer), "Entity_%llu", (unsigned long long)(rand.next() % 30000));
+			StringView key(buffer, u32(length));
+
+			u64 op = rand.next() % 4;
+			if (op < 2)
+			{
+				map.insert_or_assign(key, u64(step));
+				model[buffer] = u64(step);
+			}
+			else if (op == 2)
+			{
+				map.erase(key);
+				model.erase(buffer);
+			}
+			else
+			{
+				const u64* found = map.find(key);
+				auto it = model.find(buffer);
+				ok = ok && (found != nullptr) == (it != model.end()) && (!found || *found == it->second);
+			}
+
+			memset(buffer, 'x', sizeof(buffer));
+
+			if (step % 40000 == 0)
+			{
+				StringMap copy = map.clone();
+				StringMap moved((StringMap&&)copy);
+				ok = ok && matches(moved, model);
+			}
+		}
+
+		ok = ok && matches(map, model);
+	}
+
+	report(name, ok && heap.liveAllocations() == 0);
+}
+
+// buildFrom takes names from buffers that go away right after, the empty name
+// among them.
+static void checkStringBuildFrom()
+{
+	CountingAllocator heap;
+
+	bool ok = true;
+	{
+		StringMap map(&heap);
+		{
+			std::string names[] = { "Root", "Camera", "", "Light_0" };
+			StringView keys[4];
+			u64 values[4];
+			for (i32 i = 0; i < 4; ++i)
+			{
+				keys[i] = StringView(names[i].data(), u32(names[i].size()));
+				values[i] = u64(i + 1);
+			}
+			map.buildFrom(keys, values, 4);
+
+			for (std::string& name : names)
+			{
+				name.assign(name.size(), 'x');
+			}
+		}
+
+		ok = ok && *map.find("Root") == 1 && *map.find("Camera") == 2 && *map.find("") == 3 && *map.find("Light_0") == 4;
+		ok = ok && !map.contains("Light") && map.size() == 4;
+
+		map["Light_1"] = 5;
+		map.erase("");
+		ok = ok && *map.find("Light_1") == 5 && !map.contains("") && map.size() == 4;
+	}
+
+	report("string keys, buildFrom", ok && heap.liveAllocations() == 0);
+}
+
+int main()
+{
+	checkCountTrailingZeros();
+
+	checkRandomOps<SwissMap<u64>>("swiss map", 0.875f, false);
+	checkRandomOps<SwissMap<u64>>("swiss map, 0.95 load", 0.95f, false);
+	checkRandomOps<SwissMap<u64>>("swiss map, clustered keys", 0.875f, true);
+	checkRandomOps<HashMap<u64>>("hash map", 0.7f, false);
+	checkRandomOps<HashMap<u64>>("hash map, 0.95 load", 0.95f, false);
+	checkRandomOps<HashMap<u64>>("hash map, clustered keys", 0.7f, true);
+
+	checkMoveOnly<SwissMap<CheckBox>>("swiss map, move-only values");
+	checkMoveOnly<HashMap<CheckBox>>("hash map, move-only values");
+
+	checkIncrementalGrow();
+	checkIncrementalMoveOnly();
+
+	checkFindMany<SwissMap<u64>>("swiss map, find_many", false);
+	checkFindMany<HashMap<u64>>("hash map, find_many", false);
+	checkFindMany<HashMap<u64>>("hash map, find_many mid grow", true);
+	checkReserve<SwissMap<u64>>("swiss map, reserve");
+	checkReserve<HashMap<u64>>("hash map, reserve");
+	checkBuildFrom();
+
+	checkStringKeys("string keys", false);
+	checkStringKeys("string keys, incremental grow", true);
+	checkStringBuildFrom();
+
+	return s_failures;
+}
@@ -0,0 +1,90 @@
+// Single insert stalls while a HashMap grows from empty to Count entries.
+//
+// Every insert is timed on its own. In place, the slowest ones are where the
+// bucket heads double (at 0.7 of each power of two) and where m_data itself
+// reallocates (at each power of two), printed with the size the map had when
+// they happened. Incremental, both move a few per insert instead.
+
+#include <chrono>
+#include <stdio.h>
+
+#include "../Core/HashMap.h"
+
+Allocator* GLOBAL_HEAP;
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+constexpr static i32 Count = 2 << 20;
+constexpr static i32 Worst = 4;
+
+struct Stall
+{
+	double ns;
+	i32 size;
+};
+
+static void run(const char* name, bool incremental, const Array<u64>& keys)
+{
+	HeapAllocator heap;
+	HashMap<u64> map(&heap);
+	map.set_incremental_rehash(incremental);
+
+	Stall worst[Worst] = {};
+	double total = 0.0;
+
+	for (i32 i = 0; i < Count; ++i)
+	{
+		auto start = std::chrono::steady_clock::now();
+		map.insert_or_assign(keys[i], u64(i));
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		total += ns;
+
+		// kept sorted, slowest first
+		for (i32 w = 0; w < Worst; ++w)
+		{
+			if (ns > worst[w].ns)
+			{
+				memmove(&worst[w + 1], &worst[w], (Worst - w - 1) * sizeof(Stall));
+				worst[w] = Stall{ ns, i };
+				break;
+			}
+		}
+	}
+
+	printf("%-12s insert %6.1f ns |", name, total / Count);
+	for (const Stall& stall : worst)
+	{
+		printf(" %8.0f us at %8d |", stall.ns / 1000.0, stall.size);
+	}
+	printf("\n");
+}
+
+int main()
+{
+	HeapAllocator heap;
+	Xorshift rand;
+
+	Array<u64> keys(&heap);
+	for (i32 i = 0; i < Count; ++i)
+	{
+		keys.push_back(rand.next());
+	}
+
+	printf("%d inserts, slowest %d\n", Count, Worst);
+
+	run("in place", false, keys);
+	run("incremental", true, keys);
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+// HashMap lookups under each hash policy for keys with and without structure.
+//
+// Random keys are what nextKey() hands out. Sequential keys are tab and
+// viewport ids, strided keys have their low bits fixed the way handles and
+// aligned addresses do and high keys differ only above bit 32. Each row fills
+// a map with Count keys and looks them all up in a shuffled order, next to the
+// histogram of the chains it ended up with.
+
+#include <chrono>
+#include <stdio.h>
+
+#include "../Core/HashMap.h"
+
+Allocator* GLOBAL_HEAP;
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+// Small enough that the cases putting every key in one chain still finish.
+constexpr static i32 Count = 1 << 16;
+
+static double nanoseconds(std::chrono::steady_clock::time_point from)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - from).count();
+}
+
+template<typename Hash>
+static void run(const char* pattern, const char* policy, const Array<u64>& keys, const Array<u64>& shuffled)
+{
+	HeapAllocator heap;
+	HashMap<u64, Hash> map(&heap);
+
+	auto insertStart = std::chrono::steady_clock::now();
+	for (i32 i = 0; i < keys.size(); ++i)
+	{
+		map.insert_or_assign(keys[i], u64(i));
+	}
+	double insert = nanoseconds(insertStart) / keys.size();
+
+	u64 sum = 0;
+	auto hitStart = std::chrono::steady_clock::now();
+	for (u64 key : shuffled)
+	{
+		sum += *map.find(key);
+	}
+	double hit = nanoseconds(hitStart) / shuffled.size();
+
+	HashMapHistogram h = map.histogram();
+	u32 longer = 0;
+	for (i32 i = 4; i < HashMapHistogram::Bins; ++i)
+	{
+		longer += h.chainLength[i];
+	}
+
+	printf("%-10s %-8s | insert %8.1f | hit %8.1f ns | probes %8.2f | longest %7d | chains 0:%u 1:%u 2:%u 3:%u 4+:%u\n",
+		pattern, policy, insert, hit, h.averageProbes, h.longestChain,
+		h.chainLength[0], h.chainLength[1], h.chainLength[2], h.chainLength[3], longer);
+
+	if (sum == 0)
+	{
+		printf("\n");
+	}
+}
+
+template<typename MakeKey>
+static void runPattern(const char* pattern, MakeKey makeKey)
+{
+	HeapAllocator heap;
+	Xorshift rand;
+
+	Array<u64> keys(&heap);
+	for (i32 i = 0; i < Count; ++i)
+	{
+		keys.push_back(makeKey(i, rand));
+	}
+
+	Array<u64> shuffled = keys.clone();
+	for (i32 i = Count - 1; i > 0; --i)
+	{
+		i32 j = i32(rand.next() % u64(i + 1));
+		u64 swap = shuffled[i];
+		shuffled[i] = shuffled[j];
+		shuffled[j] = swap;
+	}
+
+	run<HashIdentity>(pattern, "identity", keys, shuffled);
+	run<HashMix>(pattern, "mix", keys, shuffled);
+	run<HashMetro>(pattern, "metro", keys, shuffled);
+}
+
+int main()
+{
+	printf("%d keys\n", Count);
+
+	runPattern("random", [](i32, Xorshift& rand) { return rand.next(); });
+	runPattern("sequential", [](i32 i, Xorshift&) { return u64(i) + 1; });
+	runPattern("strided", [](i32 i, Xorshift&) { return u64(i) << 12; });
+	runPattern("high", [](i32 i, Xorshift&) { return u64(i) << 32; });
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+// Long editing session against a Truth with a bounded undo history.
+//
+// Objects objects are edited, added, erased, undone and redone at random for
+// Iterations steps, with some transactions abandoned halfway. Undoing and then
+// editing drops the redo entries, the history policy drops the oldest units.
+// Every Sample steps the live allocations of the heap are printed, they should
+// settle after the history fills up and stay flat from there on.
+
+#include <chrono>
+#include <stdio.h>
+
+#include "../TruthView.h"
+
+Allocator* GLOBAL_HEAP;
+
+// Heap that keeps count of what is still allocated.
+class CountingAllocator : public Allocator
+{
+public:
+	void* alloc(i32 size) override
+	{
+		u64* block = (u64*)::malloc(size + sizeof(u64) * 2);
+		block[0] = u64(size);
+		++m_liveAllocations;
+		m_liveBytes += u64(size);
+		return block + 2;
+	}
+
+	void free(void* block) override
+	{
+		if (block)
+		{
+			u64* header = (u64*)block - 2;
+			--m_liveAllocations;
+			m_liveBytes -= header[0];
+			::free(header);
+		}
+	}
+
+	void freeSizeKnown(void* block, i32) override
+	{
+		free(block);
+	}
+
+	i64 liveAllocations() const { return m_liveAllocations; }
+	u64 liveBytes() const { return m_liveBytes; }
+
+private:
+	i64 m_liveAllocations = 0;
+	u64 m_liveBytes = 0;
+};
+
+struct BenchObject : TruthObject
+{
+	u64 typeId() const override { return 1; }
+
+	TruthObject* clone(Allocator* a) const override
+	{
+		BenchObject* copy = create<BenchObject>(a);
+		copy->root = root;
+		copy->value = value;
+		return copy;
+	}
+
+	u64 contentHash() const override { return truth::mixHash(value); }
+
+	u64 value = 0;
+};
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+constexpr static i32 Objects = 20000;
+constexpr static i32 Iterations = 200000;
+constexpr static i32 Sample = 20000;
+constexpr static i32 MaxUndoUnits = 300;
+
+int main()
+{
+	CountingAllocator heap;
+	Xorshift rand;
+
+	Truth truth(&heap);
+	HistoryPolicy policy;
+	policy.maxUndoUnits = MaxUndoUnits;
+	truth.setHistoryPolicy(policy);
+
+	Array<truth::Key> keys(&heap);
+	Transaction load = truth.openTransaction();
+	for (i32 i = 0; i < Objects; ++i)
+	{
+		truth::Key key{ rand.next() };
+		keys.push_back(key);
+		truth.add(load, key, create<BenchObject>(&heap));
+	}
+	truth.commit(load);
+
+	printf("%d objects, %d steps, at most %d undo units\n", Objects, Iterations, MaxUndoUnits);
+
+	auto start = std::chrono::steady_clock::now();
+	for (i32 step = 1; step <= Iterations; ++step)
+	{
+		u64 op = rand.next() % 20;
+
+		if (op < 3)
+		{
+			truth.undo();
+		}
+		else if (op < 4)
+		{
+			// redo
+			if (truth.getReadIndex() + 1 < truth.undoUnits())
+			{
+				truth.setReadIndex(truth.getReadIndex() + 1);
+			}
+		}
+		else
+		{
+			Transaction tx = truth.openTransaction();
+			i32 edits = 1 + i32(rand.next() % 4);
+			for (i32 e = 0; e < edits; ++e)
+			{
+				i32 slot = i32(rand.next() % u64(keys.size()));
+
+				// keys an undo took away are left alone, so head keeps its size
+				if (!truth.read(tx, keys[slot]))
+				{
+					continue;
+				}
+
+				if (op < 6)
+				{
+					// erase and add under a new key
+					truth.erase(tx, keys[slot]);
+					keys[slot] = truth::Key{ rand.next() };
+					truth.add(tx, keys[slot], create<BenchObject>(&heap));
+				}
+				else
+				{
+					((BenchObject*)truth.edit(tx, keys[slot]))->value = rand.next();
+				}
+			}
+
+			if (op == 19 || !truth.commit(tx))
+			{
+				truth.drop(tx);
+			}
+		}
+
+		truth.collect();
+
+		if (step % Sample == 0)
+		{
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			printf("step %7d | %5.1f s | %6u objects in head | live allocations %8lld | live %8.1f KB | undo units %4d\n",
+				step, seconds, truth.head().s->size(), (long long)heap.liveAllocations(), double(heap.liveBytes()) / 1024.0, truth.undoUnits());
+		}
+	}
+
+	return 0;
+}
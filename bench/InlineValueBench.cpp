@@ -0,0 +1,225 @@
+// Positions behind a TruthObject pointer each (Truth) against positions held
+// inline in the leaves (TruthPodMap).
+//
+// Both hold Count positions under random keys. Lookups resolve every key in a
+// shuffled order, the bulk pass sums all positions in key order and a version
+// overwrites EditsPerVersion positions the way a drag of a selection does.
+
+#include <chrono>
+#include <stdio.h>
+
+#include "../TruthPodMap.h"
+#include "../TruthView.h"
+
+Allocator* GLOBAL_HEAP;
+
+struct Position
+{
+	float x;
+	float y;
+	float z;
+	u32 flags;
+};
+
+struct PositionObject : TruthObject
+{
+	u64 typeId() const override { return 1; }
+
+	TruthObject* clone(Allocator* a) const override
+	{
+		PositionObject* copy = create<PositionObject>(a);
+		copy->root = root;
+		copy->position = position;
+		return copy;
+	}
+
+	u64 contentHash() const override
+	{
+		u64 bits[2];
+		memcpy(bits, &position, sizeof(bits));
+		return truth::mixHash(bits[0] ^ truth::mixHash(bits[1]));
+	}
+
+	Position position = {};
+};
+
+// Counts bytes handed out, to compare what a version allocates.
+struct CountingAllocator : Allocator
+{
+	void* alloc(i32 size) override
+	{
+		bytes += u64(size);
+		return ::malloc(size);
+	}
+
+	void free(void* block) override { ::free(block); }
+	void freeSizeKnown(void* block, i32) override { ::free(block); }
+
+	u64 bytes = 0;
+};
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+constexpr static i32 Count = 1000000;
+constexpr static i32 EditsPerVersion = 1000;
+constexpr static i32 Versions = 200;
+
+static double nanoseconds(std::chrono::steady_clock::time_point from)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - from).count();
+}
+
+static void report(const char* layout, double lookup, double bulk, double version, u64 bytes)
+{
+	printf("%-8s lookup %6.1f ns | bulk %5.2f ns per position | version %8.1f us %9llu bytes\n",
+		layout, lookup, bulk, version, (unsigned long long)bytes);
+}
+
+static void runPointer(const Array<truth::Key>& keys, const Array<truth::Key>& shuffled)
+{
+	CountingAllocator heap;
+	Xorshift rand;
+
+	Array<TruthObject*> objects(&heap);
+	for (i32 i = 0; i < Count; ++i)
+	{
+		PositionObject* object = create<PositionObject>(&heap);
+		object->position = Position{ float(i), 1.0f, 2.0f, 0 };
+		objects.push_back(object);
+	}
+
+	Truth truth(&heap);
+	Transaction load = truth.openTransaction();
+	truth.addMany(load, keys.data(), objects.data(), u32(keys.size()));
+	truth.commit(load);
+
+	ReadOnlySnapshot snap = truth.head();
+
+	float sum = 0.0f;
+	auto lookupStart = std::chrono::steady_clock::now();
+	for (truth::Key key : shuffled)
+	{
+		sum += ((const PositionObject*)truth.read(snap, key))->position.x;
+	}
+	double lookup = nanoseconds(lookupStart) / Count;
+
+	auto bulkStart = std::chrono::steady_clock::now();
+	snap.s->forEach([&](truth::Key, const TruthObject* object)
+	{
+		sum += ((const PositionObject*)object)->position.y;
+	});
+	double bulk = nanoseconds(bulkStart) / Count;
+
+	u64 bytesBefore = heap.bytes;
+	auto versionStart = std::chrono::steady_clock::now();
+	for (i32 v = 0; v < Versions; ++v)
+	{
+		Transaction tx = truth.openTransaction();
+		for (i32 e = 0; e < EditsPerVersion; ++e)
+		{
+			((PositionObject*)truth.edit(tx, keys[i32(rand.next() % Count)]))->position.x += 1.0f;
+		}
+		truth.commit(tx);
+		truth.collect();
+	}
+	double version = nanoseconds(versionStart) / 1000.0 / Versions;
+
+	report("pointer", lookup, bulk, version, (heap.bytes - bytesBefore) / Versions);
+	if (sum == 0.0f)
+	{
+		printf("\n");
+	}
+}
+
+static void runInline(const Array<truth::Key>& keys, const Array<truth::Key>& shuffled)
+{
+	CountingAllocator heap;
+	Xorshift rand;
+
+	TruthPodMap<Position> positions(&heap);
+	for (i32 i = 0; i < Count; ++i)
+	{
+		positions.set(keys[i], Position{ float(i), 1.0f, 2.0f, 0 });
+	}
+
+	float sum = 0.0f;
+	auto lookupStart = std::chrono::steady_clock::now();
+	for (truth::Key key : shuffled)
+	{
+		sum += positions.find(key)->x;
+	}
+	double lookup = nanoseconds(lookupStart) / Count;
+
+	auto bulkStart = std::chrono::steady_clock::now();
+	positions.forEachChunk([&](const u64*, const Position* values, u32 count)
+	{
+		for (u32 i = 0; i < count; ++i)
+		{
+			sum += values[i].y;
+		}
+	});
+	double bulk = nanoseconds(bulkStart) / Count;
+
+	// each version is a clone written to while the previous one is dropped,
+	// the same lifetime Truth gives a committed snapshot
+	u64 bytesBefore = heap.bytes;
+	auto versionStart = std::chrono::steady_clock::now();
+	for (i32 v = 0; v < Versions; ++v)
+	{
+		TruthPodMap<Position> next = positions.clone();
+		for (i32 e = 0; e < EditsPerVersion; ++e)
+		{
+			truth::Key key = keys[i32(rand.next() % Count)];
+			Position p = *next.find(key);
+			p.x += 1.0f;
+			next.set(key, p);
+		}
+		positions = (TruthPodMap<Position>&&)next;
+	}
+	double version = nanoseconds(versionStart) / 1000.0 / Versions;
+
+	report("inline", lookup, bulk, version, (heap.bytes - bytesBefore) / Versions);
+	if (sum == 0.0f)
+	{
+		printf("\n");
+	}
+}
+
+int main()
+{
+	HeapAllocator heap;
+	Xorshift rand;
+
+	Array<truth::Key> keys(&heap);
+	for (i32 i = 0; i < Count; ++i)
+	{
+		keys.push_back(truth::Key{ rand.next() });
+	}
+
+	Array<truth::Key> shuffled = keys.clone();
+	for (i32 i = Count - 1; i > 0; --i)
+	{
+		i32 j = i32(rand.next() % u64(i + 1));
+		truth::Key swap = shuffled[i];
+		shuffled[i] = shuffled[j];
+		shuffled[j] = swap;
+	}
+
+	printf("%d positions, versions of %d edits\n", Count, EditsPerVersion);
+
+	runPointer(keys, shuffled);
+	runInline(keys, shuffled);
+
+	return 0;
+}
@@ -0,0 +1,153 @@
+// Commit and diff cost of random keys against partitioned keys (truth::partitionKey).
+//
+// A scene of Entities entities is spread over Roots roots. Every commit edits
+// EditsPerCommit entities of one root, the way a tab edits its own scene. The
+// diff pass then asks for one root's changes across many commits, the way a
+// tab catches up with head.
+
+#include <chrono>
+#include <stdio.h>
+
+#include "../TruthView.h"
+
+Allocator* GLOBAL_HEAP;
+
+struct BenchObject : TruthObject
+{
+	u64 typeId() const override { return 1; }
+
+	TruthObject* clone(Allocator* a) const override
+	{
+		BenchObject* copy = create<BenchObject>(a);
+		copy->root = root;
+		copy->value = value;
+		return copy;
+	}
+
+	u64 contentHash() const override { return truth::mixHash(value + root.asU64); }
+
+	u64 value = 0;
+};
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+constexpr static i32 Entities = 200000;
+constexpr static i32 Roots = 64;
+constexpr static i32 EditsPerCommit = 16;
+constexpr static i32 Commits = 2000;
+
+struct RootFilter : TruthDiffVisitor
+{
+	truth::Key root;
+	bool partitioned;
+	u64 ranges = 0;
+	u64 found = 0;
+
+	bool visitRange(u64 first, u64 last)
+	{
+		++ranges;
+		return !partitioned || (truth::partitionFirst(root) <= last && first <= truth::partitionLast(root));
+	}
+
+	void onEdit(truth::Key, TruthObject*, TruthObject* after)
+	{
+		found += after->root == root;
+	}
+};
+
+static double microseconds(std::chrono::steady_clock::time_point from)
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - from).count();
+}
+
+static void run(bool partitioned)
+{
+	HeapAllocator heap;
+	Xorshift rand;
+
+	truth::Key roots[Roots];
+	for (truth::Key& root : roots)
+	{
+		root.asU64 = rand.next();
+	}
+
+	Array<truth::Key> keys(&heap);
+	Array<TruthObject*> objects(&heap);
+	for (i32 i = 0; i < Entities; ++i)
+	{
+		truth::Key root = roots[i % Roots];
+		truth::Key key = partitioned ? truth::partitionKey(root, u64(i)) : truth::Key{ rand.next() };
+
+		BenchObject* object = create<BenchObject>(&heap);
+		object->root = root;
+		keys.push_back(key);
+		objects.push_back(object);
+	}
+
+	Truth truth(&heap);
+	Transaction load = truth.openTransaction();
+	truth.addMany(load, keys.data(), objects.data(), u32(keys.size()));
+	truth.commit(load);
+
+	ReadOnlySnapshot start = truth.head();
+	truth.retain(start);
+
+	u64 bytes = 0;
+	auto commitStart = std::chrono::steady_clock::now();
+	for (i32 c = 0; c < Commits; ++c)
+	{
+		i32 root = c % Roots;
+		ReadOnlySnapshot before = truth.head();
+
+		Transaction tx = truth.openTransaction();
+		for (i32 e = 0; e < EditsPerCommit; ++e)
+		{
+			i32 entity = i32(rand.next() % (Entities / Roots)) * Roots + root;
+			((BenchObject*)truth.edit(tx, keys[entity]))->value = rand.next();
+		}
+		truth.commit(tx);
+
+		bytes += TruthMap::bytesAdded(before.s, truth.head().s);
+		truth.collect();
+	}
+	double commitTime = microseconds(commitStart) / Commits;
+
+	RootFilter filter;
+	filter.root = roots[0];
+	filter.partitioned = partitioned;
+
+	auto diffStart = std::chrono::steady_clock::now();
+	diff(start.s, truth.head().s, filter);
+	double diffTime = microseconds(diffStart);
+
+	printf("%-12s commit %8.1f us %8llu bytes path copied | one root diff %9.1f us %8llu ranges %6llu edits\n",
+		partitioned ? "partitioned" : "random",
+		commitTime,
+		(unsigned long long)(bytes / Commits),
+		diffTime,
+		(unsigned long long)filter.ranges,
+		(unsigned long long)filter.found);
+
+	truth.release(start);
+}
+
+int main()
+{
+	printf("%d entities over %d roots, %d commits of %d edits to one root each\n", Entities, Roots, Commits, EditsPerCommit);
+
+	run(false);
+	run(true);
+
+	return 0;
+}
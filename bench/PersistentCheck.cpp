@@ -0,0 +1,451 @@
+// Checks of the persistent containers against std containers, run by bench.bat
+// with the benchmarks. Every check prints one line, the exit code is the
+// number of checks that failed.
+
+#include <iterator>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "../Core/Hash.h"
+#include "../Core/PersistentArray.h"
+#include "../Core/PersistentHashMap.h"
+#include "../TruthPodMap.h"
+
+Allocator* GLOBAL_HEAP;
+
+// Heap that keeps count of what is still allocated.
+class CountingAllocator : public Allocator
+{
+public:
+	void* alloc(i32 size) override
+	{
+		++m_liveAllocations;
+		return ::malloc(size);
+	}
+
+	void free(void* block) override
+	{
+		if (block)
+		{
+			--m_liveAllocations;
+			::free(block);
+		}
+	}
+
+	void freeSizeKnown(void* block, i32) override
+	{
+		free(block);
+	}
+
+	i64 liveAllocations() const { return m_liveAllocations; }
+
+private:
+	i64 m_liveAllocations = 0;
+};
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+static i32 s_failures = 0;
+
+static void report(const char* name, bool ok)
+{
+	printf("%-28s %s\n", name, ok ? "ok" : "FAILED");
+	s_failures += ok ? 0 : 1;
+}
+
+// Every way through array gives the elements of model, and contentHash the
+// sum it documents.
+static bool matches(const PersistentArray<u64>& array, const std::vector<u64>& model, Xorshift& rand)
+{
+	if (array.size() != i32(model.size()))
+	{
+		return false;
+	}
+
+	bool same = true;
+	size_t i = 0;
+	for (u64 item : array)
+	{
+		same = same && i < model.size() && item == model[i];
+		++i;
+	}
+	same = same && i == model.size();
+
+	size_t chunked = 0;
+	array.forEachChunk([&](const u64* items, i32 count)
+	{
+		for (i32 k = 0; k < count; ++k)
+		{
+			same = same && chunked < model.size() && items[k] == model[chunked];
+			++chunked;
+		}
+	});
+	same = same && chunked == model.size();
+
+	for (i32 k = 0; k < 16 && !model.empty(); ++k)
+	{
+		size_t at = size_t(rand.next() % model.size());
+		same = same && array[i32(at)] == model[at];
+	}
+
+	u64 hash = 0;
+	u64 scale = 1;
+	for (u64 item : model)
+	{
+		hash += scale * HashMix::hash(item);
+		scale *= PersistentArray<u64>::Multiplier;
+	}
+
+	return same && array.contentHash(HashMix::hash) == hash;
+}
+
+// Random inserts, erases and sets against a std::vector, keeping a clone every
+// few hundred steps that later writes must not reach. Draining the array and
+// dropping the clones has to give back every node.
+static void checkPersistentArray()
+{
+	constexpr i32 Steps = 200000;
+
+	CountingAllocator heap;
+	Xorshift rand;
+	bool ok = true;
+
+	{
+		PersistentArray<u64> array(&heap);
+		std::vector<u64> model;
+		std::vector<PersistentArray<u64>> clones;
+		std::vector<std::vector<u64>> cloneModels;
+
+		for (i32 step = 0; step < Steps; ++step)
+		{
+			u64 op = rand.next() % 10;
+			u64 value = rand.next();
+			if (op == 0)
+			{
+				array.push_back(value);
+				model.push_back(value);
+			}
+			else if (op < 5 || model.empty())
+			{
+				size_t at = size_t(rand.next() % (model.size() + 1));
+				array.insert(i32(at), value);
+				model.insert(model.begin() + at, value);
+			}
+			else if (op < 8)
+			{
+				size_t at = size_t(rand.next() % model.size());
+				array.erase(i32(at));
+				model.erase(model.begin() + at);
+			}
+			else
+			{
+				size_t at = size_t(rand.next() % model.size());
+				array.set(i32(at), value);
+				model[at] = value;
+			}
+
+			if (step % 997 == 0)
+			{
+				clones.push_back(array.clone());
+				cloneModels.push_back(model);
+			}
+			if (step % 5000 == 0)
+			{
+				ok = ok && matches(array, model, rand);
+			}
+		}
+
+		for (size_t c = 0; c < clones.size(); ++c)
+		{
+			ok = ok && matches(clones[c], cloneModels[c], rand);
+		}
+
+		while (!model.empty())
+		{
+			size_t at = size_t(rand.next() % model.size());
+			array.erase(i32(at));
+			model.erase(model.begin() + at);
+			if (model.size() % 1000 == 0)
+			{
+				ok = ok && matches(array, model, rand);
+			}
+		}
+	}
+
+	report("persistent array", ok && heap.liveAllocations() == 0);
+}
+
+using ListMap = PersistentHashMap<PersistentArray<u64>>;
+using ListModel = std::map<u64, std::vector<u64>>;
+
+static bool matches(const ListMap& map, const ListModel& model)
+{
+	if (map.size() != i32(model.size()))
+	{
+		return false;
+	}
+
+	bool same = true;
+	size_t visited = 0;
+	for (const ListMap::Entry& entry : map)
+	{
+		auto it = model.find(entry.key);
+		same = same && it != model.end() && entry.value.size() == i32(it->second.size());
+		for (i32 i = 0; same && i < entry.value.size(); ++i)
+		{
+			same = entry.value[i] == it->second[i];
+		}
+		++visited;
+	}
+	same = same && visited == model.size();
+
+	for (const auto& entry : model)
+	{
+		same = same && map.contains(entry.first) && map.find(entry.first)->size() == i32(entry.second.size());
+	}
+
+	return same;
+}
+
+// Random appends, assignments and erases of lists under keys against a
+// std::map, the way instantiatedRoots is used. A few keys agree in their low
+// bits or in all but the top one, so they share nodes down to the last level.
+// Clones kept along the way must not see later writes, and draining the map
+// and dropping the clones has to give back every node.
+static void checkPersistentHashMap()
+{
+	constexpr i32 Keys = 400;
+	constexpr i32 Steps = 100000;
+
+	CountingAllocator heap;
+	Xorshift rand;
+	bool ok = true;
+
+	{
+		std::vector<u64> keys;
+		for (i32 i = 0; i < Keys; ++i)
+		{
+			u64 key = rand.next();
+			if (i % 50 == 0)
+			{
+				key &= 0xffff;
+			}
+			else if (i % 50 == 1)
+			{
+				key = keys.back() ^ (u64(1) << 63);
+			}
+			keys.push_back(key);
+		}
+
+		ListMap map(&heap);
+		ListModel model;
+		std::vector<ListMap> clones;
+		std::vector<ListModel> cloneModels;
+
+		for (i32 step = 0; step < Steps; ++step)
+		{
+			u64 key = keys[size_t(rand.next() % keys.size())];
+			u64 op = rand.next() % 6;
+			if (op < 3)
+			{
+				PersistentArray<u64>* list = map.find(key);
+				if (list == nullptr)
+				{
+					list = &map[key];
+					list->set_allocator(&heap);
+				}
+				list->push_back(u64(step));
+				model[key].push_back(u64(step));
+			}
+			else if (op < 5)
+			{
+				map.erase(key);
+				model.erase(key);
+			}
+			else
+			{
+				PersistentArray<u64> list(&heap);
+				list.push_back(u64(step));
+				map.insert_or_assign(key, (PersistentArray<u64>&&)list);
+				model[key] = { u64(step) };
+			}
+
+			if (step % 499 == 0)
+			{
+				clones.push_back(map.clone());
+				cloneModels.push_back(model);
+			}
+			if (step % 1000 == 0)
+			{
+				ok = ok && matches(map, model);
+			}
+		}
+
+		for (size_t c = 0; c < clones.size(); ++c)
+		{
+			ok = ok && matches(clones[c], cloneModels[c]);
+		}
+
+		for (u64 key : keys)
+		{
+			map.erase(key);
+		}
+		ok = ok && map.size() == 0;
+	}
+
+	report("persistent hash map", ok && heap.liveAllocations() == 0);
+}
+
+// A transform sized value, tag tells which write it came from.
+struct CheckPod
+{
+	float x, y, z;
+	u32 tag;
+};
+
+// A float4 sized value, leaves must keep it as aligned as Math.h's types.
+struct alignas(16) CheckAlignedPod
+{
+	float x, y, z;
+	u32 tag;
+};
+
+using PodModel = std::map<u64, u32>;
+
+template<typename Pod>
+static bool aligned(const Pod* value)
+{
+	return uintptr_t(value) % alignof(Pod) == 0;
+}
+
+template<typename Pod>
+static bool matches(const TruthPodMap<Pod>& map, const PodModel& model)
+{
+	if (map.size() != model.size())
+	{
+		return false;
+	}
+
+	bool same = true;
+	auto it = model.begin();
+	map.forEach([&](truth::Key key, const Pod& value)
+	{
+		same = same && it != model.end() && it->first == key.asU64 && it->second == value.tag && aligned(&value);
+		it = it != model.end() ? std::next(it) : it;
+	});
+	same = same && it == model.end();
+
+	it = model.begin();
+	map.forEachChunk([&](const u64* keys, const Pod* values, u32 count)
+	{
+		same = same && aligned(values);
+		for (u32 i = 0; i < count; ++i)
+		{
+			same = same && it != model.end() && it->first == keys[i] && it->second == values[i].tag;
+			it = it != model.end() ? std::next(it) : it;
+		}
+	});
+	same = same && it == model.end();
+
+	for (const auto& entry : model)
+	{
+		const Pod* value = map.find(truth::Key{ entry.first });
+		same = same && value && value->tag == entry.second && aligned(value);
+	}
+
+	return same;
+}
+
+// Random sets and erases against a std::map. A third of the keys share their
+// top bits, which the trie consumes first, so their leaves split down to deep
+// levels. Clones kept along the way must not see later writes, and erasing
+// every key and dropping the clones has to give back every node and leaf.
+template<typename Pod>
+static void checkTruthPodMap(const char* name)
+{
+	constexpr i32 Keys = 20000;
+	constexpr i32 Steps = 300000;
+
+	CountingAllocator heap;
+	Xorshift rand;
+	bool ok = true;
+
+	{
+		std::vector<u64> keys;
+		for (i32 i = 0; i < Keys; ++i)
+		{
+			u64 key = rand.next();
+			if (i % 3 == 0)
+			{
+				key = (key & 0xfff0000000000000ULL) | (rand.next() & 0xffff);
+			}
+			keys.push_back(key);
+		}
+
+		TruthPodMap<Pod> map(&heap);
+		PodModel model;
+		std::vector<TruthPodMap<Pod>> clones;
+		std::vector<PodModel> cloneModels;
+
+		for (i32 step = 0; step < Steps; ++step)
+		{
+			u64 key = keys[size_t(rand.next() % keys.size())];
+			if (rand.next() % 4 != 0)
+			{
+				map.set(truth::Key{ key }, Pod{ 1.0f, 2.0f, 3.0f, u32(step) });
+				model[key] = u32(step);
+			}
+			else
+			{
+				map.erase(truth::Key{ key });
+				model.erase(key);
+			}
+
+			if (step % 9973 == 0)
+			{
+				clones.push_back(map.clone());
+				cloneModels.push_back(model);
+			}
+			if (step % 20000 == 0)
+			{
+				ok = ok && matches(map, model);
+			}
+		}
+
+		for (size_t c = 0; c < clones.size(); ++c)
+		{
+			ok = ok && matches(clones[c], cloneModels[c]);
+		}
+
+		for (u64 key : keys)
+		{
+			map.erase(truth::Key{ key });
+		}
+		ok = ok && map.size() == 0;
+	}
+
+	report(name, ok && heap.liveAllocations() == 0);
+}
+
+int main()
+{
+	checkPersistentArray();
+	checkPersistentHashMap();
+	checkTruthPodMap<CheckPod>("pod map");
+	checkTruthPodMap<CheckAlignedPod>("pod map, aligned values");
+
+	return s_failures;
+}
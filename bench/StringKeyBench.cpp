@@ -0,0 +1,110 @@
+// Names looked up through a HashMap keyed by their MetroHash64, the way string
+// tables were built so far, against a KeyedHashMap<StringView> that stores the
+// names and compares them on lookup.
+//
+// Both resolve every name once in a shuffled order from the caller's own
+// buffer, so the string table pays for hashing and comparing the characters
+// and the pre-hashed one only for hashing them.
+
+#include <chrono>
+#include <stdio.h>
+
+#include "../Core/HashMap.h"
+
+Allocator* GLOBAL_HEAP;
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+constexpr static i32 Count = 1000000;
+constexpr static i32 NameSize = 32;
+
+static double nanoseconds(std::chrono::steady_clock::time_point from)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - from).count();
+}
+
+int main()
+{
+	HeapAllocator heap;
+	Xorshift rand;
+
+	// Count names like "Entity_123456" back to back, NameSize bytes each
+	Array<char> names(&heap);
+	names.resize(Count * NameSize);
+	Array<u32> lengths(&heap);
+	for (i32 i = 0; i < Count; ++i)
+	{
+		lengths.push_back(u32(snprintf(&names[i * NameSize], NameSize, "Entity_%llu", (unsigned long long)(rand.next() % 100000000))));
+	}
+
+	Array<i32> order(&heap);
+	for (i32 i = 0; i < Count; ++i)
+	{
+		order.push_back(i);
+	}
+	for (i32 i = Count - 1; i > 0; --i)
+	{
+		i32 j = i32(rand.next() % u64(i + 1));
+		i32 swap = order[i];
+		order[i] = order[j];
+		order[j] = swap;
+	}
+
+	u64 sum = 0;
+
+	{
+		HashMap<i32> hashed(&heap);
+		auto insertStart = std::chrono::steady_clock::now();
+		for (i32 i = 0; i < Count; ++i)
+		{
+			hashed.insert_or_assign(MetroHash64::Hash(&names[i * NameSize], lengths[i]), i);
+		}
+		double insert = nanoseconds(insertStart) / Count;
+
+		auto findStart = std::chrono::steady_clock::now();
+		for (i32 i : order)
+		{
+			sum += *hashed.find(MetroHash64::Hash(&names[i * NameSize], lengths[i]));
+		}
+		double find = nanoseconds(findStart) / Count;
+
+		printf("pre-hashed u64  insert %6.1f ns | find %6.1f ns\n", insert, find);
+	}
+
+	{
+		KeyedHashMap<StringView, i32> strings(&heap);
+		auto insertStart = std::chrono::steady_clock::now();
+		for (i32 i = 0; i < Count; ++i)
+		{
+			strings.insert_or_assign(StringView(&names[i * NameSize], lengths[i]), i);
+		}
+		double insert = nanoseconds(insertStart) / Count;
+
+		auto findStart = std::chrono::steady_clock::now();
+		for (i32 i : order)
+		{
+			sum += *strings.find(StringView(&names[i * NameSize], lengths[i]));
+		}
+		double find = nanoseconds(findStart) / Count;
+
+		printf("StringView      insert %6.1f ns | find %6.1f ns\n", insert, find);
+	}
+
+	if (sum == 0)
+	{
+		printf("\n");
+	}
+
+	return 0;
+}
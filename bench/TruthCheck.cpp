@@ -0,0 +1,1154 @@
+// Checks of Truth against plain reference models, run by bench.bat with the
+// benchmarks. Every check prints one line, the exit code is the number of
+// checks that failed.
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <stdio.h>
+#include <thread>
+
+#include "../TruthView.h"
+
+Allocator* GLOBAL_HEAP;
+
+// Heap that keeps count of what is still allocated, from any thread.
+class CountingAllocator : public Allocator
+{
+public:
+	void* alloc(i32 size) override
+	{
+		m_liveAllocations.fetch_add(1, std::memory_order_relaxed);
+		return ::malloc(size);
+	}
+
+	void free(void* block) override
+	{
+		if (block)
+		{
+			m_liveAllocations.fetch_sub(1, std::memory_order_relaxed);
+			::free(block);
+		}
+	}
+
+	void freeSizeKnown(void* block, i32) override
+	{
+		free(block);
+	}
+
+	i64 liveAllocations() const { return m_liveAllocations.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<i64> m_liveAllocations{ 0 };
+};
+
+struct CheckObject : TruthObject
+{
+	u64 typeId() const override { return type; }
+
+	TruthObject* clone(Allocator* a) const override
+	{
+		CheckObject* copy = create<CheckObject>(a);
+		copy->root = root;
+		copy->value = value;
+		copy->type = type;
+		return copy;
+	}
+
+	u64 contentHash() const override { return truth::mixHash(value + 1) ^ type; }
+
+	u64 value = 0;
+	u64 type = 1;
+};
+
+// A field group holding memory of its own, the way Entity's groups do.
+struct CheckItems
+{
+	Array<u64> items;
+
+	CheckItems clone() const
+	{
+		CheckItems copy;
+		copy.items = items.clone();
+		return copy;
+	}
+
+	u64 contentHash() const
+	{
+		u64 hash = u64(items.size());
+		for (u64 item : items)
+		{
+			hash = truth::mixHash(hash + item);
+		}
+		return hash;
+	}
+};
+
+struct CheckName
+{
+	u64 value = 0;
+
+	u64 contentHash() const { return truth::mixHash(value + 1); }
+};
+
+enum CheckGroupsField : u32
+{
+	CheckField_Name = 1 << 0,
+	CheckField_Items = 1 << 1,
+};
+
+// Two groups like an Entity's name and hierarchy, the items are keys it refers to.
+struct CheckGroupsObject : TruthObject
+{
+	u64 typeId() const override { return 2; }
+
+	TruthObject* clone(Allocator* a) const override
+	{
+		CheckGroupsObject* copy = create<CheckGroupsObject>(a);
+		copy->root = root;
+		copy->name = name;
+		copy->items = items;
+		return copy;
+	}
+
+	u64 contentHash() const override { return truth::mixHash(name.contentHash() ^ items.contentHash()); }
+
+	void references(Array<truth::Key>& out) const override
+	{
+		for (u64 item : items->items)
+		{
+			out.push_back(truth::Key{ item });
+		}
+	}
+
+	u32 changedFields(const TruthObject* before) const override
+	{
+		if (before->typeId() != 2)
+		{
+			return ~0u;
+		}
+
+		const CheckGroupsObject* object = (const CheckGroupsObject*)before;
+
+		u32 fields = 0;
+		fields |= name.same(object->name) ? 0 : CheckField_Name;
+		fields |= items.same(object->items) ? 0 : CheckField_Items;
+
+		return fields;
+	}
+
+	u32 referenceFields() const override { return CheckField_Items; }
+
+	TruthField<CheckName> name;
+	TruthField<CheckItems> items;
+};
+
+// Refers to up to MaxLinks other keys.
+struct CheckLinkObject : TruthObject
+{
+	static constexpr u32 MaxLinks = 4;
+
+	u64 typeId() const override { return 3; }
+
+	TruthObject* clone(Allocator* a) const override
+	{
+		CheckLinkObject* copy = create<CheckLinkObject>(a);
+		copy->root = root;
+		copy->linkCount = linkCount;
+		memcpy(copy->links, links, sizeof(links));
+		return copy;
+	}
+
+	u64 contentHash() const override
+	{
+		u64 hash = linkCount;
+		for (u32 i = 0; i < linkCount; ++i)
+		{
+			hash = truth::mixHash(hash + links[i]);
+		}
+		return hash;
+	}
+
+	void references(Array<truth::Key>& out) const override
+	{
+		for (u32 i = 0; i < linkCount; ++i)
+		{
+			out.push_back(truth::Key{ links[i] });
+		}
+	}
+
+	u64 links[MaxLinks] = {};
+	u32 linkCount = 0;
+};
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+static i32 s_failures = 0;
+
+static void report(const char* name, bool ok)
+{
+	printf("%-28s %s\n", name, ok ? "ok" : "FAILED");
+	s_failures += ok ? 0 : 1;
+}
+
+static u64 valueOf(const TruthObject* object)
+{
+	return ((const CheckObject*)object)->value;
+}
+
+static CheckObject* makeObject(Allocator* allocator, u64 value)
+{
+	CheckObject* object = create<CheckObject>(allocator);
+	object->value = value;
+	return object;
+}
+
+static CheckGroupsObject* makeGroupsObject(Allocator* allocator)
+{
+	CheckGroupsObject* object = create<CheckGroupsObject>(allocator);
+	object->name.init(allocator);
+	object->items.init(allocator);
+	object->items.write().items.set_allocator(allocator);
+	return object;
+}
+
+// Same keys and values in snap as in model.
+static bool matches(ReadOnlySnapshot snap, const std::map<u64, u64>& model)
+{
+	if (snap.s->size() != model.size())
+	{
+		return false;
+	}
+
+	bool same = true;
+	auto it = model.begin();
+	snap.s->forEach([&](truth::Key key, TruthObject* value)
+	{
+		same = same && key.asU64 == it->first && valueOf(value) == it->second;
+		++it;
+	});
+
+	return same;
+}
+
+// Writers on several threads increment one counter object, each commit either
+// lands or reports the conflict. Readers check that head never goes back while
+// the owning thread collects, and afterwards only what the bounded history
+// holds is still allocated.
+static void checkConcurrentCommits()
+{
+	constexpr i32 Writers = 3;
+	constexpr i32 Readers = 3;
+	constexpr i32 CommitsPerWriter = 2000;
+
+	CountingAllocator heap;
+	Truth truth(&heap);
+	HistoryPolicy policy;
+	policy.maxUndoUnits = 16;
+	truth.setHistoryPolicy(policy);
+
+	truth::Key counter{ 1 };
+	truth.set(counter, create<CheckObject>(&heap));
+	i64 startAllocations = heap.liveAllocations();
+
+	std::atomic<i32> running{ Writers };
+	std::atomic<i32> succeeded{ 0 };
+	std::atomic<i32> wentBack{ 0 };
+
+	std::thread writers[Writers];
+	for (std::thread& writer : writers)
+	{
+		writer = std::thread([&]()
+		{
+			for (i32 i = 0; i < CommitsPerWriter; ++i)
+			{
+				Transaction tx = truth.openTransaction();
+				((CheckObject*)truth.edit(tx, counter))->value += 1;
+				if (truth.commit(tx))
+				{
+					succeeded.fetch_add(1);
+				}
+				else
+				{
+					truth.drop(tx);
+				}
+			}
+			running.fetch_sub(1);
+		});
+	}
+
+	std::thread readers[Readers];
+	for (std::thread& reader : readers)
+	{
+		reader = std::thread([&]()
+		{
+			u64 last = 0;
+			while (running.load() > 0)
+			{
+				Truth::ReadScope scope(truth);
+				u64 value = valueOf(truth.read(truth.head(), counter));
+				wentBack.fetch_add(value < last ? 1 : 0);
+				last = value;
+			}
+		});
+	}
+
+	while (running.load() > 0)
+	{
+		truth.collect();
+		std::this_thread::yield();
+	}
+
+	for (std::thread& writer : writers)
+	{
+		writer.join();
+	}
+	for (std::thread& reader : readers)
+	{
+		reader.join();
+	}
+
+	// with every scope closed two collects free everything the history let go
+	truth.collect();
+	truth.collect();
+
+	bool counted = valueOf(truth.read(truth.head(), counter)) == u64(succeeded.load());
+	bool bounded = heap.liveAllocations() - startAllocations <= (policy.maxUndoUnits + 1) * 8;
+	report("concurrent commits", counted && wentBack.load() == 0 && succeeded.load() > 0 && bounded);
+}
+
+// Two transactions opened on the same head touch disjoint keys and both land,
+// the second one replayed onto the first. Three more opened at the same time
+// edit and erase keys the first one edited and are rejected, one of them only
+// editing a key back to the content it had, which sealing no longer shows.
+static void checkRebase(const char* name, bool interning)
+{
+	constexpr i32 Keys = 1000;
+	constexpr i32 Rounds = 200;
+
+	HeapAllocator heap;
+	Truth truth(&heap);
+	truth.setInterning(interning);
+	Xorshift rand;
+	std::map<u64, u64> model;
+
+	Transaction load = truth.openTransaction();
+	for (i32 i = 0; i < Keys; ++i)
+	{
+		u64 key = rand.next();
+		model[key] = u64(i);
+		truth.add(load, truth::Key{ key }, makeObject(&heap, u64(i)));
+	}
+	truth.commit(load);
+
+	bool ok = true;
+	for (i32 round = 0; round < Rounds; ++round)
+	{
+		// seven distinct keys, a* for the first transaction and b* for the second
+		u64 picked[7];
+		for (i32 i = 0; i < 7; ++i)
+		{
+			bool taken = true;
+			while (taken)
+			{
+				auto it = model.lower_bound(rand.next());
+				picked[i] = it == model.end() ? model.begin()->first : it->first;
+
+				taken = false;
+				for (i32 j = 0; j < i; ++j)
+				{
+					taken = taken || picked[j] == picked[i];
+				}
+			}
+		}
+
+		u64 aEdit = picked[0], aErase = picked[1], aEdit2 = picked[2];
+		u64 bEdit = picked[3], bErase = picked[4], bEdit2 = picked[5], bSame = picked[6];
+		u64 aAdd = rand.next(), bAdd = rand.next();
+
+		Transaction a = truth.openTransaction();
+		Transaction b = truth.openTransaction();
+		Transaction c = truth.openTransaction();
+		Transaction d = truth.openTransaction();
+		Transaction e = truth.openTransaction();
+
+		((CheckObject*)truth.edit(a, truth::Key{ aEdit }))->value = rand.next();
+		((CheckObject*)truth.edit(a, truth::Key{ aEdit2 }))->value = rand.next();
+		truth.erase(a, truth::Key{ aErase });
+		truth.add(a, truth::Key{ aAdd }, makeObject(&heap, aAdd));
+
+		((CheckObject*)truth.edit(b, truth::Key{ bEdit }))->value = rand.next();
+		((CheckObject*)truth.edit(b, truth::Key{ bEdit2 }))->value = rand.next();
+		truth.erase(b, truth::Key{ bErase });
+		truth.add(b, truth::Key{ bAdd }, makeObject(&heap, bAdd));
+		truth.edit(b, truth::Key{ bSame });
+
+		((CheckObject*)truth.edit(c, truth::Key{ aEdit }))->value = rand.next();
+		truth.erase(d, truth::Key{ aEdit2 });
+		truth.edit(e, truth::Key{ aEdit });
+
+		for (u64 key : { aEdit, aEdit2 })
+		{
+			model[key] = valueOf(truth.read(a, truth::Key{ key }));
+		}
+		for (u64 key : { bEdit, bEdit2 })
+		{
+			model[key] = valueOf(truth.read(b, truth::Key{ key }));
+		}
+		model.erase(aErase);
+		model.erase(bErase);
+		model[aAdd] = aAdd;
+		model[bAdd] = bAdd;
+
+		ok = ok && truth.commit(a);
+		ok = ok && truth.commit(b);
+		ok = ok && !truth.commit(c);
+		ok = ok && !truth.commit(d);
+		ok = ok && !truth.commit(e);
+		truth.drop(c);
+		truth.drop(d);
+		truth.drop(e);
+
+		ok = ok && matches(truth.head(), model);
+		truth.collect();
+	}
+
+	report(name, ok);
+}
+
+// Fresh keys for a batch, a third of them sharing all but a few bits so they
+// land in the same leaves and force splits.
+static void freshKeys(Xorshift& rand, const std::map<u64, u64>& model, Array<truth::Key>& keys, i32 count)
+{
+	keys.clear();
+	std::map<u64, u64> taken;
+	while (keys.size() < count)
+	{
+		u64 key = rand.next();
+		if (keys.size() % 3 == 0)
+		{
+			key &= 0xffff000000ffffffULL;
+		}
+		if (model.count(key) == 0 && taken.count(key) == 0)
+		{
+			taken[key] = 0;
+			keys.push_back(truth::Key{ key });
+		}
+	}
+}
+
+// Batches of new keys through addMany, mixed with single adds and edits in the
+// same transactions, against a std::map. The head before each commit keeps
+// its contents. A Truth started from sorted entries matches them and takes
+// batches the same way.
+static void checkAddMany()
+{
+	constexpr i32 Batches[] = { 0, 1, 2, 31, 32, 33, 500, 5000 };
+	constexpr i32 Rounds = 60;
+
+	HeapAllocator heap;
+	Xorshift rand;
+
+	bool ok = true;
+	for (i32 start : { 0, 3000 })
+	{
+		std::map<u64, u64> model;
+		Array<truth::Key> keys(&heap);
+		freshKeys(rand, model, keys, start);
+
+		Array<KeyEntry> sorted(&heap);
+		for (truth::Key key : keys)
+		{
+			model[key.asU64] = key.asU64;
+		}
+		for (const auto& entry : model)
+		{
+			sorted.push_back(KeyEntry{ truth::Key{ entry.first }, makeObject(&heap, entry.second) });
+		}
+
+		Truth truth(&heap, sorted.data(), u32(sorted.size()));
+		ok = ok && matches(truth.head(), model);
+
+		Array<TruthObject*> objects(&heap);
+		for (i32 round = 0; round < Rounds; ++round)
+		{
+			i32 count = Batches[round % 8];
+			freshKeys(rand, model, keys, count);
+			objects.clear();
+			for (truth::Key key : keys)
+			{
+				objects.push_back(makeObject(&heap, rand.next()));
+			}
+
+			ReadOnlySnapshot before = truth.head();
+			truth.retain(before);
+			std::map<u64, u64> previous = model;
+
+			Transaction tx = truth.openTransaction();
+
+			// a single add before the batch and an edit after it
+			u64 single = rand.next() | 1;
+			if (model.count(single) == 0 && std::find(keys.begin(), keys.end(), truth::Key{ single }) == keys.end())
+			{
+				truth.add(tx, truth::Key{ single }, makeObject(&heap, single));
+				model[single] = single;
+			}
+
+			truth.addMany(tx, keys.data(), objects.data(), u32(count));
+			for (i32 i = 0; i < count; ++i)
+			{
+				model[keys[i].asU64] = valueOf(objects[i]);
+			}
+
+			if (!model.empty())
+			{
+				auto it = model.lower_bound(rand.next());
+				it = it == model.end() ? model.begin() : it;
+				((CheckObject*)truth.edit(tx, truth::Key{ it->first }))->value = round;
+				it->second = u64(round);
+			}
+
+			ok = ok && truth.commit(tx);
+			ok = ok && matches(truth.head(), model) && matches(before, previous);
+
+			truth.release(before);
+			truth.collect();
+		}
+	}
+
+	report("addMany and sorted start", ok);
+}
+
+// Objects made of field groups are edited in transactions, some committed and
+// some dropped. Their groups have to outlive the transaction arena, which
+// ASan catches when they do not.
+static void checkArenaEdits()
+{
+	constexpr i32 Objects = 200;
+	constexpr i32 Rounds = 2000;
+
+	HeapAllocator heap;
+	Truth truth(&heap);
+	Xorshift rand;
+	std::map<u64, Array<u64>> model;
+
+	Transaction load = truth.openTransaction();
+	for (i32 i = 0; i < Objects; ++i)
+	{
+		truth.add(load, truth::Key{ u64(i) }, makeGroupsObject(&heap));
+		model[u64(i)] = Array<u64>(&heap);
+	}
+	truth.commit(load);
+
+	bool ok = true;
+	for (i32 round = 0; round < Rounds; ++round)
+	{
+		u64 key = rand.next() % Objects;
+		u64 item = rand.next();
+		bool keep = rand.next() % 4 != 0;
+
+		Transaction tx = truth.openTransaction();
+		((CheckGroupsObject*)truth.edit(tx, truth::Key{ key }))->items.write().items.push_back(item);
+		if (keep && truth.commit(tx))
+		{
+			model[key].push_back(item);
+		}
+		else
+		{
+			truth.drop(tx);
+		}
+
+		const CheckGroupsObject* object = (const CheckGroupsObject*)truth.read(truth.head(), truth::Key{ key });
+		const Array<u64>& expected = model[key];
+		ok = ok && object->items->items.size() == expected.size();
+		for (i32 i = 0; ok && i < expected.size(); ++i)
+		{
+			ok = object->items->items[i] == expected[i];
+		}
+
+		truth.collect();
+	}
+
+	report("field groups outlive arena", ok);
+}
+
+static bool sameEntries(Array<KeyEntry>& a, Array<KeyEntry>& b)
+{
+	std::sort(a.begin(), a.end());
+	std::sort(b.begin(), b.end());
+
+	bool same = a.size() == b.size();
+	for (i32 i = 0; same && i < a.size(); ++i)
+	{
+		same = a[i].key == b[i].key && a[i].value == b[i].value;
+	}
+	return same;
+}
+
+static bool sameKeys(const Array<u64>& a, const Array<u64>& b)
+{
+	bool same = a.size() == b.size();
+	for (i32 i = 0; same && i < a.size(); ++i)
+	{
+		same = a[i] == b[i];
+	}
+	return same;
+}
+
+// One random step of an editing session: an add, edit, erase, undo or redo.
+// Objects take one of values values.
+static void randomStep(Truth& truth, Allocator* heap, Xorshift& rand, Array<truth::Key>& keys, u64 values)
+{
+	u64 op = rand.next() % 10;
+	if (op == 0)
+	{
+		truth.undo();
+		return;
+	}
+	if (op == 1)
+	{
+		if (truth.getReadIndex() + 1 < truth.undoUnits())
+		{
+			truth.setReadIndex(truth.getReadIndex() + 1);
+		}
+		return;
+	}
+
+	Transaction tx = truth.openTransaction();
+	truth::Key key = keys[i32(rand.next() % u64(keys.size()))];
+	if (op < 4 || truth.read(tx, key) == nullptr)
+	{
+		truth::Key added{ rand.next() };
+		keys.push_back(added);
+		truth.add(tx, added, makeObject(heap, rand.next() % values));
+	}
+	else if (op < 8)
+	{
+		((CheckObject*)truth.edit(tx, key))->value = rand.next() % values;
+	}
+	else
+	{
+		truth.erase(tx, key);
+	}
+
+	if (!truth.commit(tx))
+	{
+		truth.drop(tx);
+	}
+}
+
+// The change feed folded between two snapshots of the history against a diff
+// of the two, from each of the last few heads to the current one. With few
+// values edits often go back to content a snapshot already had.
+static void checkChangeFeed(const char* name, const HistoryPolicy& policy, u64 values, bool interning)
+{
+	constexpr i32 Steps = 20000;
+	constexpr i32 Kept = 8;
+
+	HeapAllocator heap;
+	Truth truth(&heap);
+	truth.setHistoryPolicy(policy);
+	truth.setInterning(interning);
+	Xorshift rand;
+
+	Array<truth::Key> keys(&heap);
+	Transaction load = truth.openTransaction();
+	for (i32 i = 0; i < 2000; ++i)
+	{
+		keys.push_back(truth::Key{ rand.next() });
+		truth.add(load, keys.back(), makeObject(&heap, rand.next() % values));
+	}
+	truth.commit(load);
+
+	ReadOnlySnapshot kept[Kept];
+	for (ReadOnlySnapshot& snap : kept)
+	{
+		snap = truth.head();
+		truth.retain(snap);
+	}
+
+	bool ok = true;
+	i32 compared = 0;
+	for (i32 step = 0; step < Steps; ++step)
+	{
+		randomStep(truth, &heap, rand, keys, values);
+
+		ReadOnlySnapshot from = kept[rand.next() % Kept];
+		Array<KeyEntry> adds(&heap), edits(&heap), removes(&heap);
+		if (truth.changes(from, truth.head(), adds, edits, removes))
+		{
+			Array<KeyEntry> diffAdds(&heap), diffEdits(&heap), diffRemoves(&heap);
+			diff(from.s, truth.head().s, diffAdds, diffEdits, diffRemoves);
+
+			ok = ok && sameEntries(adds, diffAdds) && sameEntries(edits, diffEdits) && sameEntries(removes, diffRemoves);
+			++compared;
+		}
+
+		ReadOnlySnapshot& oldest = kept[step % Kept];
+		truth.release(oldest);
+		oldest = truth.head();
+		truth.retain(oldest);
+
+		truth.collect();
+	}
+
+	for (ReadOnlySnapshot& snap : kept)
+	{
+		truth.release(snap);
+	}
+
+	report(name, ok && compared > Steps / 2);
+}
+
+// An edit and its revert give a head equal by content to the one before, with
+// interning the very same root node.
+static void checkEditRevert()
+{
+	HeapAllocator heap;
+	Truth truth(&heap);
+	truth.setInterning(true);
+	Xorshift rand;
+
+	Array<truth::Key> keys(&heap);
+	Transaction load = truth.openTransaction();
+	for (i32 i = 0; i < 20000; ++i)
+	{
+		keys.push_back(truth::Key{ rand.next() });
+		truth.add(load, keys.back(), makeObject(&heap, u64(i)));
+	}
+	truth.commit(load);
+
+	ReadOnlySnapshot before = truth.head();
+	truth.retain(before);
+
+	truth::Key key = keys[5];
+	Transaction edit = truth.openTransaction();
+	((CheckObject*)truth.edit(edit, key))->value = ~u64(0);
+	truth.commit(edit);
+	bool changed = !truth.sameContent(before, truth.head());
+
+	Transaction revert = truth.openTransaction();
+	((CheckObject*)truth.edit(revert, key))->value = 5;
+	truth.commit(revert);
+
+	Array<KeyEntry> adds(&heap), edits(&heap), removes(&heap);
+	diff(before.s, truth.head().s, adds, edits, removes);
+
+	bool same = truth.sameContent(before, truth.head()) && before.s->root() == truth.head().s->root();
+	report("edit and revert", changed && same && adds.size() + edits.size() + removes.size() == 0);
+
+	truth.release(before);
+}
+
+// forEachOfType against a filtered walk of the whole map, for every type in
+// use and one that is not, after each step of a session that also changes
+// objects' types.
+static void checkTypeIndex(const char* name, bool interning)
+{
+	constexpr i32 Types = 4;
+	constexpr i32 Steps = 3000;
+
+	HeapAllocator heap;
+	Truth truth(&heap);
+	HistoryPolicy policy;
+	policy.maxUndoUnits = 4;
+	truth.setHistoryPolicy(policy);
+	Xorshift rand;
+
+	Array<truth::Key> keys(&heap);
+	Transaction load = truth.openTransaction();
+	for (i32 i = 0; i < 5000; ++i)
+	{
+		CheckObject* object = makeObject(&heap, rand.next());
+		object->type = 1 + rand.next() % (Types - 1);
+		keys.push_back(truth::Key{ rand.next() });
+		truth.add(load, keys.back(), object);
+	}
+	truth.commit(load);
+
+	truth.enableTypeIndex();
+	truth.setInterning(interning);
+
+	bool ok = true;
+	for (i32 step = 0; step < Steps; ++step)
+	{
+		Transaction tx = truth.openTransaction();
+		truth::Key key = keys[i32(rand.next() % u64(keys.size()))];
+		u64 op = rand.next() % 5;
+		if (op == 0 || truth.read(tx, key) == nullptr)
+		{
+			CheckObject* object = makeObject(&heap, rand.next());
+			object->type = 1 + rand.next() % Types;
+			keys.push_back(truth::Key{ rand.next() });
+			truth.add(tx, keys.back(), object);
+		}
+		else if (op == 1)
+		{
+			((CheckObject*)truth.edit(tx, key))->value = rand.next();
+		}
+		else if (op == 2)
+		{
+			((CheckObject*)truth.edit(tx, key))->type = 1 + rand.next() % Types;
+		}
+		else
+		{
+			truth.erase(tx, key);
+		}
+		truth.commit(tx);
+
+		if (rand.next() % 8 == 0)
+		{
+			truth.undo();
+		}
+
+		ReadOnlySnapshot head = truth.head();
+		for (u64 type = 1; type <= Types + 1; ++type)
+		{
+			Array<u64> indexed(&heap);
+			Array<u64> walked(&heap);
+			truth.forEachOfType(head, type, [&](truth::Key key, const TruthObject*) { indexed.push_back(key.asU64); });
+			head.s->forEach([&](truth::Key key, const TruthObject* object)
+			{
+				if (object->typeId() == type)
+				{
+					walked.push_back(key.asU64);
+				}
+			});
+
+			ok = ok && sameKeys(indexed, walked);
+		}
+
+		truth.collect();
+	}
+
+	report(name, ok);
+}
+
+static void randomLinks(CheckLinkObject* object, Xorshift& rand, const Array<truth::Key>& keys)
+{
+	object->linkCount = u32(rand.next() % (CheckLinkObject::MaxLinks + 1));
+	for (u32 i = 0; i < object->linkCount; ++i)
+	{
+		object->links[i] = keys[i32(rand.next() % u64(keys.size()))].asU64;
+	}
+}
+
+// forEachReferrer against a scan of every object's links, for a sample of keys
+// after each step of a session that adds, relinks and erases objects.
+static void checkReferenceIndex(const char* name, bool interning)
+{
+	constexpr i32 Steps = 3000;
+	constexpr i32 Samples = 20;
+
+	HeapAllocator heap;
+	Truth truth(&heap);
+	HistoryPolicy policy;
+	policy.maxUndoUnits = 4;
+	truth.setHistoryPolicy(policy);
+	Xorshift rand;
+
+	Array<truth::Key> keys(&heap);
+	for (i32 i = 0; i < 3000; ++i)
+	{
+		keys.push_back(truth::Key{ rand.next() });
+	}
+
+	Transaction load = truth.openTransaction();
+	for (truth::Key key : keys)
+	{
+		CheckLinkObject* object = create<CheckLinkObject>(&heap);
+		randomLinks(object, rand, keys);
+		truth.add(load, key, object);
+	}
+	truth.commit(load);
+
+	truth.enableReferenceIndex();
+	truth.setInterning(interning);
+
+	bool ok = true;
+	for (i32 step = 0; step < Steps; ++step)
+	{
+		Transaction tx = truth.openTransaction();
+		truth::Key key = keys[i32(rand.next() % u64(keys.size()))];
+		u64 op = rand.next() % 4;
+		if (op == 0 || truth.read(tx, key) == nullptr)
+		{
+			CheckLinkObject* object = create<CheckLinkObject>(&heap);
+			randomLinks(object, rand, keys);
+			keys.push_back(truth::Key{ rand.next() });
+			truth.add(tx, keys.back(), object);
+		}
+		else if (op == 1)
+		{
+			randomLinks((CheckLinkObject*)truth.edit(tx, key), rand, keys);
+		}
+		else
+		{
+			truth.erase(tx, key);
+		}
+		truth.commit(tx);
+
+		if (rand.next() % 8 == 0)
+		{
+			truth.undo();
+		}
+
+		ReadOnlySnapshot head = truth.head();
+		for (i32 sample = 0; sample < Samples; ++sample)
+		{
+			u64 target = keys[i32(rand.next() % u64(keys.size()))].asU64;
+
+			Array<u64> indexed(&heap);
+			Array<u64> scanned(&heap);
+			truth.forEachReferrer(head, truth::Key{ target }, [&](truth::Key referrer) { indexed.push_back(referrer.asU64); });
+			head.s->forEach([&](truth::Key key, const TruthObject* object)
+			{
+				const CheckLinkObject* links = (const CheckLinkObject*)object;
+				bool refers = false;
+				for (u32 i = 0; i < links->linkCount; ++i)
+				{
+					refers = refers || links->links[i] == target;
+				}
+				if (refers)
+				{
+					scanned.push_back(key.asU64);
+				}
+			});
+
+			ok = ok && sameKeys(indexed, scanned);
+		}
+
+		truth.collect();
+	}
+
+	report(name, ok);
+}
+
+// Full cursor walks against the sorted keys, and range walks against a
+// filtered scan, on maps from empty to deep. A third of the keys share all but
+// a few bits so they force splits down to the last levels.
+static void checkCursor()
+{
+	constexpr i32 Counts[] = { 0, 1, 5, 64, 65, 300, 5000, 200000 };
+	constexpr i32 Ranges = 200;
+
+	HeapAllocator heap;
+	Xorshift rand;
+
+	bool ok = true;
+	for (i32 count : Counts)
+	{
+		Truth truth(&heap);
+
+		Array<u64> keys(&heap);
+		Transaction load = truth.openTransaction();
+		for (i32 i = 0; i < count; ++i)
+		{
+			u64 key = rand.next();
+			if (i % 3 == 0)
+			{
+				key &= 0xffff000000ffffffULL;
+			}
+
+			if (truth.read(load, truth::Key{ key }) == nullptr)
+			{
+				keys.push_back(key);
+				truth.add(load, truth::Key{ key }, makeObject(&heap, key));
+			}
+		}
+		truth.commit(load);
+		std::sort(keys.begin(), keys.end());
+
+		Array<u64> walked(&heap);
+		for (TruthCursor cursor(truth.head().s); cursor.valid(); cursor.next())
+		{
+			walked.push_back(cursor.key().asU64);
+			ok = ok && valueOf(cursor.value()) == cursor.key().asU64;
+		}
+		ok = ok && sameKeys(walked, keys);
+
+		for (i32 r = 0; r < Ranges; ++r)
+		{
+			u64 first = rand.next();
+			u64 last = rand.next();
+
+			// some ranges start right on a key
+			if (r % 4 == 0 && count > 0)
+			{
+				first = keys[i32(rand.next() % u64(keys.size()))];
+			}
+			if (first > last)
+			{
+				u64 swap = first;
+				first = last;
+				last = swap;
+			}
+
+			Array<u64> ranged(&heap);
+			for (TruthCursor cursor(truth.head().s, truth::Key{ first }, truth::Key{ last }); cursor.valid(); cursor.next())
+			{
+				ranged.push_back(cursor.key().asU64);
+			}
+
+			Array<u64> filtered(&heap);
+			for (u64 key : keys)
+			{
+				if (key >= first && key < last)
+				{
+					filtered.push_back(key);
+				}
+			}
+
+			ok = ok && sameKeys(ranged, filtered);
+		}
+	}
+
+	report("cursor walks and ranges", ok);
+}
+
+static const CheckGroupsObject* readGroups(ReadOnlySnapshot snap, truth::Key key)
+{
+	return (const CheckGroupsObject*)snap.s->find(key);
+}
+
+// Renames and relinks of objects made of two groups. An edit copies only the
+// group it wrote, changedFields names exactly that group, the snapshot before
+// keeps its contents and undo gets back to it. Renames skip the reference
+// index, which has to agree with a scan of the items either way.
+static void checkFieldGroups()
+{
+	constexpr i32 Objects = 300;
+	constexpr i32 Steps = 3000;
+	constexpr i32 Samples = 10;
+
+	HeapAllocator heap;
+	Truth truth(&heap);
+	Xorshift rand;
+
+	Array<truth::Key> keys(&heap);
+	Transaction load = truth.openTransaction();
+	for (i32 i = 0; i < Objects; ++i)
+	{
+		keys.push_back(truth::Key{ rand.next() });
+		CheckGroupsObject* object = makeGroupsObject(&heap);
+		object->name.write().value = u64(i);
+		truth.add(load, keys.back(), object);
+	}
+	for (truth::Key key : keys)
+	{
+		CheckGroupsObject* object = (CheckGroupsObject*)truth.edit(load, key);
+		for (i32 i = 0; i < 3; ++i)
+		{
+			object->items.write().items.push_back(keys[i32(rand.next() % u64(Objects))].asU64);
+		}
+	}
+	truth.commit(load);
+	truth.enableReferenceIndex();
+
+	bool ok = true;
+	for (i32 step = 0; step < Steps; ++step)
+	{
+		ReadOnlySnapshot before = truth.head();
+		truth.retain(before);
+
+		truth::Key key = keys[i32(rand.next() % u64(Objects))];
+		const CheckGroupsObject* old = readGroups(before, key);
+		u64 oldName = old->name->value;
+		i32 oldItems = old->items->items.size();
+
+		bool rename = rand.next() % 2 == 0;
+		Transaction tx = truth.openTransaction();
+		CheckGroupsObject* object = (CheckGroupsObject*)truth.edit(tx, key);
+		ok = ok && object->name.same(old->name) && object->items.same(old->items);
+		if (rename)
+		{
+			object->name.write().value = rand.next();
+		}
+		else
+		{
+			object->items.write().items.push_back(keys[i32(rand.next() % u64(Objects))].asU64);
+		}
+		truth.commit(tx);
+
+		const CheckGroupsObject* now = readGroups(truth.head(), key);
+		ok = ok && now->changedFields(old) == (rename ? CheckField_Name : CheckField_Items);
+		ok = ok && old->name->value == oldName && old->items->items.size() == oldItems;
+
+		for (i32 sample = 0; sample < Samples; ++sample)
+		{
+			u64 target = keys[i32(rand.next() % u64(Objects))].asU64;
+
+			Array<u64> indexed(&heap);
+			Array<u64> scanned(&heap);
+			truth.forEachReferrer(truth.head(), truth::Key{ target }, [&](truth::Key referrer) { indexed.push_back(referrer.asU64); });
+			truth.head().s->forEach([&](truth::Key referrer, const TruthObject* value)
+			{
+				const Array<u64>& items = ((const CheckGroupsObject*)value)->items->items;
+				if (std::find(items.begin(), items.end(), target) != items.end())
+				{
+					scanned.push_back(referrer.asU64);
+				}
+			});
+
+			ok = ok && sameKeys(indexed, scanned);
+		}
+
+		if (rand.next() % 4 == 0)
+		{
+			truth.undo();
+			ok = ok && truth.sameContent(before, truth.head());
+		}
+
+		truth.release(before);
+		truth.collect();
+	}
+
+	report("field groups copied on write", ok);
+}
+
+int main()
+{
+	checkConcurrentCommits();
+	checkRebase("rebase on disjoint keys", false);
+	checkRebase("rebase, interned", true);
+	checkAddMany();
+	checkArenaEdits();
+	checkFieldGroups();
+
+	HistoryPolicy unbounded;
+	checkChangeFeed("change feed, full history", unbounded, ~u64(0), false);
+
+	HistoryPolicy capped;
+	capped.maxUndoUnits = 4;
+	checkChangeFeed("change feed, 4 undo units", capped, ~u64(0), false);
+
+	HistoryPolicy coalesced;
+	coalesced.keepRecent = 4;
+	coalesced.coalesceCommits = 3;
+	checkChangeFeed("change feed, coalesced", coalesced, ~u64(0), false);
+
+	checkEditRevert();
+	checkChangeFeed("change feed, reverts", capped, 4, false);
+	checkChangeFeed("change feed, interned", capped, 4, true);
+
+	checkTypeIndex("type index", false);
+	checkTypeIndex("type index, interned", true);
+
+	checkReferenceIndex("reference index", false);
+	checkReferenceIndex("reference index, interned", true);
+
+	checkCursor();
+
+	return s_failures;
+}
@@ -0,0 +1,121 @@
+// TruthMap insert and lookup cost as the map grows from 1k to 10M keys.
+//
+// Each row loads Count random keys through add() in one transaction, then
+// commits Commits single key inserts on top of it the way an edit lands in a
+// big scene, and finally reads every key back in a shuffled order. With the
+// trie every cost follows its depth, one level per 32x more keys, and the
+// cache misses a bigger map takes, instead of the number of keys.
+
+#include <chrono>
+#include <stdio.h>
+
+#include "../TruthView.h"
+
+Allocator* GLOBAL_HEAP;
+
+struct BenchObject : TruthObject
+{
+	u64 typeId() const override { return 1; }
+
+	TruthObject* clone(Allocator* a) const override
+	{
+		BenchObject* copy = create<BenchObject>(a);
+		copy->root = root;
+		copy->value = value;
+		return copy;
+	}
+
+	u64 contentHash() const override { return truth::mixHash(value); }
+
+	u64 value = 0;
+};
+
+struct Xorshift
+{
+	u64 next()
+	{
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+
+	u64 s = 0x2545f4914f6cdd1dULL;
+};
+
+constexpr static i32 Counts[] = { 1000, 10000, 100000, 1000000, 10000000 };
+constexpr static i32 Commits = 1000;
+
+static double nanoseconds(std::chrono::steady_clock::time_point from)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - from).count();
+}
+
+static void run(i32 count)
+{
+	HeapAllocator heap;
+	Xorshift rand;
+
+	Array<truth::Key> keys(&heap);
+	for (i32 i = 0; i < count; ++i)
+	{
+		keys.push_back(truth::Key{ rand.next() });
+	}
+
+	Truth truth(&heap);
+
+	auto loadStart = std::chrono::steady_clock::now();
+	Transaction load = truth.openTransaction();
+	for (i32 i = 0; i < count; ++i)
+	{
+		BenchObject* object = create<BenchObject>(&heap);
+		object->value = u64(i);
+		truth.add(load, keys[i], object);
+	}
+	truth.commit(load);
+	double loadTime = nanoseconds(loadStart) / count;
+
+	auto commitStart = std::chrono::steady_clock::now();
+	for (i32 c = 0; c < Commits; ++c)
+	{
+		BenchObject* object = create<BenchObject>(&heap);
+		object->value = u64(c);
+		truth.set(truth::Key{ rand.next() }, object);
+		truth.collect();
+	}
+	double commitTime = nanoseconds(commitStart) / Commits;
+
+	for (i32 i = count - 1; i > 0; --i)
+	{
+		i32 j = i32(rand.next() % u64(i + 1));
+		truth::Key swap = keys[i];
+		keys[i] = keys[j];
+		keys[j] = swap;
+	}
+
+	ReadOnlySnapshot head = truth.head();
+	u64 sum = 0;
+	auto findStart = std::chrono::steady_clock::now();
+	for (truth::Key key : keys)
+	{
+		sum += ((const BenchObject*)truth.read(head, key))->value;
+	}
+	double findTime = nanoseconds(findStart) / count;
+
+	printf("%9d keys | add %7.1f ns | single key commit %8.1f ns | find %7.1f ns\n", count, loadTime, commitTime, findTime);
+
+	if (sum == 0)
+	{
+		printf("\n");
+	}
+}
+
+int main()
+{
+	for (i32 count : Counts)
+	{
+		run(count);
+	}
+
+	return 0;
+}